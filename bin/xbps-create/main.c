@@ -41,6 +41,7 @@
 #include <libgen.h>
 #include <locale.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include <xbps.h>
 #include "queue.h"
@@ -58,18 +59,19 @@
 
 struct xentry {
 	TAILQ_ENTRY(xentry) entries;
+	struct xentry *hash_next;
 	uint64_t mtime;
 	uint64_t size;
 	char *file, *type, *target, *hash;
-	ino_t inode;
+	int hash_rv;
 };
 
 static TAILQ_HEAD(xentry_head, xentry) xentry_list =
     TAILQ_HEAD_INITIALIZER(xentry_list);
 
 static uint64_t instsize;
-static xbps_dictionary_t pkg_propsd, pkg_filesd, all_filesd;
-static const char *destdir;
+static xbps_dictionary_t pkg_propsd, pkg_filesd;
+static const char *destdir, *digest;
 
 static void __attribute__((noreturn))
 usage(void)
@@ -88,6 +90,8 @@ usage(void)
 	"                     e.g '/etc/foo.conf /etc/foo-blah.conf').\n"
 	" -H --homepage       Homepage.\n"
 	" -h --help           Show help.\n"
+	" -j --threads        Number of compression threads for xz and zstd,\n"
+	"                     0 to use all CPUs (default: $XBPS_COMPRESS_THREADS or 1).\n"
 	" -l --license        License.\n"
 	" -M --mutable-files  Mutable files list (blank separated list,\n"
 	"                     e.g: '/usr/lib/foo /usr/bin/blah').\n"
@@ -110,10 +114,14 @@ usage(void)
 	"                     'vi:/usr/bin/vi:/usr/bin/vim foo:/usr/bin/foo:/usr/bin/blah'.\n"
 	" --build-options     A string with the used build options.\n"
 	" --compression       Compression format: none, gzip, bzip2, lz4, zstd, xz (default).\n"
+	" --digest            Files digest: sha256 (default), blake2b.\n"
+	" --seekable          Compress in zstd frames with a trailing member index.\n"
 	" --shlib-provides    List of provided shared libraries (blank separated list,\n"
 	"                     e.g 'libfoo.so.1 libblah.so.2').\n"
 	" --shlib-requires    List of required shared libraries (blank separated list,\n"
-	"                     e.g 'libfoo.so.1 libblah.so.2').\n\n"
+	"                     e.g 'libfoo.so.1 libblah.so.2').\n"
+	" --triggers          List of triggers to run once per transaction (blank\n"
+	"                     separated list, e.g 'gtk-icon-cache mimedb').\n\n"
 	"NOTE:\n"
 	" At least three flags are required: architecture, pkgver and desc.\n\n"
 	"EXAMPLE:\n"
@@ -136,6 +144,90 @@ die(const char *fmt, ...)
 	exit(EXIT_FAILURE);
 }
 
+/*
+ * Simple hash set of strings, used to find hardlinks by device and
+ * inode and to match mutable files by path in constant time.
+ */
+struct strset_entry {
+	struct strset_entry *next;
+	char str[];
+};
+
+struct strset {
+	struct strset_entry **buckets;
+	size_t nbuckets, count;
+};
+
+static struct strset hardlinks, mutables;
+
+static size_t
+strset_hash(const char *str)
+{
+	size_t h = 2166136261U;
+
+	/* FNV-1a */
+	for (; *str; str++) {
+		h ^= (unsigned char)*str;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static bool
+strset_has(struct strset *set, const char *str)
+{
+	struct strset_entry *e;
+
+	if (set->count == 0)
+		return false;
+	e = set->buckets[strset_hash(str) & (set->nbuckets - 1)];
+	for (; e; e = e->next) {
+		if (strcmp(e->str, str) == 0)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Adds str to set, returns false if it was already there.
+ */
+static bool
+strset_add(struct strset *set, const char *str)
+{
+	struct strset_entry *e, *next, **buckets;
+	size_t b, len;
+
+	if (strset_has(set, str))
+		return false;
+
+	if (set->count >= set->nbuckets) {
+		/* grow and rehash */
+		b = set->nbuckets ? set->nbuckets * 2 : 256;
+		buckets = calloc(b, sizeof(*buckets));
+		assert(buckets);
+		for (size_t i = 0; i < set->nbuckets; i++) {
+			for (e = set->buckets[i]; e; e = next) {
+				next = e->next;
+				e->next = buckets[strset_hash(e->str) & (b - 1)];
+				buckets[strset_hash(e->str) & (b - 1)] = e;
+			}
+		}
+		free(set->buckets);
+		set->buckets = buckets;
+		set->nbuckets = b;
+	}
+	len = strlen(str) + 1;
+	e = malloc(sizeof(*e) + len);
+	assert(e);
+	memcpy(e->str, str, len);
+	b = strset_hash(str) & (set->nbuckets - 1);
+	e->next = set->buckets[b];
+	set->buckets[b] = e;
+	set->count++;
+
+	return true;
+}
+
 static void
 process_array(const char *key, const char *val)
 {
@@ -302,11 +394,111 @@ entry_is_conf_file(const char *file)
 	return false;
 }
 
+/*
+ * Regular files are hashed by a pool of threads while the destdir
+ * is being walked; every file is read exactly once. Results are
+ * stored in the xentry and checked once the walk has finished.
+ */
+static struct {
+	pthread_t *thds;
+	unsigned int nthreads;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	struct xentry *head, *tail;
+	bool done;
+} hashq = {
+	.mtx = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void
+hash_xentry(struct xentry *xe)
+{
+	if ((xe->hash = xbps_file_digest(xe->file, digest)) == NULL)
+		xe->hash_rv = errno;
+}
+
+static void *
+hash_thread(void *arg UNUSED)
+{
+	struct xentry *xe;
+
+	for (;;) {
+		pthread_mutex_lock(&hashq.mtx);
+		while (hashq.head == NULL && !hashq.done)
+			pthread_cond_wait(&hashq.cond, &hashq.mtx);
+		if ((xe = hashq.head) != NULL) {
+			if ((hashq.head = xe->hash_next) == NULL)
+				hashq.tail = NULL;
+		}
+		pthread_mutex_unlock(&hashq.mtx);
+		if (xe == NULL)
+			break;
+		hash_xentry(xe);
+	}
+	return NULL;
+}
+
+static void
+hash_start(void)
+{
+	long maxthreads;
+
+	maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (maxthreads <= 1)
+		return;
+
+	hashq.thds = calloc(maxthreads, sizeof(*hashq.thds));
+	assert(hashq.thds);
+	for (; hashq.nthreads < (unsigned int)maxthreads; hashq.nthreads++) {
+		if (pthread_create(&hashq.thds[hashq.nthreads], NULL,
+		    hash_thread, NULL) != 0)
+			break;
+	}
+}
+
+static void
+hash_queue(struct xentry *xe)
+{
+	if (hashq.nthreads == 0) {
+		hash_xentry(xe);
+		return;
+	}
+	pthread_mutex_lock(&hashq.mtx);
+	if (hashq.tail)
+		hashq.tail->hash_next = xe;
+	else
+		hashq.head = xe;
+	hashq.tail = xe;
+	pthread_cond_signal(&hashq.cond);
+	pthread_mutex_unlock(&hashq.mtx);
+}
+
+static void
+hash_finish(void)
+{
+	struct xentry *xe;
+
+	pthread_mutex_lock(&hashq.mtx);
+	hashq.done = true;
+	pthread_cond_broadcast(&hashq.cond);
+	pthread_mutex_unlock(&hashq.mtx);
+	for (unsigned int i = 0; i < hashq.nthreads; i++)
+		pthread_join(hashq.thds[i], NULL);
+	free(hashq.thds);
+
+	TAILQ_FOREACH(xe, &xentry_list, entries) {
+		if (xe->hash_rv != 0) {
+			errno = xe->hash_rv;
+			die("failed to process hash for %s:", xe->file);
+		}
+	}
+}
+
 static int
 ftw_cb(const char *fpath, const struct stat *sb, const struct dirent *dir UNUSED)
 {
 	struct xentry *xe = NULL;
-	xbps_dictionary_t fileinfo = NULL;
 	const char *filep = NULL;
 	char *buf, *p, *p2, *dname;
 	ssize_t r;
@@ -325,24 +517,14 @@ ftw_cb(const char *fpath, const struct stat *sb, const struct dirent *dir UNUSED
 
 	/* sanitized file path */
 	filep = strchr(fpath, '.') + 1;
-	fileinfo = xbps_dictionary_create();
 	xe = calloc(1, sizeof(*xe));
 	assert(xe);
-	/* XXX: fileinfo contains the sanatized path, whereas xe contains the
-	 * unsanatized path!
-	 *
-	 * when handing the files over, do not use the dictionary directly. Instead
-	 * use the keysym, as this value has the unsanatized path.
-	 */
-	xbps_dictionary_set_cstring(fileinfo, "file", filep);
-	xbps_dictionary_set(all_filesd, fpath, fileinfo);
 	xe->file = strdup(fpath);
 	assert(xe->file);
 
 	if ((strcmp(fpath, "./INSTALL") == 0) ||
 	    (strcmp(fpath, "./REMOVE") == 0)) {
 		/* metadata file */
-		xbps_dictionary_set_cstring_nocopy(fileinfo, "type", "metadata");
 		xe->type = strdup("metadata");
 		assert(xe->type);
 		goto out;
@@ -354,13 +536,10 @@ ftw_cb(const char *fpath, const struct stat *sb, const struct dirent *dir UNUSED
 		 *
 		 * Find out target file.
 		 */
-		xbps_dictionary_set_cstring_nocopy(fileinfo, "type", "links");
 		xe->type = strdup("links");
 		assert(xe->type);
 		/* store modification time for regular files and links */
-		xbps_dictionary_set_cstring_nocopy(fileinfo, "type", "links");
 		xe->mtime = (uint64_t)sb->st_mtime;
-		xbps_dictionary_set_uint64(fileinfo, "mtime", (uint64_t)sb->st_mtime);
 		buf = malloc(sb->st_size+1);
 		assert(buf);
 		r = readlink(fpath, buf, sb->st_size+1);
@@ -381,7 +560,6 @@ ftw_cb(const char *fpath, const struct stat *sb, const struct dirent *dir UNUSED
 				 * So let's use the same target.
 				 */
 				xe->target = strdup(buf);
-				xbps_dictionary_set_cstring(fileinfo, "target", buf);
 			} else {
 				/*
 				 * Sanitize destdir just in case.
@@ -390,7 +568,6 @@ ftw_cb(const char *fpath, const struct stat *sb, const struct dirent *dir UNUSED
 					die("failed to sanitize destdir %s: %s", destdir, strerror(errno));
 
 				xe->target = strdup(p+strlen(p2));
-				xbps_dictionary_set_cstring(fileinfo, "target", p+strlen(p2));
 				free(p2);
 				free(p);
 			}
@@ -401,84 +578,48 @@ ftw_cb(const char *fpath, const struct stat *sb, const struct dirent *dir UNUSED
 			dname = dirname(p);
 			assert(dname);
 			xe->target = xbps_xasprintf("%s/%s", dname, buf);
-			p2 = xbps_xasprintf("%s/%s", dname, buf);
-			xbps_dictionary_set_cstring(fileinfo, "target", p2);
-			free(p2);
 			free(p);
 		} else {
 			xe->target = strdup(buf);
-			xbps_dictionary_set_cstring(fileinfo, "target", buf);
 		}
 		assert(xe->target);
-		assert(xbps_dictionary_get(fileinfo, "target"));
 		free(buf);
 	} else if (S_ISREG(sb->st_mode)) {
-		struct xentry *xep;
-		bool hlink = false;
-		xbps_object_iterator_t iter;
-		xbps_object_t obj;
-		xbps_dictionary_t linkinfo;
-		uint64_t inode = 0;
+		char key[64];
 		/*
 		 * Regular files. First find out if it's a hardlink:
 		 * 	- st_nlink > 1
-		 * and then search for a stored file matching its inode.
+		 * and then search for a stored file matching its
+		 * device and inode; only the first one is accounted.
 		 */
-		TAILQ_FOREACH(xep, &xentry_list, entries) {
-			if (sb->st_nlink > 1 && xep->inode == sb->st_ino) {
-				hlink = true;
-				break;
-			}
-		}
-
-		iter = xbps_dictionary_iterator(all_filesd);
-		assert(iter);
-		while ((obj = xbps_object_iterator_next(iter))) {
-			if (sb->st_nlink <= 1)
-				continue;
-			linkinfo = xbps_dictionary_get_keysym(all_filesd, obj);
-			xbps_dictionary_get_uint64(linkinfo, "inode", &inode);
-			if (inode == sb->st_ino) {
-				break;
-			}
-		}
-		if (!hlink != (inode != sb->st_ino))
-			die("Inconsistent results from xbps_dictionary_t and linked list!\n");
-
-		if (inode != sb->st_ino)
+		if (sb->st_nlink > 1) {
+			snprintf(key, sizeof(key), "%ju:%ju",
+			    (uintmax_t)sb->st_dev, (uintmax_t)sb->st_ino);
+			if (strset_add(&hardlinks, key))
+				instsize += sb->st_size;
+		} else {
 			instsize += sb->st_size;
-		xbps_object_iterator_release(iter);
+		}
 
 		/*
 		 * Find out if it's a configuration file or not
-		 * and calculate sha256 hash.
+		 * and queue it to calculate its hash.
 		 */
-		if (entry_is_conf_file(filep)) {
-			xbps_dictionary_set_cstring_nocopy(fileinfo, "type", "conf_files");
+		if (entry_is_conf_file(filep))
 			xe->type = strdup("conf_files");
-		} else {
-			xbps_dictionary_set_cstring_nocopy(fileinfo, "type", "files");
+		else
 			xe->type = strdup("files");
-		}
 
 		assert(xe->type);
-		if ((p = xbps_file_hash(fpath)) == NULL)
-			die("failed to process hash for %s:", fpath);
-		xbps_dictionary_set_cstring(fileinfo, "sha256", p);
-		free(p);
-		if ((xe->hash = xbps_file_hash(fpath)) == NULL)
-			die("failed to process hash for %s:", fpath);
-
-		xbps_dictionary_set_uint64(fileinfo, "inode", sb->st_ino);
-		xe->inode = sb->st_ino;
+
+		hash_queue(xe);
+
 		/* store modification time for regular files and links */
-		xbps_dictionary_set_uint64(fileinfo, "mtime", sb->st_mtime);
 		xe->mtime = (uint64_t)sb->st_mtime;
 		xe->size = (uint64_t)sb->st_size;
 
 	} else if (S_ISDIR(sb->st_mode)) {
 		/* directory */
-		xbps_dictionary_set_cstring_nocopy(fileinfo, "type", "dirs");
 		xe->type = strdup("dirs");
 		assert(xe->type);
 	} else if (S_ISFIFO(sb->st_mode)) {
@@ -493,7 +634,6 @@ ftw_cb(const char *fpath, const struct stat *sb, const struct dirent *dir UNUSED
 	}
 
 out:
-	xbps_object_release(fileinfo);
 	TAILQ_INSERT_TAIL(&xentry_list, xe, entries);
 	return 0;
 }
@@ -541,13 +681,13 @@ walk_dir(const char *path,
 }
 
 static void
-process_xentry(const char *key, const char *mutable_files)
+process_xentry(const char *key, bool mutable)
 {
 	xbps_array_t a;
 	xbps_dictionary_t d;
 	struct xentry *xe;
-	char *p, *saveptr, *args, *tok;
-	bool found = false, mutable_found = false;
+	char *p;
+	bool found = false;
 
 	a = xbps_array_create();
 	assert(a);
@@ -564,28 +704,9 @@ process_xentry(const char *key, const char *mutable_files)
 		/*
 		 * Find out if this file is mutable.
 		 */
-		if (mutable_files) {
-			if ((strchr(mutable_files, ' ') == NULL) &&
-			    (strcmp(mutable_files, p) == 0))
-				xbps_dictionary_set_bool(d, "mutable", true);
-			else {
-				args = strdup(mutable_files);
-				assert(args);
-				for ((tok = strtok_r(args, " ", &saveptr)); tok;
-				    (tok = strtok_r(NULL, " ", &saveptr))) {
-					if (strcmp(tok, p) == 0) {
-						mutable_found = true;
-						break;
-					}
-				}
-				free(args);
-				if (mutable_found) {
-					xbps_dictionary_set_bool(d, "mutable",
-					    true);
-					mutable_found = false;
-				}
-			}
-		}
+		if (mutable && strset_has(&mutables, p))
+			xbps_dictionary_set_bool(d, "mutable", true);
+
 		xbps_dictionary_set_cstring(d, "file", p);
 		if (xe->target)
 			xbps_dictionary_set_cstring(d, "target", xe->target);
@@ -608,20 +729,182 @@ process_xentry(const char *key, const char *mutable_files)
 static void
 process_destdir(const char *mutable_files)
 {
+	char *args, *p, *saveptr;
+
+	if (mutable_files) {
+		args = strdup(mutable_files);
+		assert(args);
+		for ((p = strtok_r(args, " ", &saveptr)); p;
+		    (p = strtok_r(NULL, " ", &saveptr)))
+			strset_add(&mutables, p);
+		free(args);
+	}
+
+	hash_start();
 	if (walk_dir(".", ftw_cb) < 0)
 		die("failed to process destdir files (nftw):");
 
+	/* Wait until all regular files have been hashed */
+	hash_finish();
+
 	/* Process regular files */
-	process_xentry("files", mutable_files);
+	process_xentry("files", true);
 
 	/* Process configuration files */
-	process_xentry("conf_files", NULL);
+	process_xentry("conf_files", false);
 
 	/* Process symlinks */
-	process_xentry("links", NULL);
+	process_xentry("links", false);
 
 	/* Process directories */
-	process_xentry("dirs", NULL);
+	process_xentry("dirs", false);
+}
+
+/*
+ * Seekable packages: the tar stream is split at member boundaries
+ * into zstd frames that can be decompressed on their own. The
+ * metadata files get a frame each, data files are grouped into
+ * frames of XBPS_SEEK_FRAME_SIZE. A skippable frame at the end maps
+ * every member to the offset of its frame, one "<offset> <member>"
+ * line each, followed by the index length and XBPS_SEEK_MAGIC.
+ */
+static struct {
+	struct archive *frame;
+	const char *threads;
+	int fd;
+	uint64_t offset, foffset, fsize;
+	char *index;
+	size_t indexlen, indexsz;
+	bool enabled;
+} seek;
+
+static ssize_t
+write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	size_t done = 0;
+	ssize_t r;
+
+	while (done < len) {
+		if ((r = write(fd, p + done, len - done)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += (size_t)r;
+	}
+	return (ssize_t)done;
+}
+
+static ssize_t
+seek_frame_write(struct archive *a UNUSED, void *data UNUSED,
+		const void *buf, size_t len)
+{
+	ssize_t r;
+
+	if ((r = write_all(seek.fd, buf, len)) > 0)
+		seek.offset += (uint64_t)r;
+	return r;
+}
+
+static void
+seek_frame_close(void)
+{
+	if (seek.frame == NULL)
+		return;
+	if (archive_write_free(seek.frame) != ARCHIVE_OK)
+		die("cannot compress package frame:");
+	seek.frame = NULL;
+}
+
+static ssize_t
+seek_write(struct archive *a UNUSED, void *data UNUSED,
+		const void *buf, size_t len)
+{
+	struct archive_entry *entry;
+
+	if (seek.frame == NULL) {
+		seek.frame = archive_write_new();
+		assert(seek.frame);
+		archive_write_add_filter_zstd(seek.frame);
+		archive_write_set_options(seek.frame, "compression-level=19");
+		if (xbps_archive_set_threads(seek.frame, seek.threads) != 0)
+			die("invalid number of compression threads");
+		archive_write_set_format_raw(seek.frame);
+		archive_write_set_bytes_per_block(seek.frame, 0);
+		if (archive_write_open(seek.frame, NULL, NULL,
+		    seek_frame_write, NULL) != ARCHIVE_OK)
+			die("cannot open package frame: %s",
+			    archive_error_string(seek.frame));
+		entry = archive_entry_new();
+		assert(entry);
+		archive_entry_set_filetype(entry, AE_IFREG);
+		archive_entry_set_pathname(entry, "frame");
+		if (archive_write_header(seek.frame, entry) != ARCHIVE_OK)
+			die("cannot open package frame: %s",
+			    archive_error_string(seek.frame));
+		archive_entry_free(entry);
+		seek.foffset = seek.offset;
+		seek.fsize = 0;
+	}
+	if (archive_write_data(seek.frame, buf, len) != (ssize_t)len)
+		die("cannot compress package frame: %s",
+		    archive_error_string(seek.frame));
+	seek.fsize += len;
+	return (ssize_t)len;
+}
+
+static int
+seek_close(struct archive *a UNUSED, void *data UNUSED)
+{
+	unsigned char hdr[8], tail[12];
+	uint32_t size;
+
+	seek_frame_close();
+
+	size = (uint32_t)(seek.indexlen + sizeof(tail));
+	for (int i = 0; i < 4; i++) {
+		hdr[i] = (XBPS_SEEK_FRAME_MAGIC >> (i * 8)) & 0xff;
+		hdr[4 + i] = (size >> (i * 8)) & 0xff;
+		tail[i] = (seek.indexlen >> (i * 8)) & 0xff;
+	}
+	memcpy(tail + 4, XBPS_SEEK_MAGIC, 8);
+	if (write_all(seek.fd, hdr, sizeof(hdr)) < 0 ||
+	    write_all(seek.fd, seek.index, seek.indexlen) < 0 ||
+	    write_all(seek.fd, tail, sizeof(tail)) < 0)
+		die("cannot write package index:");
+	free(seek.index);
+	return ARCHIVE_OK;
+}
+
+static void
+seek_member(struct archive *ar, const char *name)
+{
+	size_t len;
+
+	if (!seek.enabled)
+		return;
+
+	/* flush the padding of this member into the current frame */
+	archive_write_finish_entry(ar);
+	assert(seek.frame);
+
+	len = (size_t)snprintf(NULL, 0, "%ju %s\n", (uintmax_t)seek.foffset, name);
+	while (seek.indexlen + len + 1 > seek.indexsz) {
+		seek.indexsz = seek.indexsz ? seek.indexsz * 2 : 4096;
+		seek.index = realloc(seek.index, seek.indexsz);
+		assert(seek.index);
+	}
+	snprintf(seek.index + seek.indexlen, len + 1, "%ju %s\n",
+	    (uintmax_t)seek.foffset, name);
+	seek.indexlen += len;
+
+	if (seek.fsize >= XBPS_SEEK_FRAME_SIZE ||
+	    strcmp(name, "./INSTALL") == 0 ||
+	    strcmp(name, "./REMOVE") == 0 ||
+	    strcmp(name, "./props.plist") == 0 ||
+	    strcmp(name, "./files.plist") == 0)
+		seek_frame_close();
 }
 
 static void
@@ -644,6 +927,7 @@ write_entry(struct archive *ar, struct archive_entry *entry)
 	/* Only regular files can have data. */
 	if (archive_entry_filetype(entry) != AE_IFREG ||
 	    archive_entry_size(entry) == 0) {
+		seek_member(ar, archive_entry_pathname(entry));
 		archive_entry_free(entry);
 		return;
 	}
@@ -659,6 +943,7 @@ write_entry(struct archive *ar, struct archive_entry *entry)
 	if(len < 0)
 		die("cannot open %s file", name);
 
+	seek_member(ar, archive_entry_pathname(entry));
 	archive_entry_free(entry);
 }
 
@@ -744,6 +1029,7 @@ process_archive(struct archive *ar,
 	assert(xml);
 	xbps_archive_append_buf(ar, xml, strlen(xml), "./props.plist",
 	    0644, "root", "root");
+	seek_member(ar, "./props.plist");
 	free(xml);
 
 	/* Add files.plist metadata file */
@@ -751,6 +1037,7 @@ process_archive(struct archive *ar,
 	assert(xml);
 	xbps_archive_append_buf(ar, xml, strlen(xml), "./files.plist",
 	    0644, "root", "root");
+	seek_member(ar, "./files.plist");
 	free(xml);
 
 	/* Add all package data files and release resources */
@@ -771,7 +1058,7 @@ process_archive(struct archive *ar,
 int
 main(int argc, char **argv)
 {
-	const char *shortopts = "A:B:C:c:D:F:G:H:hl:M:m:n:P:pqr:R:S:s:t:V";
+	const char *shortopts = "A:B:C:c:D:F:G:H:hj:l:M:m:n:P:pqr:R:S:s:t:V";
 	const struct option longopts[] = {
 		{ "architecture", required_argument, NULL, 'A' },
 		{ "built-with", required_argument, NULL, 'B' },
@@ -781,6 +1068,7 @@ main(int argc, char **argv)
 		{ "config-files", required_argument, NULL, 'F' },
 		{ "homepage", required_argument, NULL, 'H' },
 		{ "help", no_argument, NULL, 'h' },
+		{ "threads", required_argument, NULL, 'j' },
 		{ "license", required_argument, NULL, 'l' },
 		{ "mutable-files", required_argument, NULL, 'M' },
 		{ "maintainer", required_argument, NULL, 'm' },
@@ -799,7 +1087,10 @@ main(int argc, char **argv)
 		{ "build-options", required_argument, NULL, '2' },
 		{ "compression", required_argument, NULL, '3' },
 		{ "alternatives", required_argument, NULL, '4' },
+		{ "triggers", required_argument, NULL, '5' },
 		{ "changelog", required_argument, NULL, 'c'},
+		{ "digest", required_argument, NULL, '6' },
+		{ "seekable", no_argument, NULL, '7' },
 		{ NULL, 0, NULL, 0 }
 	};
 	struct archive *ar;
@@ -810,9 +1101,10 @@ main(int argc, char **argv)
 	const char *provides, *pkgver, *replaces, *reverts, *desc, *ldesc;
 	const char *arch, *config_files, *mutable_files, *version, *changelog;
 	const char *buildopts, *shlib_provides, *shlib_requires, *alternatives;
-	const char *compression, *tags = NULL, *srcrevs = NULL;
+	const char *compression, *tags = NULL, *srcrevs = NULL, *triggers = NULL;
+	const char *threads = NULL;
 	char *pkgname, *binpkg, *tname, *p, cwd[PATH_MAX-1];
-	bool quiet = false, preserve = false;
+	bool quiet = false, preserve = false, seekable = false;
 	int c, pkg_fd;
 	mode_t myumask;
 
@@ -853,6 +1145,9 @@ main(int argc, char **argv)
 		case 'H':
 			homepage = optarg;
 			break;
+		case 'j':
+			threads = optarg;
+			break;
 		case 'l':
 			license = optarg;
 			break;
@@ -907,6 +1202,15 @@ main(int argc, char **argv)
 		case '4':
 			alternatives = optarg;
 			break;
+		case '5':
+			triggers = optarg;
+			break;
+		case '6':
+			digest = optarg;
+			break;
+		case '7':
+			seekable = true;
+			break;
 		case '?':
 		default:
 			usage();
@@ -925,6 +1229,8 @@ main(int argc, char **argv)
 		die("short description not set!");
 	else if (arch == NULL)
 		die("architecture not set!");
+	else if (digest && !xbps_digest_supported(digest))
+		die("unknown digest %s", digest);
 	/*
 	 * Sanity check for required options.
 	 */
@@ -976,6 +1282,8 @@ main(int argc, char **argv)
 				"tags", tags);
 	if (preserve)
 		xbps_dictionary_set_bool(pkg_propsd, "preserve", true);
+	if (seekable)
+		xbps_dictionary_set_bool(pkg_propsd, "seekable", true);
 	if (buildopts)
 		xbps_dictionary_set_cstring_nocopy(pkg_propsd,
 				"build-options", buildopts);
@@ -992,6 +1300,7 @@ main(int argc, char **argv)
 	process_array("reverts", reverts);
 	process_array("shlib-provides", shlib_provides);
 	process_array("shlib-requires", shlib_requires);
+	process_array("triggers", triggers);
 	process_dict_of_arrays("alternatives", alternatives);
 
 	/* save cwd */
@@ -1010,8 +1319,6 @@ main(int argc, char **argv)
 	 */
 	pkg_filesd = xbps_dictionary_create();
 	assert(pkg_filesd);
-	all_filesd = xbps_dictionary_create();
-	assert(all_filesd);
 	process_destdir(mutable_files);
 
 	/* Back to original cwd after file tree walk processing */
@@ -1032,9 +1339,17 @@ main(int argc, char **argv)
 	ar = archive_write_new();
 	assert(ar);
 	/*
-	 * Set compression format, xz if unset.
+	 * Set compression format, xz if unset; seekable packages
+	 * compress every frame with zstd on their own.
 	 */
-	if (compression == NULL || strcmp(compression, "xz") == 0) {
+	if (seekable) {
+		if (compression && strcmp(compression, "zstd"))
+			die("seekable packages must be compressed with zstd");
+		seek.enabled = true;
+		seek.fd = pkg_fd;
+		seek.threads = threads;
+		archive_write_set_bytes_per_block(ar, 0);
+	} else if (compression == NULL || strcmp(compression, "xz") == 0) {
 		archive_write_add_filter_xz(ar);
 	} else if (strcmp(compression, "gzip") == 0) {
 		archive_write_add_filter_gzip(ar);
@@ -1053,6 +1368,11 @@ main(int argc, char **argv)
 	} else {
 		die("unknown compression format %s");
 	}
+	if (xbps_archive_set_threads(ar, threads) != 0) {
+		errno = 0;
+		die("invalid number of compression threads: %s",
+		    threads ? threads : getenv("XBPS_COMPRESS_THREADS"));
+	}
 
 	archive_write_set_format_pax_restricted(ar);
 	if ((resolver = archive_entry_linkresolver_new()) == NULL)
@@ -1060,7 +1380,11 @@ main(int argc, char **argv)
 	archive_entry_linkresolver_set_strategy(resolver,
 	    archive_format(ar));
 
-	if (archive_write_open_fd(ar, pkg_fd) != 0)
+	if (seekable) {
+		if (archive_write_open(ar, NULL, NULL, seek_write,
+		    seek_close) != 0)
+			die("Failed to open %s for writing:", tname);
+	} else if (archive_write_open_fd(ar, pkg_fd) != 0)
 		die("Failed to open %s fd for writing:", tname);
 
 	process_archive(ar, resolver, pkgver, quiet);
@@ -35,7 +35,6 @@
 #include <getopt.h>
 
 #include <xbps.h>
-#include "queue.h"
 
 #ifdef __clang__
 #pragma clang diagnostic ignored "-Wformat-nonliteral"
@@ -81,16 +80,7 @@ struct defprops {
 	{ .sect = "node-sub", .prop = "opt-fillcolor", .val = "grey" }
 };
 
-struct pkgdep {
-	SLIST_ENTRY(pkgdep) pkgdep_entries;
-	unsigned int idx;
-	const char *pkgver;
-	xbps_array_t provides;
-};
-
 static xbps_dictionary_t confd;
-static SLIST_HEAD(pkgdep_head, pkgdep) pkgdep_list =
-    SLIST_HEAD_INITIALIZER(pkgdep_list);
 
 static void __attribute__((noreturn))
 die(const char *fmt, ...)
@@ -335,88 +325,117 @@ parse_array_in_pkg_dictionary(FILE *f, xbps_dictionary_t plistd,
 	}
 }
 
+static xbps_dictionary_t
+get_pkgd(struct xbps_handle *xhp, const char *pkg, bool repomode)
+{
+	xbps_dictionary_t pkgd;
+
+	if (repomode) {
+		if ((pkgd = xbps_rpool_get_pkg(xhp, pkg)) == NULL)
+			pkgd = xbps_rpool_get_virtualpkg(xhp, pkg);
+	} else {
+		if ((pkgd = xbps_pkgdb_get_pkg(xhp, pkg)) == NULL)
+			pkgd = xbps_pkgdb_get_virtualpkg(xhp, pkg);
+	}
+	return pkgd;
+}
+
+static void
+write_edges(struct xbps_handle *xhp, FILE *f, xbps_dictionary_t nodes,
+		xbps_dictionary_t pkgd, unsigned int pkgidx, bool repomode)
+{
+	xbps_array_t rpkgrdeps;
+
+	/*
+	 * Resolve dependencies the same way than the fulldeptree,
+	 * and find out its node index by pkgname.
+	 */
+	rpkgrdeps = xbps_dictionary_get(pkgd, "run_depends");
+	for (unsigned int x = 0; x < xbps_array_count(rpkgrdeps); x++) {
+		xbps_dictionary_t rpkgd;
+		const char *rpkgdep = NULL, *rpkgver = NULL;
+		char *rpkgname;
+		unsigned int idx;
+
+		xbps_array_get_cstring_nocopy(rpkgrdeps, x, &rpkgdep);
+		if ((rpkgd = get_pkgd(xhp, rpkgdep, repomode)) == NULL)
+			continue;
+		xbps_dictionary_get_cstring_nocopy(rpkgd, "pkgver", &rpkgver);
+		rpkgname = xbps_pkg_name(rpkgver);
+		assert(rpkgname);
+		if (xbps_dictionary_get_uint32(nodes, rpkgname, &idx) &&
+		    idx != pkgidx)
+			fprintf(f, "\t%u -> %u;\n", pkgidx, idx);
+		free(rpkgname);
+	}
+}
+
 static void
 process_fulldeptree(struct xbps_handle *xhp, FILE *f,
 		xbps_dictionary_t pkgd, xbps_array_t rdeps,
 		bool repomode)
 {
-	xbps_array_t rpkgrdeps;
-	struct pkgdep *pd;
+	xbps_dictionary_t nodes;
 	const char *pkgver;
-	unsigned int i, x;
+	char *pkgname;
+	unsigned int i, idx = 0;
 
 	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
 
+	/*
+	 * Assign a node index to every package, dependencies first.
+	 */
+	nodes = xbps_dictionary_create();
+	assert(nodes);
+	i = xbps_array_count(rdeps);
+	while (i--) {
+		const char *pkgdep = NULL;
+
+		xbps_array_get_cstring_nocopy(rdeps, i, &pkgdep);
+		if (strcmp(pkgdep, pkgver) == 0)
+			continue;
+		pkgname = xbps_pkg_name(pkgdep);
+		assert(pkgname);
+		if (!xbps_dictionary_get(nodes, pkgname))
+			xbps_dictionary_set_uint32(nodes, pkgname, idx++);
+		free(pkgname);
+	}
+	pkgname = xbps_pkg_name(pkgver);
+	assert(pkgname);
+	xbps_dictionary_set_uint32(nodes, pkgname, idx);
+	free(pkgname);
+
 	i = xbps_array_count(rdeps);
 	while (i--) {
 		xbps_dictionary_t rpkgd;
 		const char *pkgdep = NULL;
-		unsigned int pkgidx = 0;
-		bool found = false;
+		unsigned int pkgidx;
 
 		xbps_array_get_cstring_nocopy(rdeps, i, &pkgdep);
 		if (strcmp(pkgdep, pkgver) == 0)
 			continue;
 
-		SLIST_FOREACH(pd, &pkgdep_list, pkgdep_entries) {
-			if (strcmp(pd->pkgver, pkgdep) == 0) {
-				found = true;
-				break;
-			}
-			pkgidx++;
-		}
 		if (repomode) {
 			rpkgd = xbps_rpool_get_pkg(xhp, pkgdep);
 		} else {
 			rpkgd = xbps_pkgdb_get_pkg(xhp, pkgdep);
 		}
 		assert(rpkgd);
-		if (!found) {
-			pd = malloc(sizeof(*pd));
-			assert(pd);
-			pd->idx = pkgidx;
-			pd->pkgver = pkgdep;
-			pd->provides = xbps_dictionary_get(rpkgd, "provides");
-			SLIST_INSERT_HEAD(&pkgdep_list, pd, pkgdep_entries);
-		}
-		rpkgrdeps = xbps_dictionary_get(rpkgd, "run_depends");
-		for (x = 0; x < xbps_array_count(rpkgrdeps); x++) {
-			struct pkgdep *ppd;
-			const char *rpkgdep = NULL;
-
-			xbps_array_get_cstring_nocopy(rpkgrdeps, x, &rpkgdep);
-			SLIST_FOREACH(ppd, &pkgdep_list, pkgdep_entries) {
-				if (xbps_pkgpattern_match(ppd->pkgver, rpkgdep))
-					fprintf(f, "\t%u -> %u;\n", pkgidx, ppd->idx);
-				else if (ppd->provides &&
-					xbps_match_virtual_pkg_in_array(ppd->provides, rpkgdep))
-					fprintf(f, "\t%u -> %u;\n", pkgidx, ppd->idx);
-			}
-		}
+		pkgname = xbps_pkg_name(pkgdep);
+		assert(pkgname);
+		xbps_dictionary_get_uint32(nodes, pkgname, &pkgidx);
+		free(pkgname);
+
+		write_edges(xhp, f, nodes, rpkgd, pkgidx, repomode);
 		fprintf(f, "\t%u [label=\"%s\"", pkgidx, pkgdep);
 		if (repomode && xbps_pkgdb_get_pkg(xhp, pkgdep))
 			fprintf(f, ",style=\"filled\",fillcolor=\"yellowgreen\"");
 
 		fprintf(f, "]\n");
 	}
-	i = 0;
-	SLIST_FOREACH(pd, &pkgdep_list, pkgdep_entries)
-		++i;
-
-	fprintf(f, "\t%u [label=\"%s\",style=\"filled\",fillcolor=\"darksalmon\"];\n", i, pkgver);
-	rpkgrdeps = xbps_dictionary_get(pkgd, "run_depends");
-	for (x = 0; x < xbps_array_count(rpkgrdeps); x++) {
-		const char *rpkgdep = NULL;
-
-		xbps_array_get_cstring_nocopy(rpkgrdeps, x, &rpkgdep);
-		SLIST_FOREACH(pd, &pkgdep_list, pkgdep_entries) {
-			if (xbps_pkgpattern_match(pd->pkgver, rpkgdep))
-				fprintf(f, "\t%u -> %u;\n", i, pd->idx);
-			else if (pd->provides &&
-				xbps_match_virtual_pkg_in_array(pd->provides, rpkgdep))
-				fprintf(f, "\t%u -> %u;\n", i, pd->idx);
-		}
-	}
+	fprintf(f, "\t%u [label=\"%s\",style=\"filled\",fillcolor=\"darksalmon\"];\n", idx, pkgver);
+	write_edges(xhp, f, nodes, pkgd, idx, repomode);
+	xbps_object_release(nodes);
 }
 
 static void
@@ -41,7 +41,7 @@ usage(void)
 	"\n"
 	"OPTIONS:\n"
 	" -h\t\tShow usage()\n"
-	" -m <sha256>\tSelects the digest mode, sha256 (default)\n"
+	" -m <mode>\tSelects the digest mode: sha256 (default), blake2b\n"
 	" -V\t\tPrints the xbps release version\n"
 	"\n"
 	"NOTES\n"
@@ -49,6 +49,17 @@ usage(void)
 	exit(EXIT_FAILURE);
 }
 
+/* strip the algorithm prefix, print the hex digest only */
+static const char *
+digest_hex(const char *hash)
+{
+	const char *p;
+
+	if ((p = strchr(hash, ':')) != NULL)
+		return p + 1;
+	return hash;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -77,29 +88,28 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (mode && strcmp(mode, "sha256")) {
-		/* sha256 is the only supported mode currently */
+	if (mode && !xbps_digest_supported(mode)) {
 		fprintf(stderr, "%s: unsupported digest mode\n", progname);
 		exit(EXIT_FAILURE);
 	}
 
 	if (argc < 1) {
-		hash = xbps_file_hash("/dev/stdin");
+		hash = xbps_file_digest("/dev/stdin", mode);
 		if (hash == NULL)
 			exit(EXIT_FAILURE);
 
-		printf("%s\n", hash);
+		printf("%s\n", digest_hex(hash));
 		free(hash);
 	} else {
 		for (int i = 0; i < argc; i++) {
-			hash = xbps_file_hash(argv[i]);
+			hash = xbps_file_digest(argv[i], mode);
 			if (hash == NULL) {
 				fprintf(stderr,
 				    "%s: couldn't get hash for %s (%s)\n",
 				progname, argv[i], strerror(errno));
 				exit(EXIT_FAILURE);
 			}
-			printf("%s\n", hash);
+			printf("%s\n", digest_hex(hash));
 			free(hash);
 		}
 	}
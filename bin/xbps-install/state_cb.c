@@ -174,6 +174,7 @@ state_cb(const struct xbps_state_cb_data *xscd, void *cbdata UNUSED)
 	case XBPS_STATE_DOWNLOAD_FAIL:
 	case XBPS_STATE_REPOSYNC_FAIL:
 	case XBPS_STATE_CONFIG_FILE_FAIL:
+	case XBPS_STATE_TRIGGER_FAIL:
 		xbps_error_printf("%s\n", xscd->desc);
 		if (slog) {
 			syslog(LOG_ERR, "%s", xscd->desc);
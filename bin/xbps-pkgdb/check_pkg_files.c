@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <assert.h>
 #include <unistd.h>
 #include <sys/param.h>
 
@@ -82,34 +83,47 @@ check_pkg_files(struct xbps_handle *xhp, const char *pkgname, void *arg)
 	xbps_object_t obj;
 	xbps_object_iterator_t iter;
 	xbps_dictionary_t pkg_filesd = arg;
+	struct xbps_file_hash_job *jobs;
 	const char *file = NULL, *sha256 = NULL;
-	char *path;
+	char *path, **paths;
+	unsigned int i, njobs;
 	bool mutable, test_broken = false;
-	int rv = 0, errors = 0;
+	int errors = 0;
 
 	array = xbps_dictionary_get(pkg_filesd, "files");
-	if (array != NULL && xbps_array_count(array) > 0) {
-		iter = xbps_array_iter_from_dict(pkg_filesd, "files");
-		if (iter == NULL)
-			return -1;
+	if (array != NULL && (njobs = xbps_array_count(array)) > 0) {
+		/*
+		 * Hash all files at once, and then report
+		 * the results in the same order.
+		 */
+		jobs = calloc(njobs, sizeof(*jobs));
+		paths = calloc(njobs, sizeof(*paths));
+		assert(jobs);
+		assert(paths);
+		for (i = 0; i < njobs; i++) {
+			obj = xbps_array_get(array, i);
+			xbps_dictionary_get_cstring_nocopy(obj, "file", &file);
+			sha256 = NULL;
+			xbps_dictionary_get_cstring_nocopy(obj,
+			    "sha256", &sha256);
+			paths[i] = xbps_xasprintf("%s/%s", xhp->rootdir, file);
+			jobs[i].file = paths[i];
+			jobs[i].digest = sha256;
+		}
+		(void)xbps_file_hash_batch(xhp, jobs, njobs);
 
-		while ((obj = xbps_object_iterator_next(iter))) {
+		for (i = 0; i < njobs; i++) {
+			obj = xbps_array_get(array, i);
 			xbps_dictionary_get_cstring_nocopy(obj, "file", &file);
-			path = xbps_xasprintf("%s/%s", xhp->rootdir, file);
-                        xbps_dictionary_get_cstring_nocopy(obj,
-                            "sha256", &sha256);
-			rv = xbps_file_hash_check(path, sha256);
-			switch (rv) {
+			switch (jobs[i].rv) {
 			case 0:
-				if (check_file_mtime(obj, pkgname, path)) {
+				if (check_file_mtime(obj, pkgname, paths[i])) {
 					test_broken = true;
 				}
-				free(path);
 				break;
 			case ENOENT:
 				xbps_error_printf("%s: unexistent file %s.\n",
 				    pkgname, file);
-				free(path);
 				test_broken = true;
 				break;
 			case ERANGE:
@@ -121,17 +135,17 @@ check_pkg_files(struct xbps_handle *xhp, const char *pkgname, void *arg)
 					    "for %s.\n", pkgname, file);
 					test_broken = true;
 				}
-				free(path);
 				break;
 			default:
 				xbps_error_printf(
 				    "%s: can't check `%s' (%s)\n",
-				    pkgname, file, strerror(rv));
-				free(path);
+				    pkgname, file, strerror(jobs[i].rv));
 				break;
 			}
-                }
-                xbps_object_iterator_release(iter);
+			free(paths[i]);
+		}
+		free(paths);
+		free(jobs);
 	}
 	if (test_broken) {
 		xbps_error_printf("%s: files check FAILED.\n", pkgname);
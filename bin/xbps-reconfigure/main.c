@@ -74,8 +74,14 @@ state_cb(const struct xbps_state_cb_data *xscd, void *cbd UNUSED)
 			syslog(LOG_NOTICE,
 			    "%s: configured successfully.", xscd->arg);
 		break;
+	case XBPS_STATE_TRIGGER:
+		printf("%s\n", xscd->desc);
+		if (slog)
+			syslog(LOG_NOTICE, "%s", xscd->desc);
+		break;
 	/* errors */
 	case XBPS_STATE_CONFIGURE_FAIL:
+	case XBPS_STATE_TRIGGER_FAIL:
 		xbps_error_printf("%s\n", xscd->desc);
 		if (slog)
 			syslog(LOG_ERR, "%s", xscd->desc);
@@ -180,6 +186,8 @@ main(int argc, char **argv)
 				    "`%s': %s\n", argv[i], strerror(rv));
 			}
 		}
+		if ((i = xbps_triggers_run(&xh)) != 0 && rv == 0)
+			rv = i;
 	}
 	if (rv == 0)
 		xbps_pkgdb_update(&xh, true, false);
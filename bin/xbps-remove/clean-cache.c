@@ -36,47 +36,11 @@
 #include <xbps.h>
 #include "defs.h"
 
-static int
-cleaner_cb(struct xbps_handle *xhp, xbps_object_t obj,
-		const char *key UNUSED, void *arg,
-		bool *done UNUSED)
+static void
+remove_binpkg(const char *binpkg, bool drun)
 {
-	xbps_dictionary_t repo_pkgd;
-	const char *binpkg, *rsha256;
-	char *binpkgsig, *pkgver, *arch;
-	bool drun = false;
-
-	/* Extract drun (dry-run) flag from arg*/
-	if (arg != NULL)
-		drun = *(bool*)arg;
+	char *binpkgsig;
 
-	/* Internalize props.plist dictionary from binary pkg */
-	binpkg = xbps_string_cstring_nocopy(obj);
-	arch = xbps_binpkg_arch(binpkg);
-	assert(arch);
-
-	if (!xbps_pkg_arch_match(xhp, arch, NULL)) {
-		xbps_dbg_printf(xhp, "%s: ignoring binpkg with unmatched arch (%s)\n", binpkg, arch);
-		free(arch);
-		return 0;
-	}
-	free(arch);
-	/*
-	 * Remove binary pkg if it's not registered in any repository
-	 * or if hash doesn't match.
-	 */
-	pkgver = xbps_binpkg_pkgver(binpkg);
-	assert(pkgver);
-	repo_pkgd = xbps_rpool_get_pkg(xhp, pkgver);
-	free(pkgver);
-	if (repo_pkgd) {
-		xbps_dictionary_get_cstring_nocopy(repo_pkgd,
-		    "filename-sha256", &rsha256);
-		if (xbps_file_hash_check(binpkg, rsha256) == 0) {
-			/* hash matched */
-			return 0;
-		}
-	}
 	binpkgsig = xbps_xasprintf("%s.sig", binpkg);
 	if (!drun && unlink(binpkg) == -1) {
 		fprintf(stderr, "Failed to remove `%s': %s\n",
@@ -91,6 +55,65 @@ cleaner_cb(struct xbps_handle *xhp, xbps_object_t obj,
 		}
 	}
 	free(binpkgsig);
+	/* digest saved while downloading */
+	binpkgsig = xbps_xasprintf("%s.sha256", binpkg);
+	if (!drun)
+		(void)unlink(binpkgsig);
+	free(binpkgsig);
+}
+
+static int
+cleaner(struct xbps_handle *xhp, xbps_array_t array, bool drun)
+{
+	xbps_dictionary_t repo_pkgd;
+	struct xbps_file_hash_job *jobs;
+	const char *binpkg, *rsha256;
+	char *pkgver, *arch;
+	unsigned int i, njobs = 0;
+
+	jobs = calloc(xbps_array_count(array), sizeof(*jobs));
+	assert(jobs);
+
+	for (i = 0; i < xbps_array_count(array); i++) {
+		xbps_array_get_cstring_nocopy(array, i, &binpkg);
+		arch = xbps_binpkg_arch(binpkg);
+		assert(arch);
+
+		if (!xbps_pkg_arch_match(xhp, arch, NULL)) {
+			xbps_dbg_printf(xhp, "%s: ignoring binpkg with unmatched arch (%s)\n", binpkg, arch);
+			free(arch);
+			continue;
+		}
+		free(arch);
+		/*
+		 * Remove binary pkg if it's not registered in any repository,
+		 * otherwise check its hash below.
+		 */
+		pkgver = xbps_binpkg_pkgver(binpkg);
+		assert(pkgver);
+		repo_pkgd = xbps_rpool_get_pkg(xhp, pkgver);
+		free(pkgver);
+		if (repo_pkgd == NULL) {
+			remove_binpkg(binpkg, drun);
+			continue;
+		}
+		if (!xbps_dictionary_get_cstring_nocopy(repo_pkgd,
+		    "filename-sha256", &rsha256))
+			continue;
+		jobs[njobs].file = binpkg;
+		jobs[njobs].digest = rsha256;
+		njobs++;
+	}
+	/*
+	 * Hash all registered binary pkgs at once and remove
+	 * the ones that don't match.
+	 */
+	(void)xbps_file_hash_batch(xhp, jobs, njobs);
+	for (i = 0; i < njobs; i++) {
+		if (jobs[i].rv != 0)
+			remove_binpkg(jobs[i].file, drun);
+	}
+	free(jobs);
 
 	return 0;
 }
@@ -128,8 +151,8 @@ clean_cachedir(struct xbps_handle *xhp, bool drun)
 	(void)closedir(dirp);
 
 	if (xbps_array_count(array)) {
-		rv = xbps_array_foreach_cb_multi(xhp, array, NULL, cleaner_cb, (void*)&drun);
-		xbps_object_release(array);
+		rv = cleaner(xhp, array, drun);
 	}
+	xbps_object_release(array);
 	return rv;
 }
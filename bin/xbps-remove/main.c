@@ -100,6 +100,7 @@ state_cb_rm(const struct xbps_state_cb_data *xscd, void *cbdata UNUSED)
 		break;
 	/* errors */
 	case XBPS_STATE_REMOVE_FAIL:
+	case XBPS_STATE_TRIGGER_FAIL:
 		xbps_error_printf("%s\n", xscd->desc);
 		if (slog) {
 			syslog(LOG_ERR, "%s", xscd->desc);
@@ -122,6 +123,7 @@ state_cb_rm(const struct xbps_state_cb_data *xscd, void *cbdata UNUSED)
 	case XBPS_STATE_ALTGROUP_SWITCHED:
 	case XBPS_STATE_ALTGROUP_LINK_ADDED:
 	case XBPS_STATE_ALTGROUP_LINK_REMOVED:
+	case XBPS_STATE_TRIGGER:
 		if (xscd->desc) {
 			printf("%s\n", xscd->desc);
 			if (slog)
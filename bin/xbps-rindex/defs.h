@@ -67,7 +67,8 @@
 #define _XBPS_RINDEX		"xbps-rindex"
 
 /* From index-add.c */
-int	index_add(struct xbps_handle *, int, int, char **, bool, const char *);
+int	index_add(struct xbps_handle *, int, int, char **, bool, const char *,
+		const char *);
 
 /* From index-clean.c */
 int	index_clean(struct xbps_handle *, const char *, bool, const char *);
@@ -80,6 +81,9 @@ int	sign_repo(struct xbps_handle *, const char *, const char *,
 		const char *, const char *);
 int	sign_pkgs(struct xbps_handle *, int, int, char **, const char *, bool);
 
+/* From jobs.c */
+void	run_jobs(unsigned int, void (*)(unsigned int, void *), void *);
+
 /* From repoflush.c */
 bool	repodata_flush(struct xbps_handle *, const char *, const char *,
 		xbps_dictionary_t, xbps_dictionary_t, const char *);
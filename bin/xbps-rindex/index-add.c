@@ -33,6 +33,7 @@
 #include <libgen.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include <xbps.h>
 #include "defs.h"
@@ -214,14 +215,162 @@ repodata_commit(struct xbps_handle *xhp, const char *repodir,
 	return rv;
 }
 
+/*
+ * Package metadata is read by a pool of threads; the results are
+ * merged into the index in argv order afterwards.
+ */
+struct ingest {
+	const char *file;
+	xbps_dictionary_t binpkgd;
+	xbps_dictionary_t memo;
+	struct stat st;
+	int rv;
+};
+
+static void
+ingest_pkg(struct ingest *pkg)
+{
+	/* unchanged since the last run */
+	if (pkg->memo)
+		return;
+	pkg->binpkgd = xbps_archive_fetch_plist(pkg->file, "/props.plist");
+}
+
+static void
+ingest_job(unsigned int i, void *arg)
+{
+	struct ingest *pkgs = arg;
+
+	ingest_pkg(&pkgs[i]);
+}
+
+/*
+ * The memo records what the previous runs learned from every package
+ * file: its pkgver, architecture, reverts and digest, keyed by file
+ * name and valid as long as the size, mtime and inode are the same.
+ * Unchanged packages are then checked against the index without
+ * opening them.
+ */
+static char *
+memo_path(struct xbps_handle *xhp, const char *repodir)
+{
+	char *repofile, *path;
+
+	repofile = xbps_repo_path(xhp, repodir);
+	path = xbps_xasprintf("%s.memo", repofile);
+	free(repofile);
+	return path;
+}
+
+static xbps_dictionary_t
+memo_lookup(xbps_dictionary_t memo, const char *file, const struct stat *st)
+{
+	xbps_dictionary_t d;
+	uint64_t size = 0, mtime = 0, mtimensec = 0, inode = 0;
+	char *p, *bname;
+
+	p = strdup(file);
+	assert(p);
+	bname = basename(p);
+	d = xbps_dictionary_get(memo, bname);
+	free(p);
+	if (d == NULL)
+		return NULL;
+
+	xbps_dictionary_get_uint64(d, "size", &size);
+	xbps_dictionary_get_uint64(d, "mtime", &mtime);
+	xbps_dictionary_get_uint64(d, "mtime-nsec", &mtimensec);
+	xbps_dictionary_get_uint64(d, "inode", &inode);
+	if (size != (uint64_t)st->st_size ||
+	    mtime != (uint64_t)st->st_mtim.tv_sec ||
+	    mtimensec != (uint64_t)st->st_mtim.tv_nsec ||
+	    inode != (uint64_t)st->st_ino ||
+	    !xbps_dictionary_get(d, "pkgver") ||
+	    !xbps_dictionary_get(d, "architecture"))
+		return NULL;
+
+	return d;
+}
+
+static void
+memo_update(xbps_dictionary_t memo, const struct ingest *pkg)
+{
+	xbps_dictionary_t d;
+	xbps_object_t obj;
+	char *p;
+
+	d = xbps_dictionary_create();
+	assert(d);
+	xbps_dictionary_set_uint64(d, "size", (uint64_t)pkg->st.st_size);
+	xbps_dictionary_set_uint64(d, "mtime", (uint64_t)pkg->st.st_mtim.tv_sec);
+	xbps_dictionary_set_uint64(d, "mtime-nsec", (uint64_t)pkg->st.st_mtim.tv_nsec);
+	xbps_dictionary_set_uint64(d, "inode", (uint64_t)pkg->st.st_ino);
+	if ((obj = xbps_dictionary_get(pkg->binpkgd, "pkgver")))
+		xbps_dictionary_set(d, "pkgver", obj);
+	if ((obj = xbps_dictionary_get(pkg->binpkgd, "architecture")))
+		xbps_dictionary_set(d, "architecture", obj);
+	if ((obj = xbps_dictionary_get(pkg->binpkgd, "reverts")))
+		xbps_dictionary_set(d, "reverts", obj);
+	if ((obj = xbps_dictionary_get(pkg->binpkgd, "filename-sha256")))
+		xbps_dictionary_set(d, "filename-sha256", obj);
+
+	p = strdup(pkg->file);
+	assert(p);
+	xbps_dictionary_set(memo, basename(p), d);
+	xbps_object_release(d);
+	free(p);
+}
+
+static void
+memo_save(xbps_dictionary_t memo, const char *repodir, const char *path)
+{
+	xbps_object_iterator_t iter;
+	xbps_object_t keysym;
+	xbps_array_t gone;
+	struct stat st;
+	char *file;
+
+	/* forget packages that were removed from the repository */
+	gone = xbps_array_create();
+	assert(gone);
+	iter = xbps_dictionary_iterator(memo);
+	assert(iter);
+	while ((keysym = xbps_object_iterator_next(iter))) {
+		const char *bname = xbps_dictionary_keysym_cstring_nocopy(keysym);
+
+		file = xbps_xasprintf("%s/%s", repodir, bname);
+		if (stat(file, &st) == -1 && errno == ENOENT)
+			xbps_array_add_cstring(gone, bname);
+		free(file);
+	}
+	xbps_object_iterator_release(iter);
+	for (unsigned int i = 0; i < xbps_array_count(gone); i++) {
+		const char *bname = NULL;
+
+		xbps_array_get_cstring_nocopy(gone, i, &bname);
+		xbps_dictionary_remove(memo, bname);
+	}
+	xbps_object_release(gone);
+
+	if (!xbps_dictionary_externalize_to_file(memo, path))
+		fprintf(stderr, "%s: failed to write %s: %s\n",
+		    _XBPS_RINDEX, path, strerror(errno));
+}
+
 int
-index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force, const char *compression)
+index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force,
+		const char *compression, const char *digest)
 {
-	xbps_dictionary_t idx, idxmeta, idxstage, binpkgd, curpkgd;
+	xbps_dictionary_t idx, idxmeta, idxstage, binpkgd, curpkgd, *hashed = NULL;
+	xbps_dictionary_t memo = NULL;
 	struct xbps_repo *repo = NULL, *stage = NULL;
-	struct stat st;
+	struct xbps_file_hash_job *jobs = NULL;
+	struct ingest *pkgs = NULL;
 	char *tmprepodir = NULL, *repodir = NULL, *rlockfname = NULL;
-	int rv = 0, ret = 0, rlockfd = -1;
+	char *memofile = NULL;
+	unsigned int njobs = 0;
+	int rv = 0, ret = 0, rlockfd = -1, npkgs = 0;
+	bool memo_dirty = false;
 
 	assert(argv);
 	/*
@@ -264,18 +413,38 @@ index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force
 	else {
 		idxstage = xbps_dictionary_create();
 	}
+	memofile = memo_path(xhp, repodir);
+	if ((memo = xbps_dictionary_internalize_from_file(memofile)) == NULL)
+		memo = xbps_dictionary_create();
+	assert(memo);
 	/*
-	 * Process all packages specified in argv.
+	 * Read the metadata of all packages specified in argv concurrently,
+	 * unless the memo knows it already.
 	 */
-	for (int i = args; i < argmax; i++) {
-		const char *arch = NULL, *pkg = argv[i];
-		char *sha256 = NULL, *pkgver = NULL, *pkgname = NULL;
+	npkgs = argmax - args;
+	pkgs = calloc(npkgs, sizeof(*pkgs));
+	assert(pkgs);
+	for (int i = 0; i < npkgs; i++) {
+		pkgs[i].file = argv[args + i];
+		if (stat(pkgs[i].file, &pkgs[i].st) == -1)
+			pkgs[i].rv = errno;
+		else if (!force)
+			pkgs[i].memo = memo_lookup(memo, pkgs[i].file, &pkgs[i].st);
+	}
+	run_jobs((unsigned int)npkgs, ingest_job, pkgs);
+	jobs = calloc(npkgs, sizeof(*jobs));
+	hashed = calloc(npkgs, sizeof(*hashed));
+	assert(jobs && hashed);
+	/*
+	 * Process them in argv order.
+	 */
+	for (int i = 0; i < npkgs; i++) {
+		const char *arch = NULL, *pkg = pkgs[i].file;
+		char *pkgver = NULL, *pkgname = NULL;
 
-		assert(pkg);
-		/*
-		 * Read metadata props plist dictionary from binary package.
-		 */
-		binpkgd = xbps_archive_fetch_plist(pkg, "/props.plist");
+		binpkgd = pkgs[i].binpkgd;
+		if (binpkgd == NULL)
+			binpkgd = pkgs[i].memo;
 		if (binpkgd == NULL) {
 			fprintf(stderr, "index: failed to read %s metadata for "
 			    "`%s', skipping!\n", XBPS_PKGPROPS, pkg);
@@ -285,7 +454,6 @@ index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force
 		xbps_dictionary_get_cstring(binpkgd, "pkgver", &pkgver);
 		if (!xbps_pkg_arch_match(xhp, arch, NULL)) {
 			fprintf(stderr, "index: ignoring %s, unmatched arch (%s)\n", pkgver, arch);
-			xbps_object_release(binpkgd);
 			free(pkgver);
 			continue;
 		}
@@ -303,7 +471,6 @@ index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force
 		if (curpkgd == NULL) {
 			if (errno && errno != ENOENT) {
 				rv = errno;
-				xbps_object_release(binpkgd);
 				free(pkgver);
 				free(pkgname);
 				goto out;
@@ -333,7 +500,6 @@ index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force
 			if (ret <= 0) {
 				/* Same version or index version greater */
 				fprintf(stderr, "index: skipping `%s' (%s), already registered.\n", pkgver, arch);
-				xbps_object_release(binpkgd);
 				free(opkgver);
 				free(oarch);
 				free(pkgver);
@@ -343,43 +509,36 @@ index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force
 			free(opkgver);
 			free(oarch);
 		}
+		if (binpkgd == pkgs[i].memo) {
+			/* the memo is not enough to register it */
+			pkgs[i].memo = NULL;
+			ingest_pkg(&pkgs[i]);
+			if ((binpkgd = pkgs[i].binpkgd) == NULL) {
+				fprintf(stderr, "index: failed to read %s metadata "
+				    "for `%s', skipping!\n", XBPS_PKGPROPS, pkg);
+				free(pkgver);
+				free(pkgname);
+				continue;
+			}
+		}
 		/*
 		 * Add additional objects for repository ops:
 		 * 	- filename-size
-		 * 	- filename-sha256
+		 * 	- filename-sha256 (once all new packages are hashed)
 		 */
-		if ((sha256 = xbps_file_hash(pkg)) == NULL) {
-			xbps_object_release(binpkgd);
+		if (pkgs[i].rv != 0) {
 			free(pkgver);
 			free(pkgname);
 			rv = EINVAL;
 			goto out;
 		}
-		if (!xbps_dictionary_set_cstring(binpkgd, "filename-sha256", sha256)) {
-			xbps_object_release(binpkgd);
-			free(sha256);
+		if (!xbps_dictionary_set_uint64(binpkgd, "filename-size", (uint64_t)pkgs[i].st.st_size)) {
 			free(pkgver);
 			free(pkgname);
 			rv = EINVAL;
 			goto out;
 		}
-		free(sha256);
-		if (stat(pkg, &st) == -1) {
-			xbps_object_release(binpkgd);
-			free(pkgver);
-			free(pkgname);
-			rv = EINVAL;
-			goto out;
-		}
-		if (!xbps_dictionary_set_uint64(binpkgd, "filename-size", (uint64_t)st.st_size)) {
-			xbps_object_release(binpkgd);
-			free(pkgver);
-			free(pkgname);
-			rv = EINVAL;
-			goto out;
-		}
-		if (set_build_date(binpkgd, st.st_mtime) < 0) {
-			xbps_object_release(binpkgd);
+		if (set_build_date(binpkgd, pkgs[i].st.st_mtime) < 0) {
 			free(pkgver);
 			free(pkgname);
 			rv = EINVAL;
@@ -394,16 +553,31 @@ index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force
 		 * Add new pkg dictionary into the stage index
 		 */
 		if (!xbps_dictionary_set(idxstage, pkgname, binpkgd)) {
-			xbps_object_release(binpkgd);
 			free(pkgname);
 			free(pkgver);
 			rv = EINVAL;
 			goto out;
 		}
-		xbps_object_release(binpkgd);
+		jobs[njobs].file = pkg;
+		jobs[njobs].algo = digest;
+		hashed[njobs++] = binpkgd;
 		free(pkgname);
 		free(pkgver);
 	}
+	/*
+	 * Hash all new packages concurrently.
+	 */
+	if (xbps_file_hash_batch(xhp, jobs, njobs) != 0) {
+		rv = EINVAL;
+		goto out;
+	}
+	for (unsigned int i = 0; i < njobs; i++) {
+		if (!xbps_dictionary_set_cstring(hashed[i], "filename-sha256",
+		    jobs[i].hash)) {
+			rv = EINVAL;
+			goto out;
+		}
+	}
 	/*
 	 * Generate repository data files.
 	 */
@@ -414,11 +588,33 @@ index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force
 	}
 	printf("index: %u packages registered.\n", xbps_dictionary_count(idx));
 
+	/*
+	 * Remember the packages that had to be read.
+	 */
+	for (int i = 0; i < npkgs; i++) {
+		if (pkgs[i].binpkgd && pkgs[i].rv == 0) {
+			memo_update(memo, &pkgs[i]);
+			memo_dirty = true;
+		}
+	}
+	if (memo_dirty)
+		memo_save(memo, repodir, memofile);
+
 out:
 	xbps_object_release(idx);
 	xbps_object_release(idxstage);
 	if (idxmeta)
 		xbps_object_release(idxmeta);
+	for (int i = 0; i < npkgs; i++) {
+		if (pkgs[i].binpkgd)
+			xbps_object_release(pkgs[i].binpkgd);
+	}
+	free(pkgs);
+	free(jobs);
+	free(hashed);
+	if (memo)
+		xbps_object_release(memo);
+	free(memofile);
 
 earlyout:
 	if (repo)
@@ -40,57 +40,78 @@
 
 static xbps_dictionary_t dest;
 
-struct CleanerCbInfo {
-	const char *repourl;
-	bool hashcheck;
-};
+static void
+idx_remove_pkg(const char *pkgver)
+{
+	char *pkgname;
 
-static int
-idx_cleaner_cb(struct xbps_handle *xhp,
-		xbps_object_t obj,
-		const char *key UNUSED,
-		void *arg,
-		bool *done UNUSED)
+	if ((pkgname = xbps_pkg_name(pkgver)) == NULL)
+		return;
+	xbps_dictionary_remove(dest, pkgname);
+	free(pkgname);
+	printf("index: removed pkg %s\n", pkgver);
+}
+
+static void
+idx_cleaner(struct xbps_handle *xhp, xbps_array_t allkeys,
+		const char *repourl, bool hashcheck)
 {
-	struct CleanerCbInfo *info = arg;
-	const char *arch = NULL, *pkgver = NULL, *sha256 = NULL;
-	char *filen, *pkgname;
-
-	xbps_dictionary_get_cstring_nocopy(obj, "architecture", &arch);
-	xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
-
-	xbps_dbg_printf(xhp, "%s: checking %s [%s] ...\n", info->repourl, pkgver, arch);
-
-	filen = xbps_xasprintf("%s/%s.%s.xbps", info->repourl, pkgver, arch);
-	if (access(filen, R_OK) == -1) {
-		/*
-		 * File cannot be read, might be permissions,
-		 * broken or simply unexistent; either way, remove it.
-		 */
-		pkgname = xbps_pkg_name(pkgver);
-		if (pkgname == NULL)
-			goto out;
-		xbps_dictionary_remove(dest, pkgname);
-		free(pkgname);
-		printf("index: removed pkg %s\n", pkgver);
-	} else if (info->hashcheck) {
-		/*
-		 * File can be read; check its hash.
-		 */
-		xbps_dictionary_get_cstring_nocopy(obj,
-				"filename-sha256", &sha256);
-		if (xbps_file_hash_check(filen, sha256) != 0) {
-			pkgname = xbps_pkg_name(pkgver);
-			if (pkgname == NULL)
-				goto out;
-			xbps_dictionary_remove(dest, pkgname);
-			free(pkgname);
-			printf("index: removed pkg %s\n", pkgver);
+	xbps_dictionary_t pkgd;
+	struct xbps_file_hash_job *jobs;
+	const char *key, *arch = NULL, *pkgver = NULL, *sha256 = NULL;
+	const char **pkgvers;
+	char *filen;
+	unsigned int i, njobs = 0;
+
+	jobs = calloc(xbps_array_count(allkeys), sizeof(*jobs));
+	pkgvers = calloc(xbps_array_count(allkeys), sizeof(*pkgvers));
+	assert(jobs);
+	assert(pkgvers);
+
+	for (i = 0; i < xbps_array_count(allkeys); i++) {
+		key = xbps_dictionary_keysym_cstring_nocopy(xbps_array_get(allkeys, i));
+		/* ignore internal objs */
+		if (strncmp(key, "_XBPS_", 6) == 0)
+			continue;
+		pkgd = xbps_dictionary_get(dest, key);
+		xbps_dictionary_get_cstring_nocopy(pkgd, "architecture", &arch);
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+
+		xbps_dbg_printf(xhp, "%s: checking %s [%s] ...\n", repourl, pkgver, arch);
+
+		filen = xbps_xasprintf("%s/%s.%s.xbps", repourl, pkgver, arch);
+		if (access(filen, R_OK) == -1) {
+			/*
+			 * File cannot be read, might be permissions,
+			 * broken or simply unexistent; either way, remove it.
+			 */
+			idx_remove_pkg(pkgver);
+			free(filen);
+		} else if (hashcheck) {
+			/*
+			 * File can be read; check its hash below.
+			 */
+			sha256 = NULL;
+			xbps_dictionary_get_cstring_nocopy(pkgd,
+					"filename-sha256", &sha256);
+			jobs[njobs].file = filen;
+			jobs[njobs].digest = sha256;
+			pkgvers[njobs++] = pkgver;
+		} else {
+			free(filen);
 		}
 	}
-out:
-	free(filen);
-	return 0;
+	/*
+	 * Hash all binary packages at once.
+	 */
+	(void)xbps_file_hash_batch(xhp, jobs, njobs);
+	for (i = 0; i < njobs; i++) {
+		if (jobs[i].rv != 0)
+			idx_remove_pkg(pkgvers[i]);
+		free(__UNCONST(jobs[i].file));
+	}
+	free(pkgvers);
+	free(jobs);
 }
 
 static int
@@ -99,16 +120,12 @@ cleanup_repo(struct xbps_handle *xhp, const char *repodir, struct xbps_repo *rep
 {
 	int rv = 0;
 	xbps_array_t allkeys;
-	struct CleanerCbInfo info = {
-		.hashcheck = hashcheck,
-		.repourl = repodir
-	};
 	/*
 	 * First pass: find out obsolete entries on index and index-files.
 	 */
 	dest = xbps_dictionary_copy_mutable(repo->idx);
 	allkeys = xbps_dictionary_all_keys(dest);
-	(void)xbps_array_foreach_cb_multi(xhp, allkeys, repo->idx, idx_cleaner_cb, &info);
+	idx_cleaner(xhp, allkeys, repodir, hashcheck);
 	xbps_object_release(allkeys);
 
 	if (strcmp("stagedata", reponame) == 0 && xbps_dictionary_count(dest) == 0) {
@@ -0,0 +1,103 @@
+/*-
+ * Copyright (c) 2026 agent <agent@local>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <xbps.h>
+#include "defs.h"
+
+/*
+ * Every thread takes the next pending job until there are none left,
+ * so that a few slow packages do not leave the other threads idle.
+ */
+struct jobs {
+	void (*fn)(unsigned int, void *);
+	void *arg;
+	unsigned int njobs;
+	unsigned int next;
+	pthread_mutex_t mtx;
+};
+
+static void *
+jobs_thread(void *arg)
+{
+	struct jobs *jobs = arg;
+	unsigned int i;
+
+	for (;;) {
+		pthread_mutex_lock(&jobs->mtx);
+		if (jobs->next >= jobs->njobs) {
+			pthread_mutex_unlock(&jobs->mtx);
+			break;
+		}
+		i = jobs->next++;
+		pthread_mutex_unlock(&jobs->mtx);
+
+		(*jobs->fn)(i, jobs->arg);
+	}
+	return NULL;
+}
+
+void
+run_jobs(unsigned int njobs, void (*fn)(unsigned int, void *), void *arg)
+{
+	struct jobs jobs;
+	pthread_t *thds;
+	long ncpus;
+	unsigned int i, n = 0, nthreads;
+
+	assert(fn);
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = ncpus > 1 ? (unsigned int)ncpus : 1;
+	if (nthreads > njobs)
+		nthreads = njobs;
+
+	if (nthreads <= 1 || pthread_mutex_init(&jobs.mtx, NULL) != 0) {
+		for (i = 0; i < njobs; i++)
+			(*fn)(i, arg);
+		return;
+	}
+	jobs.fn = fn;
+	jobs.arg = arg;
+	jobs.njobs = njobs;
+	jobs.next = 0;
+
+	thds = calloc(nthreads - 1, sizeof(*thds));
+	assert(thds);
+	for (; n < nthreads - 1; n++) {
+		if (pthread_create(&thds[n], NULL, jobs_thread, &jobs) != 0)
+			break;
+	}
+	/* the calling thread takes jobs too */
+	jobs_thread(&jobs);
+	for (i = 0; i < n; i++)
+		pthread_join(thds[i], NULL);
+	free(thds);
+	pthread_mutex_destroy(&jobs.mtx);
+}
@@ -40,10 +40,12 @@ usage(bool fail)
 	    " -d --debug                        Debug mode shown to stderr\n"
 	    " -f --force                        Force mode to overwrite entry in add mode\n"
 	    " -h --help                         Show help usage\n"
+	    " -j --threads <N>                  Number of compression threads for xz and zstd\n"
 	    " -v --verbose                      Verbose messages\n"
 	    " -V --version                      Show XBPS version\n"
 	    " -C --hashcheck                    Consider file hashes for cleaning up packages\n"
 	    "    --compression <fmt>            Compression format: none, gzip (default), bzip2, lz4, zstd, xz.\n"
+	    "    --digest <algo>                Package digest: sha256 (default), blake2b.\n"
 	    "    --privkey <key>                Path to the private key for signing\n"
 	    "    --signedby <string>            Signature details, i.e \"name <email>\"\n\n"
 	    "MODE\n"
@@ -58,13 +60,14 @@ usage(bool fail)
 int
 main(int argc, char **argv)
 {
-	const char *shortopts = "acdfhrsCSVv";
+	const char *shortopts = "acdfhj:rsCSVv";
 	struct option longopts[] = {
 		{ "add", no_argument, NULL, 'a' },
 		{ "clean", no_argument, NULL, 'c' },
 		{ "debug", no_argument, NULL, 'd' },
 		{ "force", no_argument, NULL, 'f' },
 		{ "help", no_argument, NULL, 'h' },
+		{ "threads", required_argument, NULL, 'j' },
 		{ "remove-obsoletes", no_argument, NULL, 'r' },
 		{ "version", no_argument, NULL, 'V' },
 		{ "verbose", no_argument, NULL, 'v' },
@@ -74,10 +77,11 @@ main(int argc, char **argv)
 		{ "sign-pkg", no_argument, NULL, 'S'},
 		{ "hashcheck", no_argument, NULL, 'C' },
 		{ "compression", required_argument, NULL, 2},
+		{ "digest", required_argument, NULL, 3},
 		{ NULL, 0, NULL, 0 }
 	};
 	struct xbps_handle xh;
-	const char *compression = NULL;
+	const char *compression = NULL, *digest = NULL;
 	const char *privkey = NULL, *signedby = NULL;
 	int rv, c, flags = 0;
 	bool add_mode, clean_mode, rm_mode, sign_mode, sign_pkg_mode, force,
@@ -97,6 +101,9 @@ main(int argc, char **argv)
 		case 2:
 			compression = optarg;
 			break;
+		case 3:
+			digest = optarg;
+			break;
 		case 'a':
 			add_mode = true;
 			break;
@@ -112,6 +119,10 @@ main(int argc, char **argv)
 		case 'h':
 			usage(false);
 			/* NOTREACHED */
+		case 'j':
+			/* used by repodata_flush() */
+			setenv("XBPS_COMPRESS_THREADS", optarg, 1);
+			break;
 		case 'r':
 			rm_mode = true;
 			break;
@@ -144,6 +155,10 @@ main(int argc, char **argv)
 		    "remove-obsoletes, sign or sign-pkg.\n");
 		exit(EXIT_FAILURE);
 	}
+	if (digest && !xbps_digest_supported(digest)) {
+		fprintf(stderr, "Unsupported digest: %s\n", digest);
+		exit(EXIT_FAILURE);
+	}
 
 	/* initialize libxbps */
 	memset(&xh, 0, sizeof(xh));
@@ -155,7 +170,7 @@ main(int argc, char **argv)
 	}
 
 	if (add_mode)
-		rv = index_add(&xh, optind, argc, argv, force, compression);
+		rv = index_add(&xh, optind, argc, argv, force, compression, digest);
 	else if (clean_mode)
 		rv = index_clean(&xh, argv[optind], hashcheck, compression);
 	else if (rm_mode)
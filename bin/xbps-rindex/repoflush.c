@@ -81,6 +81,11 @@ repodata_flush(struct xbps_handle *xhp, const char *repodir,
         } else {
 		return false;
 	}
+	if (xbps_archive_set_threads(ar, NULL) != 0) {
+		fprintf(stderr, "%s: invalid XBPS_COMPRESS_THREADS: %s\n",
+		    _XBPS_RINDEX, getenv("XBPS_COMPRESS_THREADS"));
+		return false;
+	}
 
 	archive_write_set_format_pax_restricted(ar);
 	archive_write_open_fd(ar, repofd);
@@ -24,8 +24,10 @@
  */
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <assert.h>
@@ -112,6 +114,7 @@ rsa_sign_file(RSA *rsa, const char *file,
 				*sigret, siglen, rsa)) {
 		free(sha256);
 		free(*sigret);
+		*sigret = NULL;
 		return false;
 	}
 
@@ -252,32 +255,65 @@ out:
 	return rv ? -1 : 0;
 }
 
+/*
+ * Package signatures are computed by a pool of threads, the calling
+ * thread included, sharing the private key; RSA keys are safe to use
+ * concurrently. They are written in argv order.
+ */
+struct sign_job {
+	const char *binpkg;
+	unsigned char *sig;
+	unsigned int siglen;
+	int rv;
+	bool sign;
+};
+
+struct sign_pool {
+	struct sign_job *jobs;
+	RSA *rsa;
+};
+
+static void
+sign_job(unsigned int i, void *arg)
+{
+	struct sign_pool *pool = arg;
+	struct sign_job *job = &pool->jobs[i];
+
+	if (!job->sign)
+		return;
+	job->rv = 0;
+	if (!rsa_sign_file(pool->rsa, job->binpkg, &job->sig, &job->siglen))
+		job->rv = errno ? errno : EINVAL;
+}
+
+static void
+sign_files(struct sign_job *jobs, int njobs, RSA *rsa)
+{
+	struct sign_pool pool = { .jobs = jobs, .rsa = rsa };
+
+	run_jobs((unsigned int)njobs, sign_job, &pool);
+}
+
 static int
-sign_pkg(struct xbps_handle *xhp, const char *binpkg, const char *privkey, bool force)
+write_sig(struct xbps_handle *xhp, struct sign_job *job, bool force)
 {
-	RSA *rsa = NULL;
-	unsigned char *sig = NULL;
-	unsigned int siglen = 0;
 	char *sigfile = NULL;
 	int rv = 0, sigfile_fd = -1;
 
-	sigfile = xbps_xasprintf("%s.sig", binpkg);
+	sigfile = xbps_xasprintf("%s.sig", job->binpkg);
 	/*
 	 * Skip pkg if file signature exists
 	 */
-	if (!force && ((sigfile_fd = access(sigfile, R_OK)) == 0)) {
+	if (!job->sign ||
+	    (!force && ((sigfile_fd = access(sigfile, R_OK)) == 0))) {
 		if (xhp->flags & XBPS_FLAG_VERBOSE)
-			fprintf(stderr, "skipping %s, file signature found.\n", binpkg);
+			fprintf(stderr, "skipping %s, file signature found.\n", job->binpkg);
 
 		sigfile_fd = -1;
 		goto out;
 	}
-	/*
-	 * Generate pkg file signature.
-	 */
-	rsa = load_rsa_key(privkey);
-	if (!rsa_sign_file(rsa, binpkg, &sig, &siglen)) {
-		fprintf(stderr, "failed to sign %s: %s\n", binpkg, strerror(errno));
+	if (job->rv != 0) {
+		fprintf(stderr, "failed to sign %s: %s\n", job->binpkg, strerror(job->rv));
 		rv = EINVAL;
 		goto out;
 	}
@@ -292,23 +328,16 @@ sign_pkg(struct xbps_handle *xhp, const char *binpkg, const char *privkey, bool
 	if (sigfile_fd == -1) {
 		fprintf(stderr, "failed to create %s: %s\n", sigfile, strerror(errno));
 		rv = EINVAL;
-		free(sig);
 		goto out;
 	}
-	if (write(sigfile_fd, sig, siglen) != (ssize_t)siglen) {
+	if (write(sigfile_fd, job->sig, job->siglen) != (ssize_t)job->siglen) {
 		fprintf(stderr, "failed to write %s: %s\n", sigfile, strerror(errno));
 		rv = EINVAL;
-		free(sig);
 		goto out;
 	}
-	free(sig);
-	printf("signed successfully %s\n", binpkg);
+	printf("signed successfully %s\n", job->binpkg);
 
 out:
-	if (rsa) {
-		RSA_free(rsa);
-		rsa = NULL;
-	}
 	if (sigfile)
 		free(sigfile);
 	if (sigfile_fd != -1)
@@ -321,16 +350,43 @@ int
 sign_pkgs(struct xbps_handle *xhp, int args, int argmax, char **argv,
 		const char *privkey, bool force)
 {
+	struct sign_job *jobs;
+	RSA *rsa = NULL;
+	char *sigfile;
+	int rv = 0, njobs = argmax - args;
+	bool sign = false;
+
 	ssl_init();
 	/*
-	 * Process all packages specified in argv.
+	 * Find out which packages need to be signed.
 	 */
-	for (int i = args; i < argmax; i++) {
-		int rv;
-		const char *binpkg = argv[i];
-		rv = sign_pkg(xhp, binpkg, privkey, force);
-		if (rv != 0)
-			return rv;
+	jobs = calloc(njobs, sizeof(*jobs));
+	assert(jobs);
+	for (int i = 0; i < njobs; i++) {
+		jobs[i].binpkg = argv[args + i];
+		sigfile = xbps_xasprintf("%s.sig", jobs[i].binpkg);
+		jobs[i].sign = force || access(sigfile, R_OK) != 0;
+		sign = sign || jobs[i].sign;
+		free(sigfile);
 	}
-	return 0;
+	/*
+	 * Load the private key once and sign them concurrently.
+	 */
+	if (sign) {
+		rsa = load_rsa_key(privkey);
+		sign_files(jobs, njobs, rsa);
+		RSA_free(rsa);
+	}
+	/*
+	 * Write the signatures in argv order.
+	 */
+	for (int i = 0; i < njobs; i++) {
+		if ((rv = write_sig(xhp, &jobs[i], force)) != 0)
+			break;
+	}
+	for (int i = 0; i < njobs; i++)
+		free(jobs[i].sig);
+	free(jobs);
+
+	return rv;
 }
@@ -28,6 +28,7 @@
 #define _XBPS_API_IMPL_H_
 
 #include <assert.h>
+#include <pthread.h>
 #include "xbps.h"
 
 /*
@@ -98,6 +99,23 @@
 /**
  * @private
  */
+struct xbps_depgraph;
+struct xbps_uring;
+/**
+ * @private
+ * Packages unpacked concurrently pass their turn in order, so that
+ * their INSTALL "pre" actions are executed one at a time and in
+ * transaction order; see xbps_unpack_binary_pkg().
+ */
+struct xbps_unpack_turn {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int next;
+	bool failed;
+};
+typedef int (*xbps_depgraph_cb_t)(struct xbps_depgraph *,
+		const unsigned int *, unsigned int, void *);
+
 int HIDDEN dewey_match(const char *, const char *);
 int HIDDEN xbps_pkgdb_init(struct xbps_handle *);
 void HIDDEN xbps_pkgdb_release(struct xbps_handle *);
@@ -111,6 +129,8 @@ bool HIDDEN xbps_remove_pkg_from_array_by_pattern(xbps_array_t, const char *);
 bool HIDDEN xbps_remove_pkg_from_array_by_pkgver(xbps_array_t, const char *);
 void HIDDEN xbps_fetch_set_cache_connection(int, int);
 void HIDDEN xbps_fetch_unset_cache_connection(void);
+void HIDDEN xbps_fetch_set_session_cache(struct xbps_handle *);
+void HIDDEN xbps_fetch_cache_stats(struct xbps_handle *);
 int HIDDEN xbps_cb_message(struct xbps_handle *, xbps_dictionary_t, const char *);
 int HIDDEN xbps_entry_is_a_conf_file(xbps_dictionary_t, const char *);
 int HIDDEN xbps_entry_install_conf_file(struct xbps_handle *, xbps_dictionary_t,
@@ -133,23 +153,60 @@ bool HIDDEN xbps_transaction_shlibs(struct xbps_handle *, xbps_array_t,
 int HIDDEN xbps_transaction_init(struct xbps_handle *);
 int HIDDEN xbps_transaction_store(struct xbps_handle *, xbps_array_t,
 		xbps_dictionary_t, const char *, bool);
+int HIDDEN xbps_transaction_pkgset_add(struct xbps_handle *,
+		xbps_dictionary_t, bool);
+xbps_dictionary_t HIDDEN xbps_transaction_pkgset_get(struct xbps_handle *,
+		const char *);
+xbps_dictionary_t HIDDEN xbps_transaction_pkgset_get_virtual(
+		struct xbps_handle *, const char *);
 char HIDDEN *xbps_get_remote_repo_string(const char *);
 int HIDDEN xbps_repo_sync(struct xbps_handle *, const char *);
+void HIDDEN xbps_repo_mirror_add(struct xbps_handle *, const char *,
+		const char *);
+void HIDDEN xbps_repo_mirror_failed(struct xbps_handle *, const char *,
+		const char *);
+xbps_array_t HIDDEN xbps_repo_mirrors(struct xbps_handle *, const char *,
+		size_t *);
+void HIDDEN xbps_repo_mirrors_init(struct xbps_handle *);
+void HIDDEN xbps_repo_mirrors_probe(struct xbps_handle *, const char *);
+void HIDDEN xbps_file_hash_save(const char *, const unsigned char *);
+unsigned char HIDDEN *xbps_file_hash_saved(const char *);
+void HIDDEN xbps_file_hash_cache_init(struct xbps_handle *);
+void HIDDEN xbps_file_hash_cache_end(struct xbps_handle *);
+bool HIDDEN xbps_file_hash_cache_enabled(struct xbps_handle *);
+bool HIDDEN xbps_file_hash_cache_get(struct xbps_handle *, const struct stat *,
+		const char *, char *);
+void HIDDEN xbps_file_hash_cache_put(struct xbps_handle *, const char *,
+		const struct stat *, const char *);
 int HIDDEN xbps_file_hash_check_dictionary(struct xbps_handle *,
 		xbps_dictionary_t, const char *, const char *);
 int HIDDEN xbps_file_exec(struct xbps_handle *, const char *, ...);
+int HIDDEN xbps_file_execv(struct xbps_handle *, const char **);
+void HIDDEN xbps_triggers_add(struct xbps_handle *, xbps_dictionary_t);
+int HIDDEN xbps_configure_pkg_script(struct xbps_handle *, xbps_dictionary_t,
+		bool);
+int HIDDEN xbps_configure_pkg_done(struct xbps_handle *, xbps_dictionary_t);
 void HIDDEN xbps_set_cb_fetch(struct xbps_handle *, off_t, off_t, off_t,
 		const char *, bool, bool, bool);
 int HIDDEN xbps_set_cb_state(struct xbps_handle *, xbps_state_t, int,
 		const char *, const char *, ...);
-int HIDDEN xbps_unpack_binary_pkg(struct xbps_handle *, xbps_dictionary_t);
+int HIDDEN xbps_plist_write_file(xbps_dictionary_t, const char *, mode_t,
+		bool);
+void HIDDEN xbps_set_cb_unpack(struct xbps_handle *,
+		struct xbps_unpack_cb_data *);
+int HIDDEN xbps_unpack_binary_pkg(struct xbps_handle *, xbps_dictionary_t,
+		struct xbps_unpack_turn *, unsigned int);
 int HIDDEN xbps_transaction_package_replace(struct xbps_handle *, xbps_array_t);
 int HIDDEN xbps_remove_pkg(struct xbps_handle *, const char *, bool);
+int HIDDEN xbps_remove_files(struct xbps_handle *, xbps_array_t,
+		const char *, bool, bool);
 int HIDDEN xbps_register_pkg(struct xbps_handle *, xbps_dictionary_t);
 void HIDDEN xbps_transaction_conflicts(struct xbps_handle *, xbps_array_t);
 char HIDDEN *xbps_archive_get_file(struct archive *, struct archive_entry *);
 xbps_dictionary_t HIDDEN xbps_archive_get_dictionary(struct archive *,
 		struct archive_entry *);
+xbps_dictionary_t HIDDEN xbps_archive_fetch_pkg_plist(xbps_dictionary_t,
+		const char *, const char *);
 const char HIDDEN *vpkg_user_conf(struct xbps_handle *, const char *, bool);
 xbps_array_t HIDDEN xbps_get_pkg_fulldeptree(struct xbps_handle *,
 		const char *, bool);
@@ -158,5 +215,30 @@ struct xbps_repo HIDDEN *xbps_regget_repo(struct xbps_handle *,
 int HIDDEN xbps_conf_init(struct xbps_handle *);
 int HIDDEN xbps_transaction_files(struct xbps_handle *,
 		xbps_object_iterator_t);
+struct xbps_depgraph HIDDEN *xbps_depgraph_create(void);
+void HIDDEN xbps_depgraph_free(struct xbps_depgraph *);
+unsigned int HIDDEN xbps_depgraph_count(struct xbps_depgraph *);
+xbps_dictionary_t HIDDEN xbps_depgraph_get_pkgd(struct xbps_depgraph *,
+		unsigned int);
+bool HIDDEN xbps_depgraph_lookup(struct xbps_depgraph *, const char *,
+		unsigned int *);
+int HIDDEN xbps_depgraph_add(struct xbps_depgraph *, const char *,
+		xbps_dictionary_t, unsigned int *);
+int HIDDEN xbps_depgraph_add_edge(struct xbps_depgraph *, unsigned int,
+		unsigned int);
+struct xbps_uring HIDDEN *xbps_uring_init(unsigned int);
+void HIDDEN xbps_uring_free(struct xbps_uring *);
+unsigned int HIDDEN xbps_uring_entries(struct xbps_uring *);
+void HIDDEN xbps_uring_openat(struct xbps_uring *, int, const char *, int,
+		mode_t, uint64_t);
+void HIDDEN xbps_uring_write(struct xbps_uring *, int, const void *, size_t,
+		uint64_t, uint64_t);
+void HIDDEN xbps_uring_close(struct xbps_uring *, int, uint64_t);
+int HIDDEN xbps_uring_wait(struct xbps_uring *,
+		void (*)(uint64_t, int, void *), void *);
+int HIDDEN xbps_jobs_run(unsigned int, unsigned int,
+		int (*)(unsigned int, void *), void *);
+int HIDDEN xbps_depgraph_sort(struct xbps_depgraph *, const unsigned int *,
+		unsigned int, xbps_depgraph_cb_t, void *);
 
 #endif /* !_XBPS_API_IMPL_H_ */
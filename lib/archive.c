@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "xbps_api_impl.h"
 
@@ -105,3 +106,46 @@ xbps_archive_append_buf(struct archive *ar, const void *buf, const size_t buflen
 
 	return 0;
 }
+
+int
+xbps_archive_set_threads(struct archive *ar, const char *threads)
+{
+	char *endp, buf[16];
+	unsigned long n;
+
+	assert(ar);
+
+	if (threads == NULL)
+		threads = getenv("XBPS_COMPRESS_THREADS");
+	if (threads == NULL || *threads == '\0')
+		return 0;
+
+	errno = 0;
+	n = strtoul(threads, &endp, 10);
+	if (errno || *endp != '\0' || *threads == '-' || n > 256)
+		return EINVAL;
+	if (n == 0) {
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n = ncpus > 0 ? (unsigned long)ncpus : 1;
+	}
+	if (n == 1)
+		return 0;
+
+	/*
+	 * Only the xz and zstd filters can compress with multiple
+	 * threads; their output is still a regular xz or zstd stream.
+	 */
+	switch (archive_filter_code(ar, 0)) {
+	case ARCHIVE_FILTER_XZ:
+	case ARCHIVE_FILTER_ZSTD:
+		break;
+	default:
+		return 0;
+	}
+	snprintf(buf, sizeof(buf), "%lu", n);
+	if (archive_write_set_filter_option(ar, NULL, "threads", buf) != ARCHIVE_OK)
+		xbps_warn_printf("cannot compress with %s threads: %s\n",
+		    buf, archive_error_string(ar));
+
+	return 0;
+}
@@ -33,6 +33,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "xbps_api_impl.h"
 
@@ -40,6 +41,12 @@
 #pragma clang diagnostic ignored "-Wformat-nonliteral"
 #endif
 
+/*
+ * Client callbacks may be called from multiple threads (i.e while
+ * unpacking packages in parallel), serialize them.
+ */
+static pthread_mutex_t cb_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 void HIDDEN
 xbps_set_cb_fetch(struct xbps_handle *xhp,
 		  off_t file_size,
@@ -63,7 +70,20 @@ xbps_set_cb_fetch(struct xbps_handle *xhp,
 	xfcd.cb_start = cb_start;
 	xfcd.cb_update = cb_update;
 	xfcd.cb_end = cb_end;
+	pthread_mutex_lock(&cb_mtx);
 	(*xhp->fetch_cb)(&xfcd, xhp->fetch_cb_data);
+	pthread_mutex_unlock(&cb_mtx);
+}
+
+void HIDDEN
+xbps_set_cb_unpack(struct xbps_handle *xhp, struct xbps_unpack_cb_data *xucd)
+{
+	if (xhp->unpack_cb == NULL)
+		return;
+
+	pthread_mutex_lock(&cb_mtx);
+	(*xhp->unpack_cb)(xucd, xhp->unpack_cb_data);
+	pthread_mutex_unlock(&cb_mtx);
 }
 
 int HIDDEN
@@ -95,7 +115,9 @@ xbps_set_cb_state(struct xbps_handle *xhp,
 		else
 			xscd.desc = buf;
 	}
+	pthread_mutex_lock(&cb_mtx);
 	retval = (*xhp->state_cb)(&xscd, xhp->state_cb_data);
+	pthread_mutex_unlock(&cb_mtx);
 	if (buf != NULL)
 		free(buf);
 
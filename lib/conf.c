@@ -150,12 +150,20 @@ enum {
 	KEY_ARCHITECTURE,
 	KEY_BESTMATCHING,
 	KEY_CACHEDIR,
+	KEY_DURABLE,
+	KEY_FETCHSEGMENTS,
+	KEY_FETCHTHRESHOLD,
+	KEY_HASHCACHE,
 	KEY_IGNOREPKG,
 	KEY_INCLUDE,
+	KEY_IOURING,
+	KEY_PARALLELCONFIGURE,
 	KEY_PRESERVE,
 	KEY_REPOSITORY,
 	KEY_ROOTDIR,
+	KEY_STRICTHASH,
 	KEY_SYSLOG,
+	KEY_TLSCACHE,
 	KEY_VIRTUALPKG,
 };
 
@@ -167,15 +175,51 @@ static const struct key {
 	{ "architecture", 12, KEY_ARCHITECTURE },
 	{ "bestmatching", 12, KEY_BESTMATCHING },
 	{ "cachedir",      8, KEY_CACHEDIR },
+	{ "durable",       7, KEY_DURABLE },
+	{ "fetchsegments", 13, KEY_FETCHSEGMENTS },
+	{ "fetchthreshold", 14, KEY_FETCHTHRESHOLD },
+	{ "hashcache",     9, KEY_HASHCACHE },
 	{ "ignorepkg",     9, KEY_IGNOREPKG },
 	{ "include",       7, KEY_INCLUDE },
+	{ "iouring",       7, KEY_IOURING },
+	{ "parallelconfigure", 17, KEY_PARALLELCONFIGURE },
 	{ "preserve",      8, KEY_PRESERVE },
 	{ "repository",   10, KEY_REPOSITORY },
 	{ "rootdir",       7, KEY_ROOTDIR },
+	{ "stricthash",   10, KEY_STRICTHASH },
 	{ "syslog",        6, KEY_SYSLOG },
+	{ "tlscache",      8, KEY_TLSCACHE },
 	{ "virtualpkg",   10, KEY_VIRTUALPKG },
 };
 
+static int
+parse_size(const char *val, uint64_t *sizep)
+{
+	unsigned long long size;
+	char *end;
+
+	errno = 0;
+	size = strtoull(val, &end, 10);
+	if (errno || end == val)
+		return EINVAL;
+	switch (*end) {
+	case 'G': case 'g':
+		size *= 1024;
+		/* FALLTHROUGH */
+	case 'M': case 'm':
+		size *= 1024;
+		/* FALLTHROUGH */
+	case 'K': case 'k':
+		size *= 1024;
+		end++;
+		break;
+	}
+	if (*end != '\0')
+		return EINVAL;
+	*sizep = size;
+	return 0;
+}
+
 static int
 parse_option(char *buf, const char **keyp, char **valp)
 {
@@ -264,6 +308,7 @@ parse_file(struct xbps_handle *xhp, const char *path, bool nested)
 	char *line = NULL;
 	int rv = 0;
 	int size, rs;
+	uint64_t num;
 	char *dir;
 
 	if ((fp = fopen(path, "r")) == NULL) {
@@ -350,6 +395,79 @@ parse_file(struct xbps_handle *xhp, const char *path, bool nested)
 				xbps_dbg_printf(xhp, "%s: pkg best matching disabled\n", path);
 			}
 			break;
+		case KEY_DURABLE:
+			if (strcasecmp(val, "true") == 0) {
+				xhp->flags |= XBPS_FLAG_DURABLE;
+				xbps_dbg_printf(xhp, "%s: durable transactions enabled\n", path);
+			} else {
+				xhp->flags &= ~XBPS_FLAG_DURABLE;
+				xbps_dbg_printf(xhp, "%s: durable transactions disabled\n", path);
+			}
+			break;
+		case KEY_FETCHSEGMENTS:
+			if (parse_size(val, &num) != 0 || num > XBPS_FETCH_MAXSEGMENTS) {
+				xbps_dbg_printf(xhp, "%s: invalid fetchsegments value at "
+				    "line %zu\n", path, nlines);
+				break;
+			}
+			xhp->fetch_segments = (unsigned int)num;
+			xbps_dbg_printf(xhp, "%s: fetch segments set to %u\n",
+			    path, xhp->fetch_segments);
+			break;
+		case KEY_FETCHTHRESHOLD:
+			if (parse_size(val, &xhp->fetch_threshold) != 0) {
+				xbps_dbg_printf(xhp, "%s: invalid fetchthreshold value at "
+				    "line %zu\n", path, nlines);
+				break;
+			}
+			xbps_dbg_printf(xhp, "%s: fetch threshold set to %ju\n",
+			    path, (uintmax_t)xhp->fetch_threshold);
+			break;
+		case KEY_TLSCACHE:
+			if (strcasecmp(val, "true") == 0) {
+				xhp->flags |= XBPS_FLAG_TLS_CACHE;
+				xbps_dbg_printf(xhp, "%s: TLS session cache enabled\n", path);
+			} else {
+				xhp->flags &= ~XBPS_FLAG_TLS_CACHE;
+				xbps_dbg_printf(xhp, "%s: TLS session cache disabled\n", path);
+			}
+			break;
+		case KEY_HASHCACHE:
+			if (strcasecmp(val, "true") == 0) {
+				xhp->flags |= XBPS_FLAG_HASH_CACHE;
+				xbps_dbg_printf(xhp, "%s: hash cache enabled\n", path);
+			} else {
+				xhp->flags &= ~XBPS_FLAG_HASH_CACHE;
+				xbps_dbg_printf(xhp, "%s: hash cache disabled\n", path);
+			}
+			break;
+		case KEY_IOURING:
+			if (strcasecmp(val, "true") == 0) {
+				xhp->flags &= ~XBPS_FLAG_DISABLE_IO_URING;
+				xbps_dbg_printf(xhp, "%s: io_uring enabled\n", path);
+			} else {
+				xhp->flags |= XBPS_FLAG_DISABLE_IO_URING;
+				xbps_dbg_printf(xhp, "%s: io_uring disabled\n", path);
+			}
+			break;
+		case KEY_PARALLELCONFIGURE:
+			if (strcasecmp(val, "true") == 0) {
+				xhp->flags |= XBPS_FLAG_PARALLEL_CONFIGURE;
+				xbps_dbg_printf(xhp, "%s: parallel configure enabled\n", path);
+			} else {
+				xhp->flags &= ~XBPS_FLAG_PARALLEL_CONFIGURE;
+				xbps_dbg_printf(xhp, "%s: parallel configure disabled\n", path);
+			}
+			break;
+		case KEY_STRICTHASH:
+			if (strcasecmp(val, "true") == 0) {
+				xhp->flags |= XBPS_FLAG_STRICT_HASH;
+				xbps_dbg_printf(xhp, "%s: strict hash checking enabled\n", path);
+			} else {
+				xhp->flags &= ~XBPS_FLAG_STRICT_HASH;
+				xbps_dbg_printf(xhp, "%s: strict hash checking disabled\n", path);
+			}
+			break;
 		case KEY_IGNOREPKG:
 			store_ignored_pkg(xhp, val);
 			break;
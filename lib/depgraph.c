@@ -0,0 +1,328 @@
+/*-
+ * Copyright (c) 2026 agent <agent@local>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * Dependency graph.
+ *
+ * Every package added to the graph is interned by a string key (pkgname
+ * or pkgver) into an id, that is just its index in the nodes array.
+ * Edges are stored as adjacency lists of ids, an edge from `a' to `b'
+ * means that `a' depends on `b'.
+ *
+ * xbps_depgraph_sort() walks the graph with an iterative version of
+ * Tarjan's strongly connected components algorithm, which runs in
+ * O(V+E) and emits the components in reverse topological order, that
+ * is: dependencies always come before the packages depending on them.
+ * Any component with more than one package is a dependency cycle, its
+ * packages are emitted in the order the depth-first walk finished them.
+ */
+
+#define UNVISITED	((unsigned int)-1)
+#define NOITEM		((unsigned int)-1)
+
+struct node {
+	char *key;
+	xbps_dictionary_t pkgd;
+	unsigned int *deps;
+	unsigned int ndeps;
+	unsigned int szdeps;
+	unsigned int hnext;
+	unsigned int index;
+	unsigned int lowlink;
+	bool onstack;
+};
+
+struct xbps_depgraph {
+	struct node *nodes;
+	unsigned int nnodes;
+	unsigned int sznodes;
+	unsigned int *htable;
+	unsigned int hsize;
+};
+
+static unsigned int
+itemhash(const char *key, unsigned int hsize)
+{
+	unsigned int hv = 0xA1B5F342;
+
+	assert(key);
+
+	for (unsigned int i = 0; key[i]; ++i)
+		hv = (hv << 5) ^ (hv >> 23) ^ (unsigned char)key[i];
+
+	return hv & (hsize - 1);
+}
+
+static int
+rehash(struct xbps_depgraph *g, unsigned int hsize)
+{
+	unsigned int *htable, h;
+
+	if ((htable = malloc(hsize * sizeof(*htable))) == NULL)
+		return ENOMEM;
+	for (unsigned int i = 0; i < hsize; i++)
+		htable[i] = NOITEM;
+
+	for (unsigned int i = 0; i < g->nnodes; i++) {
+		h = itemhash(g->nodes[i].key, hsize);
+		g->nodes[i].hnext = htable[h];
+		htable[h] = i;
+	}
+	free(g->htable);
+	g->htable = htable;
+	g->hsize = hsize;
+	return 0;
+}
+
+struct xbps_depgraph HIDDEN *
+xbps_depgraph_create(void)
+{
+	struct xbps_depgraph *g;
+
+	if ((g = calloc(1, sizeof(*g))) == NULL)
+		return NULL;
+	if (rehash(g, 1024) != 0) {
+		free(g);
+		return NULL;
+	}
+	return g;
+}
+
+void HIDDEN
+xbps_depgraph_free(struct xbps_depgraph *g)
+{
+	if (g == NULL)
+		return;
+
+	for (unsigned int i = 0; i < g->nnodes; i++) {
+		free(g->nodes[i].key);
+		free(g->nodes[i].deps);
+	}
+	free(g->nodes);
+	free(g->htable);
+	free(g);
+}
+
+unsigned int HIDDEN
+xbps_depgraph_count(struct xbps_depgraph *g)
+{
+	return g->nnodes;
+}
+
+xbps_dictionary_t HIDDEN
+xbps_depgraph_get_pkgd(struct xbps_depgraph *g, unsigned int id)
+{
+	assert(id < g->nnodes);
+	return g->nodes[id].pkgd;
+}
+
+bool HIDDEN
+xbps_depgraph_lookup(struct xbps_depgraph *g, const char *key,
+		unsigned int *id)
+{
+	unsigned int i;
+
+	for (i = g->htable[itemhash(key, g->hsize)]; i != NOITEM;
+	    i = g->nodes[i].hnext) {
+		if (strcmp(key, g->nodes[i].key) == 0) {
+			*id = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+int HIDDEN
+xbps_depgraph_add(struct xbps_depgraph *g, const char *key,
+		xbps_dictionary_t pkgd, unsigned int *id)
+{
+	struct node *node;
+	unsigned int h;
+
+	if (xbps_depgraph_lookup(g, key, id))
+		return EEXIST;
+
+	if (g->nnodes == g->sznodes) {
+		unsigned int sz = g->sznodes ? g->sznodes * 2 : 64;
+
+		node = realloc(g->nodes, sz * sizeof(*node));
+		if (node == NULL)
+			return ENOMEM;
+		g->nodes = node;
+		g->sznodes = sz;
+	}
+	node = &g->nodes[g->nnodes];
+	memset(node, 0, sizeof(*node));
+	if ((node->key = strdup(key)) == NULL)
+		return ENOMEM;
+	node->pkgd = pkgd;
+
+	h = itemhash(key, g->hsize);
+	node->hnext = g->htable[h];
+	g->htable[h] = g->nnodes;
+	*id = g->nnodes++;
+
+	if (g->nnodes > g->hsize)
+		return rehash(g, g->hsize * 2);
+
+	return 0;
+}
+
+int HIDDEN
+xbps_depgraph_add_edge(struct xbps_depgraph *g, unsigned int from,
+		unsigned int to)
+{
+	struct node *node;
+
+	assert(from < g->nnodes);
+	assert(to < g->nnodes);
+
+	node = &g->nodes[from];
+	for (unsigned int i = 0; i < node->ndeps; i++) {
+		if (node->deps[i] == to)
+			return 0;
+	}
+	if (node->ndeps == node->szdeps) {
+		unsigned int sz = node->szdeps ? node->szdeps * 2 : 4;
+		unsigned int *deps;
+
+		if ((deps = realloc(node->deps, sz * sizeof(*deps))) == NULL)
+			return ENOMEM;
+		node->deps = deps;
+		node->szdeps = sz;
+	}
+	node->deps[node->ndeps++] = to;
+	return 0;
+}
+
+struct frame {
+	unsigned int id;
+	unsigned int edge;
+};
+
+int HIDDEN
+xbps_depgraph_sort(struct xbps_depgraph *g, const unsigned int *roots,
+		unsigned int nroots, xbps_depgraph_cb_t cb, void *arg)
+{
+	struct frame *frames;
+	unsigned int *stack, *post;
+	unsigned int nframes = 0, nstack = 0, npost = 0, index = 0;
+	int rv = 0;
+
+	if (g->nnodes == 0)
+		return 0;
+
+	frames = malloc(g->nnodes * sizeof(*frames));
+	stack = malloc(g->nnodes * sizeof(*stack));
+	post = malloc(g->nnodes * sizeof(*post));
+	if (frames == NULL || stack == NULL || post == NULL) {
+		free(frames);
+		free(stack);
+		free(post);
+		return ENOMEM;
+	}
+	for (unsigned int i = 0; i < g->nnodes; i++) {
+		g->nodes[i].index = g->nodes[i].lowlink = UNVISITED;
+		g->nodes[i].onstack = false;
+	}
+	if (roots == NULL)
+		nroots = g->nnodes;
+
+	for (unsigned int r = 0; r < nroots && rv == 0; r++) {
+		unsigned int root = roots ? roots[r] : r;
+
+		assert(root < g->nnodes);
+		if (g->nodes[root].index != UNVISITED)
+			continue;
+
+		g->nodes[root].index = g->nodes[root].lowlink = index++;
+		g->nodes[root].onstack = true;
+		stack[nstack++] = root;
+		frames[nframes].id = root;
+		frames[nframes++].edge = 0;
+
+		while (nframes > 0 && rv == 0) {
+			struct frame *f = &frames[nframes - 1];
+			struct node *v = &g->nodes[f->id], *w;
+
+			if (f->edge < v->ndeps) {
+				/* visit next dependency */
+				w = &g->nodes[v->deps[f->edge]];
+				if (w->index == UNVISITED) {
+					w->index = w->lowlink = index++;
+					w->onstack = true;
+					stack[nstack++] = v->deps[f->edge];
+					frames[nframes].id = v->deps[f->edge];
+					frames[nframes++].edge = 0;
+				} else if (w->onstack && w->index < v->lowlink) {
+					v->lowlink = w->index;
+				}
+				f->edge++;
+				continue;
+			}
+			/* all dependencies visited */
+			post[npost++] = f->id;
+			if (--nframes > 0) {
+				w = &g->nodes[frames[nframes - 1].id];
+				if (v->lowlink < w->lowlink)
+					w->lowlink = v->lowlink;
+			}
+			if (v->lowlink == v->index) {
+				/* v is the root of a strongly connected component */
+				unsigned int first = nstack;
+
+				do {
+					first--;
+					g->nodes[stack[first]].onstack = false;
+				} while (stack[first] != f->id);
+				nstack = first;
+				/*
+				 * All packages finished since v was discovered
+				 * and not emitted yet are in this component.
+				 */
+				first = npost;
+				while (first > 0 && g->nodes[post[first - 1]].index >= v->index)
+					first--;
+
+				if (cb != NULL)
+					rv = (*cb)(g, &post[first], npost - first, arg);
+				npost = first;
+			}
+		}
+	}
+	free(frames);
+	free(stack);
+	free(post);
+
+	return rv;
+}
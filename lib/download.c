@@ -41,6 +41,10 @@
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <libgen.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
 
 #include "xbps_api_impl.h"
 #include "fetch.h"
@@ -81,6 +85,31 @@ xbps_fetch_unset_cache_connection(void)
 	fetchConnectionCacheClose();
 }
 
+void HIDDEN
+xbps_fetch_set_session_cache(struct xbps_handle *xhp)
+{
+	char *dir;
+
+	if ((xhp->flags & XBPS_FLAG_TLS_CACHE) == 0) {
+		fetchSessionCacheInit(NULL);
+		return;
+	}
+	dir = xbps_xasprintf("%s/tls", xhp->cachedir);
+	fetchSessionCacheInit(dir);
+	free(dir);
+}
+
+void HIDDEN
+xbps_fetch_cache_stats(struct xbps_handle *xhp)
+{
+	unsigned long hits, misses;
+
+	fetchConnectionCacheStats(&hits, &misses);
+	if (hits || misses)
+		xbps_dbg_printf(xhp, "[fetch] connection cache: %lu hits, "
+		    "%lu misses\n", hits, misses);
+}
+
 const char *
 xbps_fetch_error_string(void)
 {
@@ -90,20 +119,267 @@ xbps_fetch_error_string(void)
 	return fetchLastErrString;
 }
 
-int
-xbps_fetch_file_dest(struct xbps_handle *xhp, const char *uri, const char *filename, const char *flags)
+/*
+ * Segmented downloads: large files are split in ranges that are
+ * fetched concurrently, every range is written at its offset in the
+ * preallocated temporary file.
+ */
+struct fetch_segdl {
+	struct xbps_handle *xhp;
+	pthread_mutex_t mtx;
+	const char *filename;
+	off_t size;
+	off_t done;
+	bool failed;
+	int fd;
+};
+
+struct fetch_segment {
+	pthread_t thread;
+	struct fetch_segdl *dl;
+	fetchIO *fio;
+	off_t offset;
+	off_t length;
+	off_t done;
+	int rv;
+};
+
+static unsigned int
+fetch_nsegments(struct xbps_handle *xhp, struct url *url,
+    struct url_stat *url_st)
+{
+	unsigned int nsegs = xhp->fetch_segments;
+
+	if (nsegs < 2 || url_st->size <= 0 || url->offset != 0 ||
+	    (uint64_t)url_st->size < xhp->fetch_threshold)
+		return 0;
+	if (strcmp(url->scheme, SCHEME_HTTP) && strcmp(url->scheme, SCHEME_HTTPS))
+		return 0;
+	if (nsegs > XBPS_FETCH_MAXSEGMENTS)
+		nsegs = XBPS_FETCH_MAXSEGMENTS;
+	/* don't bother with ranges smaller than 1MB */
+	if (url_st->size / nsegs < 1024 * 1024)
+		nsegs = url_st->size / (1024 * 1024);
+
+	return nsegs < 2 ? 0 : nsegs;
+}
+
+static void *
+fetch_segment_thread(void *arg)
+{
+	struct fetch_segment *seg = arg;
+	struct fetch_segdl *dl = seg->dl;
+	char buf[16384];
+	ssize_t rd;
+	size_t len;
+	bool failed = false;
+
+	while (seg->done < seg->length && !failed) {
+		len = MIN(sizeof(buf), (size_t)(seg->length - seg->done));
+		if ((rd = fetchIO_read(seg->fio, buf, len)) <= 0) {
+			seg->rv = EIO;
+			break;
+		}
+		if (pwrite(dl->fd, buf, rd, seg->offset + seg->done) != rd) {
+			seg->rv = errno ? errno : EIO;
+			break;
+		}
+		seg->done += rd;
+
+		pthread_mutex_lock(&dl->mtx);
+		dl->done += rd;
+		xbps_set_cb_fetch(dl->xhp, dl->size, 0, dl->done,
+		    dl->filename, false, true, false);
+		failed = dl->failed;
+		pthread_mutex_unlock(&dl->mtx);
+	}
+	if (seg->rv != 0) {
+		pthread_mutex_lock(&dl->mtx);
+		dl->failed = true;
+		pthread_mutex_unlock(&dl->mtx);
+	}
+
+	return NULL;
+}
+
+/*
+ * Download the file in nsegs ranges, fio is the already opened stream
+ * from the start of the file and is used for the first range.
+ *
+ * Returns 0 on success, -1 on error (errno set) or 1 if the server
+ * does not support ranges; in that case nothing has been read from fio.
+ */
+static int
+fetch_segmented(struct xbps_handle *xhp, struct url *url,
+    struct url_stat *url_st, fetchIO *fio, int fd, const char *filename,
+    const char *flags, unsigned int nsegs)
+{
+	struct fetch_segment segs[XBPS_FETCH_MAXSEGMENTS];
+	struct fetch_segdl dl;
+	struct url_stat st;
+	struct url *u;
+	off_t seglen, prefix;
+	unsigned int i, n;
+	int rv = 0;
+
+	memset(segs, 0, sizeof(segs));
+	seglen = url_st->size / nsegs;
+	for (i = 0; i < nsegs; i++) {
+		segs[i].offset = seglen * i;
+		segs[i].length = (i == nsegs - 1) ?
+		    url_st->size - segs[i].offset : seglen;
+	}
+	segs[0].fio = fio;
+	/*
+	 * Open the other ranges before reading anything, if the server
+	 * ignores ranges or the file changed meanwhile, fall back to a
+	 * single stream.
+	 */
+	for (i = 1; i < nsegs; i++) {
+		if ((u = fetchCopyURL(url)) == NULL) {
+			rv = 1;
+			break;
+		}
+		u->offset = segs[i].offset;
+		u->length = segs[i].length;
+		segs[i].fio = fetchXGet(u, &st, flags);
+		if (segs[i].fio == NULL || u->offset != segs[i].offset ||
+		    (off_t)u->length != segs[i].length || st.size != url_st->size ||
+		    st.mtime != url_st->mtime) {
+			xbps_dbg_printf(xhp, "%s: range %u not available, "
+			    "using a single stream\n", filename, i);
+			fetchFreeURL(u);
+			rv = 1;
+			break;
+		}
+		fetchFreeURL(u);
+	}
+	if (rv == 0) {
+		rv = posix_fallocate(fd, 0, url_st->size);
+		if (rv == EINVAL || rv == EOPNOTSUPP)
+			rv = 0;
+		if (rv != 0) {
+			errno = rv;
+			rv = -1;
+		}
+	}
+	if (rv != 0) {
+		for (i = 1; i < nsegs; i++) {
+			if (segs[i].fio != NULL)
+				fetchIO_close(segs[i].fio);
+		}
+		return rv;
+	}
+	xbps_dbg_printf(xhp, "%s: downloading in %u segments of %jd bytes\n",
+	    filename, nsegs, (intmax_t)seglen);
+
+	memset(&dl, 0, sizeof(dl));
+	pthread_mutex_init(&dl.mtx, NULL);
+	dl.xhp = xhp;
+	dl.filename = filename;
+	dl.size = url_st->size;
+	dl.fd = fd;
+
+	for (n = 0; n < nsegs; n++) {
+		segs[n].dl = &dl;
+		if (pthread_create(&segs[n].thread, NULL,
+		    fetch_segment_thread, &segs[n]) != 0) {
+			pthread_mutex_lock(&dl.mtx);
+			dl.failed = true;
+			pthread_mutex_unlock(&dl.mtx);
+			break;
+		}
+	}
+	for (i = 0; i < n; i++)
+		pthread_join(segs[i].thread, NULL);
+	pthread_mutex_destroy(&dl.mtx);
+
+	for (i = 1; i < nsegs; i++)
+		fetchIO_close(segs[i].fio);
+
+	if (n == nsegs && !dl.failed)
+		return 0;
+	/*
+	 * Keep only the contiguous data from the start of the file,
+	 * so that the transfer can be resumed later.
+	 */
+	for (prefix = 0, i = 0; i < nsegs; i++) {
+		prefix += segs[i].done;
+		if (segs[i].done != segs[i].length)
+			break;
+	}
+	rv = EIO;
+	for (i = 0; i < n; i++) {
+		if (segs[i].rv != 0 && segs[i].rv != EIO) {
+			rv = segs[i].rv;
+			break;
+		}
+	}
+	xbps_dbg_printf(xhp, "%s: segmented download failed, keeping %jd "
+	    "bytes: %s\n", filename, (intmax_t)prefix, strerror(rv));
+	(void)ftruncate(fd, prefix);
+	errno = rv;
+	return -1;
+}
+
+/*
+ * Binary packages are hashed while downloading them, so that the
+ * signature can be verified without reading them again.
+ */
+static bool
+fetch_hashing(const char *filename)
+{
+	size_t len = strlen(filename);
+
+	return len > 5 && strcmp(filename + len - 5, ".xbps") == 0;
+}
+
+static bool
+fetch_hash_prefix(SHA256_CTX *sha256, const char *file, off_t len)
+{
+	char buf[65536];
+	ssize_t rd;
+	int fd;
+
+	if ((fd = open(file, O_RDONLY|O_CLOEXEC)) == -1)
+		return false;
+	while (len > 0) {
+		rd = read(fd, buf, MIN(sizeof(buf), (size_t)len));
+		if (rd <= 0)
+			break;
+		SHA256_Update(sha256, buf, rd);
+		len -= rd;
+	}
+	(void)close(fd);
+
+	return len == 0;
+}
+
+/*
+ * If there are other mirrors to try, a transfer slower than
+ * FETCH_MINRATE bytes per second after FETCH_MINRATE_SECS is aborted.
+ */
+#define FETCH_MINRATE		(16 * 1024)
+#define FETCH_MINRATE_SECS	15
+
+static int
+fetch_file_dest(struct xbps_handle *xhp, const char *uri,
+    const char *filename, const char *flags, bool failover)
 {
 	struct stat st, st_tmpfile, *stp;
 	struct url *url = NULL;
 	struct url_stat url_st;
 	struct fetchIO *fio = NULL;
-	struct timespec ts[2];
+	struct timespec ts[2], tstart, tnow;
+	SHA256_CTX sha256;
+	unsigned char digest[SHA256_DIGEST_LENGTH];
 	off_t bytes_dload = 0;
 	ssize_t bytes_read = 0, bytes_written = 0;
 	char buf[4096], *tempfile = NULL;
 	char fetch_flags[8];
+	unsigned int nsegs;
 	int fd = -1, rv = 0;
-	bool refetch = false, restart = false;
+	bool refetch = false, restart = false, hashing = false;
 
 	assert(xhp);
 	assert(uri);
@@ -115,6 +391,7 @@ xbps_fetch_file_dest(struct xbps_handle *xhp, const char *uri, const char *filen
 		return -1;
 
 	memset(&fetch_flags, 0, sizeof(fetch_flags));
+	memset(&url_st, 0, sizeof(url_st));
 	if (flags != NULL)
 		xbps_strlcpy(fetch_flags, flags, 7);
 
@@ -158,6 +435,26 @@ xbps_fetch_file_dest(struct xbps_handle *xhp, const char *uri, const char *filen
 	 * Issue a GET request.
 	 */
 	fio = fetchXGet(url, &url_st, fetch_flags);
+	if (fio != NULL && restart && url_st.mtime &&
+	    url_st.mtime != st_tmpfile.st_mtime) {
+		/*
+		 * The partial file doesn't match the remote file, i.e
+		 * it was updated or came from an out of sync mirror;
+		 * fetch it again from the start.
+		 */
+		xbps_dbg_printf(xhp, "%s: remote file changed, "
+		    "not resuming transfer\n", tempfile);
+		fetchIO_close(fio);
+		(void)remove(tempfile);
+		restart = false;
+		memset(&st_tmpfile, 0, sizeof(st_tmpfile));
+		if (refetch)
+			stp = &st;
+		url->offset = 0;
+		url->length = 0;
+		memset(&url_st, 0, sizeof(url_st));
+		fio = fetchXGet(url, &url_st, fetch_flags);
+	}
 
 	/* debug stuff */
 	xbps_dbg_printf(xhp, "st.st_size: %zd\n", (ssize_t)stp->st_size);
@@ -219,9 +516,35 @@ xbps_fetch_file_dest(struct xbps_handle *xhp, const char *uri, const char *filen
 	 */
 	xbps_set_cb_fetch(xhp, url_st.size, url->offset, url->offset,
 	    filename, true, false, false);
+	/*
+	 * When resuming, the data already fetched is hashed first.
+	 */
+	if (fetch_hashing(filename) && SHA256_Init(&sha256)) {
+		hashing = true;
+		if (url->offset > 0)
+			hashing = restart &&
+			    fetch_hash_prefix(&sha256, tempfile, url->offset);
+	}
+	/*
+	 * Large files are fetched in several ranges concurrently,
+	 * if enabled and supported by the server.
+	 */
+	if (!restart && (nsegs = fetch_nsegments(xhp, url, &url_st)) > 0) {
+		rv = fetch_segmented(xhp, url, &url_st, fio, fd, filename,
+		    flags ? flags : "", nsegs);
+		if (rv == -1)
+			goto fetch_file_out;
+		else if (rv == 0) {
+			bytes_dload = url_st.size;
+			hashing = false;
+			goto fetch_file_done;
+		}
+		rv = 0;
+	}
 	/*
 	 * Start fetching requested file.
 	 */
+	clock_gettime(CLOCK_MONOTONIC, &tstart);
 	while ((bytes_read = fetchIO_read(fio, buf, sizeof(buf))) > 0) {
 		bytes_written = write(fd, buf, (size_t)bytes_read);
 		if (bytes_written != bytes_read) {
@@ -231,6 +554,8 @@ xbps_fetch_file_dest(struct xbps_handle *xhp, const char *uri, const char *filen
 			goto fetch_file_out;
 		}
 		bytes_dload += bytes_read;
+		if (hashing)
+			SHA256_Update(&sha256, buf, bytes_read);
 		/*
 		 * Let the fetch progress callback know that
 		 * we are sucking more bytes from it.
@@ -238,6 +563,21 @@ xbps_fetch_file_dest(struct xbps_handle *xhp, const char *uri, const char *filen
 		xbps_set_cb_fetch(xhp, url_st.size, url->offset,
 		    url->offset + bytes_dload,
 		    filename, false, true, false);
+		/*
+		 * Give up on slow mirrors, the next one resumes
+		 * the transfer.
+		 */
+		if (failover) {
+			clock_gettime(CLOCK_MONOTONIC, &tnow);
+			if (tnow.tv_sec - tstart.tv_sec >= FETCH_MINRATE_SECS &&
+			    bytes_dload / (tnow.tv_sec - tstart.tv_sec) < FETCH_MINRATE) {
+				xbps_dbg_printf(xhp, "%s: transfer too slow, "
+				    "aborting\n", uri);
+				errno = ETIMEDOUT;
+				rv = -1;
+				goto fetch_file_out;
+			}
+		}
 	}
 	if (bytes_read == -1) {
 		xbps_dbg_printf(xhp, "IO error while fetching %s: %s\n",
@@ -251,7 +591,10 @@ xbps_fetch_file_dest(struct xbps_handle *xhp, const char *uri, const char *filen
 		rv = -1;
 		goto fetch_file_out;
 	}
+	if (hashing)
+		hashing = SHA256_Final(digest, &sha256);
 
+fetch_file_done:
 	/*
 	 * Let the fetch progress callback know that the file
 	 * has been fetched.
@@ -281,13 +624,25 @@ rename_file:
 		rv = -1;
 		goto fetch_file_out;
 	}
+	if (fetch_hashing(filename))
+		xbps_file_hash_save(filename, hashing ? digest : NULL);
 	rv = 1;
 
 fetch_file_out:
 	if (fio != NULL)
 		fetchIO_close(fio);
-	if (fd != -1)
+	if (fd != -1) {
+		/*
+		 * Stamp the partial file with the remote mtime, so that
+		 * it's only resumed from the same file.
+		 */
+		if (rv == -1 && url_st.mtime) {
+			ts[0].tv_sec = ts[1].tv_sec = url_st.mtime;
+			ts[0].tv_nsec = ts[1].tv_nsec = 0;
+			(void)futimens(fd, ts);
+		}
 		(void)close(fd);
+	}
 	if (url != NULL)
 		fetchFreeURL(url);
 
@@ -296,6 +651,55 @@ fetch_file_out:
 	return rv;
 }
 
+int
+xbps_fetch_file_dest(struct xbps_handle *xhp, const char *uri, const char *filename, const char *flags)
+{
+	xbps_array_t mirrors;
+	const char *mirror;
+	char *muri, *tempfile;
+	size_t prefixlen;
+	unsigned int i, cnt;
+	int rv = -1;
+
+	assert(xhp);
+	assert(uri);
+
+	if ((mirrors = xbps_repo_mirrors(xhp, uri, &prefixlen)) == NULL)
+		return fetch_file_dest(xhp, uri, filename, flags, false);
+
+	/*
+	 * Try the repository mirrors in ranking order.
+	 */
+	cnt = xbps_array_count(mirrors);
+	for (i = 0; i < cnt; i++) {
+		xbps_array_get_cstring_nocopy(mirrors, i, &mirror);
+		if (i > 0 && filename != NULL) {
+			/*
+			 * Out of sync mirrors may have different data at
+			 * the same offsets, never resume a transfer that
+			 * failed in another mirror.
+			 */
+			tempfile = xbps_xasprintf("%s.part", filename);
+			(void)remove(tempfile);
+			free(tempfile);
+		}
+		muri = xbps_xasprintf("%s%s", mirror, uri + prefixlen);
+		rv = fetch_file_dest(xhp, muri, filename, flags, i + 1 < cnt);
+		if (rv != -1 || i + 1 == cnt) {
+			free(muri);
+			break;
+		}
+		xbps_dbg_printf(xhp, "[fetch] failed to fetch `%s': %s, "
+		    "trying next mirror\n", muri, xbps_fetch_error_string() ?
+		    xbps_fetch_error_string() : strerror(errno));
+		xbps_repo_mirror_failed(xhp, uri, mirror);
+		free(muri);
+	}
+	xbps_object_release(mirrors);
+
+	return rv;
+}
+
 int
 xbps_fetch_file(struct xbps_handle *xhp, const char *uri, const char *flags)
 {
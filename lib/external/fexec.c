@@ -125,6 +125,12 @@ vfcexec(struct xbps_handle *xhp, const char *arg, va_list ap)
 	return retval;
 }
 
+int HIDDEN
+xbps_file_execv(struct xbps_handle *xhp, const char **argv)
+{
+	return pfcexec(xhp, argv[0], argv);
+}
+
 int HIDDEN
 xbps_file_exec(struct xbps_handle *xhp, const char *arg, ...)
 {
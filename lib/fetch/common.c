@@ -38,6 +38,7 @@
 #include <sys/time.h>
 #include <sys/uio.h>
 
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -54,6 +55,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <strings.h>
+#include <time.h>
 #include <poll.h>
 #include <fcntl.h>
 
@@ -452,7 +454,7 @@ fetch_socks5(conn_t *conn, struct url *url, struct url *socks, int verbose)
 #define UNREACH_IPV6 0x01
 #define UNREACH_IPV4 0x10
 static int
-happy_eyeballs_connect(struct addrinfo *res0, int verbose)
+happy_eyeballs_connect(struct addrinfo *res0, int conntimeout, int verbose)
 {
 	static int unreach = 0;
 	struct pollfd *pfd;
@@ -525,7 +527,7 @@ happy_eyeballs_connect(struct addrinfo *res0, int verbose)
 			/* no more connections to try */
 			if (verbose)
 				fetch_info("attempted to connect to all addresses, waiting...");
-			timeout = fetchConnTimeout;
+			timeout = conntimeout ? conntimeout : fetchConnTimeout;
 			done = 1;
 			goto wait;
 		}
@@ -672,6 +674,7 @@ fetch_connect(struct url *url, int af, int verbose)
 	struct url *socks_url, *connurl;
 	const char *socks_proxy;
 	struct addrinfo hints, *res0;
+	struct timeval tv;
 	int sd, error;
 
 	socks_url = NULL;
@@ -708,11 +711,18 @@ fetch_connect(struct url *url, int af, int verbose)
 	if (verbose)
 		fetch_info("connecting to %s:%d", connurl->host, connurl->port);
 
-	sd = happy_eyeballs_connect(res0, verbose);
+	sd = happy_eyeballs_connect(res0, url->timeout, verbose);
 	freeaddrinfo(res0);
 	if (sd == -1)
 		return (NULL);
 
+	if (url->timeout > 0) {
+		tv.tv_sec = url->timeout / 1000;
+		tv.tv_usec = (url->timeout % 1000) * 1000;
+		(void)setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		(void)setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	}
+
 	if ((conn = fetch_reopen(sd)) == NULL) {
 		fetch_syserr();
 		close(sd);
@@ -728,13 +738,33 @@ fetch_connect(struct url *url, int af, int verbose)
 			}
 		}
 	}
-	conn->cache_url = fetchCopyURL(url);
+	/* connections with their own timeouts are not cached */
+	if (url->timeout == 0)
+		conn->cache_url = fetchCopyURL(url);
 	conn->cache_af = af;
 	return (conn);
 }
 
+/*
+ * Idle connections are kept in a pool per host (scheme, host, port
+ * and credentials), most recently used first. The pools are shared
+ * by all threads; connections are only used by one thread at a time.
+ */
+struct fetch_pool {
+	struct fetch_pool *next;
+	struct url	*url;
+	conn_t		*conns;
+	int		 count;
+	unsigned long	 hits;
+	unsigned long	 misses;
+};
+
 static pthread_mutex_t cache_mtx = PTHREAD_MUTEX_INITIALIZER;
-static conn_t *connection_cache;
+static struct fetch_pool *cache_pools;
+static int cache_count;
+static unsigned long cache_clock;
+static unsigned long cache_hits;
+static unsigned long cache_misses;
 static int cache_global_limit = 0;
 static int cache_per_host_limit = 0;
 
@@ -763,12 +793,86 @@ fetchConnectionCacheInit(int global_limit, int per_host_limit)
 void
 fetchConnectionCacheClose(void)
 {
+	struct fetch_pool *pool;
 	conn_t *conn;
 
-	while ((conn = connection_cache) != NULL) {
-		connection_cache = conn->next_cached;
-		(*conn->cache_close)(conn);
+	pthread_mutex_lock(&cache_mtx);
+	while ((pool = cache_pools) != NULL) {
+		cache_pools = pool->next;
+		while ((conn = pool->conns) != NULL) {
+			pool->conns = conn->next_cached;
+			(*conn->cache_close)(conn);
+		}
+		fetchFreeURL(pool->url);
+		free(pool);
 	}
+	cache_count = 0;
+	pthread_mutex_unlock(&cache_mtx);
+}
+
+/*
+ * Return the number of connections reused from the cache (hits)
+ * and the number of new connections (misses).
+ */
+void
+fetchConnectionCacheStats(unsigned long *hits, unsigned long *misses)
+{
+	pthread_mutex_lock(&cache_mtx);
+	if (hits)
+		*hits = cache_hits;
+	if (misses)
+		*misses = cache_misses;
+	pthread_mutex_unlock(&cache_mtx);
+}
+
+static struct fetch_pool *
+cache_pool(const struct url *url, int create)
+{
+	struct fetch_pool *pool;
+
+	for (pool = cache_pools; pool; pool = pool->next) {
+		if (pool->url->port == url->port &&
+		    strcmp(pool->url->scheme, url->scheme) == 0 &&
+		    strcmp(pool->url->host, url->host) == 0 &&
+		    strcmp(pool->url->user, url->user) == 0 &&
+		    strcmp(pool->url->pwd, url->pwd) == 0)
+			return pool;
+	}
+	if (!create)
+		return NULL;
+
+	if ((pool = calloc(1, sizeof(*pool))) == NULL)
+		return NULL;
+	if ((pool->url = fetchCopyURL(url)) == NULL) {
+		free(pool);
+		return NULL;
+	}
+	pool->next = cache_pools;
+	cache_pools = pool;
+	return pool;
+}
+
+/*
+ * Unlink the least recently used connection of a pool.
+ */
+static conn_t *
+cache_pool_evict(struct fetch_pool *pool)
+{
+	conn_t *conn, *last = NULL;
+
+	if ((conn = pool->conns) == NULL)
+		return NULL;
+	while (conn->next_cached != NULL) {
+		last = conn;
+		conn = conn->next_cached;
+	}
+	if (last != NULL)
+		last->next_cached = NULL;
+	else
+		pool->conns = NULL;
+	pool->count--;
+	cache_count--;
+	return conn;
 }
 
 /*
@@ -778,29 +882,36 @@ fetchConnectionCacheClose(void)
 conn_t *
 fetch_cache_get(const struct url *url, int af)
 {
-	conn_t *conn, *last_conn = NULL;
+	struct fetch_pool *pool;
+	conn_t *conn = NULL, *last_conn = NULL;
 
 	pthread_mutex_lock(&cache_mtx);
-	for (conn = connection_cache; conn; conn = conn->next_cached) {
-		if (conn->cache_url->port == url->port &&
-		    strcmp(conn->cache_url->scheme, url->scheme) == 0 &&
-		    strcmp(conn->cache_url->host, url->host) == 0 &&
-		    strcmp(conn->cache_url->user, url->user) == 0 &&
-		    strcmp(conn->cache_url->pwd, url->pwd) == 0 &&
-		    (conn->cache_af == AF_UNSPEC || af == AF_UNSPEC ||
-		     conn->cache_af == af)) {
-			if (last_conn != NULL)
-				last_conn->next_cached = conn->next_cached;
-			else
-				connection_cache = conn->next_cached;
-
-			pthread_mutex_unlock(&cache_mtx);
-			return conn;
+	if ((pool = cache_pool(url, 1)) != NULL) {
+		for (conn = pool->conns; conn; conn = conn->next_cached) {
+			if (conn->cache_af == AF_UNSPEC || af == AF_UNSPEC ||
+			    conn->cache_af == af) {
+				if (last_conn != NULL)
+					last_conn->next_cached = conn->next_cached;
+				else
+					pool->conns = conn->next_cached;
+				pool->count--;
+				cache_count--;
+				break;
+			}
+			last_conn = conn;
 		}
 	}
+	if (conn != NULL) {
+		cache_hits++;
+		pool->hits++;
+	} else {
+		cache_misses++;
+		if (pool != NULL)
+			pool->misses++;
+	}
 	pthread_mutex_unlock(&cache_mtx);
 
-	return NULL;
+	return conn;
 }
 
 /*
@@ -811,8 +922,8 @@ fetch_cache_get(const struct url *url, int af)
 void
 fetch_cache_put(conn_t *conn, int (*closecb)(conn_t *))
 {
-	conn_t *iter, *last;
-	int global_count, host_count;
+	struct fetch_pool *pool, *iter, *oldest;
+	conn_t *evicted = NULL, *c;
 
 	if (conn->cache_url == NULL || cache_global_limit == 0) {
 		(*closecb)(conn);
@@ -820,28 +931,48 @@ fetch_cache_put(conn_t *conn, int (*closecb)(conn_t *))
 	}
 
 	pthread_mutex_lock(&cache_mtx);
-	global_count = host_count = 0;
-	last = NULL;
-	for (iter = connection_cache; iter;
-	    last = iter, iter = iter->next_cached) {
-		++global_count;
-		if (strcmp(conn->cache_url->host, iter->cache_url->host) == 0)
-			++host_count;
-		if (global_count < cache_global_limit &&
-		    host_count < cache_per_host_limit)
-			continue;
-		--global_count;
-		if (last != NULL)
-			last->next_cached = iter->next_cached;
-		else
-			connection_cache = iter->next_cached;
-		(*iter->cache_close)(iter);
+	if ((pool = cache_pool(conn->cache_url, 1)) == NULL) {
+		pthread_mutex_unlock(&cache_mtx);
+		(*closecb)(conn);
+		return;
+	}
+	/* make room in this host pool, and then in the whole cache */
+	if (pool->count >= cache_per_host_limit &&
+	    (c = cache_pool_evict(pool)) != NULL) {
+		c->next_cached = evicted;
+		evicted = c;
+	}
+	while (cache_count >= cache_global_limit) {
+		unsigned long stamp = 0;
+
+		oldest = NULL;
+		for (iter = cache_pools; iter; iter = iter->next) {
+			/* the tail is the least recently used */
+			for (c = iter->conns; c && c->next_cached; c = c->next_cached)
+				;
+			if (c && (oldest == NULL || c->cache_stamp < stamp)) {
+				oldest = iter;
+				stamp = c->cache_stamp;
+			}
+		}
+		if (oldest == NULL || (c = cache_pool_evict(oldest)) == NULL)
+			break;
+		c->next_cached = evicted;
+		evicted = c;
 	}
-
 	conn->cache_close = closecb;
-	conn->next_cached = connection_cache;
-	connection_cache = conn;
+	conn->cache_stamp = ++cache_clock;
+	conn->next_cached = pool->conns;
+	pool->conns = conn;
+	pool->count++;
+	cache_count++;
 	pthread_mutex_unlock(&cache_mtx);
+
+	/* close evicted connections without holding the lock */
+	while ((c = evicted) != NULL) {
+		evicted = c->next_cached;
+		(*c->cache_close)(c);
+	}
 }
 
 
@@ -1212,7 +1343,7 @@ fetch_ssl_setup_transport_layer(SSL_CTX *ctx, int verbose)
 {
 	long ssl_ctx_options;
 
-	ssl_ctx_options = SSL_OP_ALL | SSL_OP_NO_SSLv2 | SSL_OP_NO_TICKET;
+	ssl_ctx_options = SSL_OP_ALL | SSL_OP_NO_SSLv2;
 	if (getenv("SSL_ALLOW_SSL3") == NULL)
 		ssl_ctx_options |= SSL_OP_NO_SSLv3;
 	if (getenv("SSL_NO_TLS1") != NULL)
@@ -1345,7 +1476,269 @@ ssl_init(void)
 	SSL_load_error_strings();
 	SSL_library_init();
 }
+
+/*
+ * Client side TLS session cache: the last session negotiated with
+ * every host:port is kept in memory, so that new connections to the
+ * same server can resume it instead of doing a full handshake.
+ * If a directory has been set with fetchSessionCacheInit(), sessions
+ * are also stored there to be resumed by later processes.
+ */
+struct fetch_session {
+	struct fetch_session *next;
+	char		*key;
+	SSL_SESSION	*sess;
+};
+
+static pthread_mutex_t session_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct fetch_session *session_cache;
+static char *session_dir;
+
+static char *
+session_path(const char *key)
+{
+	char *path, *p;
+	size_t len;
+
+	len = strlen(session_dir) + strlen(key) + 2;
+	if ((path = malloc(len)) == NULL)
+		return NULL;
+	snprintf(path, len, "%s/%s", session_dir, key);
+	for (p = path + strlen(session_dir) + 1; *p; p++) {
+		if (*p == '/')
+			*p = '_';
+	}
+	return path;
+}
+
+static int
+session_expired(SSL_SESSION *sess)
+{
+	return SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess) <
+	    (long)time(NULL);
+}
+
+/*
+ * Sessions are only loaded from and stored in files and directories
+ * owned by the effective user and not writable by others: resuming a
+ * session skips the certificate checks, so whoever planted it could
+ * impersonate the server.
+ */
+static int
+session_trusted(int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) == -1)
+		return 0;
+	return st.st_uid == geteuid() &&
+	    (st.st_mode & (S_IWGRP|S_IWOTH)) == 0;
+}
+
+static int
+session_dir_trusted(void)
+{
+	int fd, rv;
+
+	if ((fd = open(session_dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) == -1)
+		return 0;
+	rv = session_trusted(fd);
+	close(fd);
+	return rv;
+}
+
+static SSL_SESSION *
+session_load(const char *key)
+{
+	SSL_SESSION *sess = NULL;
+	const unsigned char *p;
+	unsigned char buf[8192];
+	char *path;
+	ssize_t len;
+	int fd;
+
+	if (!session_dir_trusted())
+		return NULL;
+	if ((path = session_path(key)) == NULL)
+		return NULL;
+	if ((fd = open(path, O_RDONLY|O_CLOEXEC|O_NOFOLLOW)) == -1) {
+		free(path);
+		return NULL;
+	}
+	if (!session_trusted(fd)) {
+		close(fd);
+		free(path);
+		return NULL;
+	}
+	len = read(fd, buf, sizeof(buf));
+	close(fd);
+	if (len > 0 && (size_t)len < sizeof(buf)) {
+		p = buf;
+		sess = d2i_SSL_SESSION(NULL, &p, len);
+	}
+	if (sess == NULL || session_expired(sess)) {
+		if (sess != NULL)
+			SSL_SESSION_free(sess);
+		sess = NULL;
+		(void)unlink(path);
+	}
+	free(path);
+	return sess;
+}
+
+static void
+session_store(const char *key, SSL_SESSION *sess)
+{
+	unsigned char *buf = NULL;
+	char *path, *tmp;
+	size_t len;
+	int fd, n;
+
+	if ((n = i2d_SSL_SESSION(sess, &buf)) <= 0)
+		return;
+	if ((path = session_path(key)) == NULL) {
+		OPENSSL_free(buf);
+		return;
+	}
+	len = strlen(path) + 5;
+	if ((tmp = malloc(len)) == NULL)
+		goto out;
+	snprintf(tmp, len, "%s.tmp", path);
+	(void)mkdir(session_dir, 0700);
+	if (!session_dir_trusted())
+		goto out;
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+	if (fd == -1)
+		goto out;
+	if (write(fd, buf, n) != n || close(fd) == -1 ||
+	    rename(tmp, path) == -1)
+		(void)unlink(tmp);
+out:
+	OPENSSL_free(buf);
+	free(path);
+	free(tmp);
+}
+
+/*
+ * Return a new reference to the cached session for key, or NULL.
+ */
+static SSL_SESSION *
+session_get(const char *key)
+{
+	struct fetch_session *s;
+	SSL_SESSION *sess;
+
+	pthread_mutex_lock(&session_mtx);
+	for (s = session_cache; s; s = s->next) {
+		if (strcmp(s->key, key) == 0)
+			break;
+	}
+	if (s == NULL && session_dir != NULL &&
+	    (sess = session_load(key)) != NULL) {
+		if ((s = calloc(1, sizeof(*s))) == NULL ||
+		    (s->key = strdup(key)) == NULL) {
+			free(s);
+			SSL_SESSION_free(sess);
+			pthread_mutex_unlock(&session_mtx);
+			return NULL;
+		}
+		s->sess = sess;
+		s->next = session_cache;
+		session_cache = s;
+	}
+	if (s != NULL && session_expired(s->sess))
+		s = NULL;
+	sess = NULL;
+	if (s != NULL && SSL_SESSION_up_ref(s->sess))
+		sess = s->sess;
+	pthread_mutex_unlock(&session_mtx);
+	return sess;
+}
+
+/*
+ * Replace the cached session for key; sess may be NULL to drop it.
+ */
+static void
+session_put(const char *key, SSL_SESSION *sess)
+{
+	struct fetch_session *s, **sp;
+	char *path;
+
+	pthread_mutex_lock(&session_mtx);
+	for (sp = &session_cache; (s = *sp) != NULL; sp = &s->next) {
+		if (strcmp(s->key, key) == 0)
+			break;
+	}
+	if (sess == NULL) {
+		if (s != NULL) {
+			*sp = s->next;
+			SSL_SESSION_free(s->sess);
+			free(s->key);
+			free(s);
+		}
+		if (session_dir != NULL &&
+		    (path = session_path(key)) != NULL) {
+			(void)unlink(path);
+			free(path);
+		}
+		pthread_mutex_unlock(&session_mtx);
+		return;
+	}
+	if (s != NULL) {
+		SSL_SESSION_free(s->sess);
+	} else {
+		if ((s = calloc(1, sizeof(*s))) == NULL ||
+		    (s->key = strdup(key)) == NULL) {
+			free(s);
+			SSL_SESSION_free(sess);
+			pthread_mutex_unlock(&session_mtx);
+			return;
+		}
+		s->next = session_cache;
+		session_cache = s;
+	}
+	s->sess = sess;
+	if (session_dir != NULL)
+		session_store(key, sess);
+	pthread_mutex_unlock(&session_mtx);
+}
+
+/*
+ * Called by OpenSSL when the server hands out a new session; with
+ * TLS 1.3 this happens after the handshake, on the first read.
+ */
+static int
+session_new_cb(SSL *ssl, SSL_SESSION *sess)
+{
+	conn_t *conn = SSL_get_app_data(ssl);
+
+	if (conn == NULL || conn->ssl_key == NULL)
+		return 0;
+	session_put(conn->ssl_key, sess);
+	return 1;
+}
+#endif
+
+/*
+ * Enable the TLS session cache on disk, sessions are stored in dir.
+ * The in-memory session cache is always used.
+ */
+void
+fetchSessionCacheInit(const char *dir)
+{
+#ifdef WITH_SSL
+	char *d = NULL;
+
+	if (dir != NULL && (d = strdup(dir)) == NULL)
+		return;
+	pthread_mutex_lock(&session_mtx);
+	free(session_dir);
+	session_dir = d;
+	pthread_mutex_unlock(&session_mtx);
+#else
+	(void)dir;
 #endif
+}
 
 
 /*
@@ -1356,9 +1749,11 @@ fetch_ssl(conn_t *conn, const struct url *URL, int verbose)
 {
 
 #ifdef WITH_SSL
-	int ret;
+	SSL_SESSION *sess;
 	X509_NAME *name;
 	char *str;
+	size_t len;
+	int ret;
 
 	(void)pthread_once(&ssl_init_once, ssl_init);
 
@@ -1369,6 +1764,9 @@ fetch_ssl(conn_t *conn, const struct url *URL, int verbose)
 		return -1;
 	}
 	SSL_CTX_set_mode(conn->ssl_ctx, SSL_MODE_AUTO_RETRY);
+	SSL_CTX_set_session_cache_mode(conn->ssl_ctx,
+	    SSL_SESS_CACHE_CLIENT|SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(conn->ssl_ctx, session_new_cb);
 
 	fetch_ssl_setup_transport_layer(conn->ssl_ctx, verbose);
 	if (!fetch_ssl_setup_peer_verification(conn->ssl_ctx, verbose))
@@ -1394,8 +1792,22 @@ fetch_ssl(conn_t *conn, const struct url *URL, int verbose)
 		return (-1);
 	}
 #endif
+	len = strlen(URL->host) + 8;
+	if ((conn->ssl_key = malloc(len)) == NULL) {
+		fetch_syserr();
+		return (-1);
+	}
+	snprintf(conn->ssl_key, len, "%s:%d", URL->host,
+	    URL->port ? URL->port : fetch_default_port(URL->scheme));
+	SSL_set_app_data(conn->ssl, conn);
+	if ((sess = session_get(conn->ssl_key)) != NULL) {
+		SSL_set_session(conn->ssl, sess);
+		SSL_SESSION_free(sess);
+	}
 	if ((ret = SSL_connect(conn->ssl)) <= 0){
 		fprintf(stderr, "SSL_connect returned %d\n", SSL_get_error(conn->ssl, ret));
+		if (sess != NULL)
+			session_put(conn->ssl_key, NULL);
 		return (-1);
 	}
 
@@ -1413,13 +1825,16 @@ fetch_ssl(conn_t *conn, const struct url *URL, int verbose)
 			fprintf(stderr,
 				"SSL certificate subject doesn't match host %s\n",
 				URL->host);
+			session_put(conn->ssl_key, NULL);
 			return (-1);
 		}
 	}
 
 	if (verbose) {
-		fetch_info("%s connection established using %s",
-		    SSL_get_version(conn->ssl), SSL_get_cipher(conn->ssl));
+		fetch_info("%s connection %s using %s",
+		    SSL_get_version(conn->ssl),
+		    SSL_session_reused(conn->ssl) ? "resumed" : "established",
+		    SSL_get_cipher(conn->ssl));
 		conn->ssl_cert = SSL_get_peer_certificate(conn->ssl);
 		name = X509_get_subject_name(conn->ssl_cert);
 		str = X509_NAME_oneline(name, 0, 0);
@@ -1687,6 +2102,7 @@ fetch_close(conn_t *conn)
 		X509_free(conn->ssl_cert);
 		conn->ssl_cert = NULL;
 	}
+	free(conn->ssl_key);
 #endif
 	ret = close(conn->sd);
 	if (conn->cache_url)
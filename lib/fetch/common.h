@@ -98,6 +98,7 @@ struct fetchconn {
 	SSL		*ssl;		/* SSL handle */
 	SSL_CTX		*ssl_ctx;	/* SSL context */
 	X509		*ssl_cert;	/* server certificate */
+	char		*ssl_key;	/* session cache key (host:port) */
 #endif
 
 	char		*ftp_home;
@@ -105,6 +106,7 @@ struct fetchconn {
 	struct url	*cache_url;
 	int		cache_af;
 	int		(*cache_close)(conn_t *);
+	unsigned long	cache_stamp;	/* last time put in the cache */
 	conn_t		*next_cached;
 };
 
@@ -53,6 +53,7 @@ struct url {
 	off_t		 offset;
 	size_t		 length;
 	time_t		 last_modified;
+	int		 timeout;
 };
 
 struct url_stat {
@@ -160,6 +161,10 @@ char		*fetchUnquoteFilename(struct url *);
 /* Connection caching */
 void		 fetchConnectionCacheInit(int, int);
 void		 fetchConnectionCacheClose(void);
+void		 fetchConnectionCacheStats(unsigned long *, unsigned long *);
+
+/* TLS session caching */
+void		 fetchSessionCacheInit(const char *);
 
 /* Authentication */
 typedef int (*auth_t)(struct url *);
@@ -176,6 +181,12 @@ extern int		 fetchTimeout;
 /* Connect timeout */
 extern int		 fetchConnTimeout;
 
+/*
+ * If the timeout member of a struct url is set, it is used (in ms) as
+ * the connect timeout and the timeout of every socket read and write,
+ * instead of the ones above. These connections are not cached.
+ */
+
 /* Connect attempt delay  */
 extern int		 fetchConnDelay;
 
@@ -1048,7 +1048,8 @@ ftp_connect(struct url *url, struct url *purl, const char *flags)
 		if (!url->port)
 			url->port = fetch_default_port(url->scheme);
 
-		while ((conn = fetch_cache_get(url, af)) != NULL) {
+		while (url->timeout == 0 &&
+		    (conn = fetch_cache_get(url, af)) != NULL) {
 			e = ftp_cmd(conn, "NOOP\r\n");
 			if (e == FTP_OK)
 				return conn;
@@ -306,7 +306,9 @@ http_closefn(void *v)
 {
 	struct httpio *io = (struct httpio *)v;
 
-	if (io->keep_alive) {
+	/* only reuse the connection if the response was fully read */
+	if (io->keep_alive && !io->error &&
+	    (io->chunked ? io->eof : io->contentlength == 0)) {
 		int val;
 
 		val = 0;
@@ -742,9 +744,11 @@ http_connect(struct url *URL, struct url *purl, const char *flags, int *cached)
 		af = AF_INET6;
 #endif
 
+	if (purl != NULL)
+		purl->timeout = URL->timeout;
 	curl = (purl != NULL) ? purl : URL;
 
-	if ((conn = fetch_cache_get(curl, af)) != NULL) {
+	if (curl->timeout == 0 && (conn = fetch_cache_get(curl, af)) != NULL) {
 		*cached = 1;
 		return (conn);
 	}
@@ -859,7 +863,7 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 	int chunked, direct, if_modified_since, need_auth, noredirect;
 	int keep_alive, verbose, cached;
 	int e, i, n, val;
-	off_t offset, clength, length, size;
+	off_t offset, clength, length, size, rlength;
 	time_t mtime;
 	const char *p;
 	fetchIO *f;
@@ -871,6 +875,7 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 	verbose = CHECK_FLAG('v');
 	if_modified_since = CHECK_FLAG('i');
 	keep_alive = 0;
+	rlength = URL->length;
 
 	if (direct && purl) {
 		fetchFreeURL(purl);
@@ -989,7 +994,11 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 		 */
 		http_cmd(conn, "Accept: */*\r\n");
 
-		if (url->offset > 0)
+		if (url->length > 0)
+			http_cmd(conn, "Range: bytes=%lld-%lld\r\n",
+			    (long long)url->offset,
+			    (long long)(url->offset + url->length - 1));
+		else if (url->offset > 0)
 			http_cmd(conn, "Range: bytes=%lld-\r\n", (long long)url->offset);
 
 		http_cmd(conn, "\r\n");
@@ -1069,6 +1078,9 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 			/* fall through so we can get the full error message */
 		}
 
+		/* HTTP/1.1 connections are persistent unless told otherwise */
+		keep_alive = (strncmp(conn->buf, "HTTP/1.1", 8) == 0);
+
 		/* get headers */
 		do {
 			switch ((h = http_next_header(conn, &p))) {
@@ -1080,7 +1092,10 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 				goto ouch;
 			case hdr_connection:
 				/* XXX too weak? */
-				keep_alive = (strcasecmp(p, "keep-alive") == 0);
+				if (strcasecmp(p, "keep-alive") == 0)
+					keep_alive = 1;
+				else if (strcasecmp(p, "close") == 0)
+					keep_alive = 0;
 				break;
 			case hdr_content_length:
 				http_parse_length(p, &clength);
@@ -1114,6 +1129,7 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 				}
 				new->offset = url->offset;
 				new->length = url->length;
+				new->timeout = url->timeout;
 				break;
 			case hdr_transfer_encoding:
 				/* XXX weak test*/
@@ -1194,7 +1210,9 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 	if (clength != -1)
 		length = offset + clength;
 
-	if (length != -1 && size != -1 && length != size) {
+	/* a bounded range may end before the end of the document */
+	if (length != -1 && size != -1 &&
+	    (length > size || (length != size && rlength == 0))) {
 		http_seterr(HTTP_PROTOCOL_ERROR);
 		goto ouch;
 	}
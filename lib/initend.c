@@ -161,6 +161,12 @@ xbps_init(struct xbps_handle *xhp)
 			return 1;
 	}
 
+	xbps_fetch_set_session_cache(xhp);
+	xbps_repo_mirrors_init(xhp);
+	xbps_file_hash_cache_init(xhp);
+	if (xhp->fetch_threshold == 0)
+		xhp->fetch_threshold = XBPS_FETCH_THRESHOLD;
+
 	xbps_dbg_printf(xhp, "rootdir=%s\n", xhp->rootdir);
 	xbps_dbg_printf(xhp, "metadir=%s\n", xhp->metadir);
 	xbps_dbg_printf(xhp, "cachedir=%s\n", xhp->cachedir);
@@ -186,5 +192,15 @@ xbps_end(struct xbps_handle *xhp)
 {
 	assert(xhp);
 
+	xbps_fetch_cache_stats(xhp);
+	xbps_file_hash_cache_end(xhp);
+	if (xhp->triggers) {
+		xbps_object_release(xhp->triggers);
+		xhp->triggers = NULL;
+	}
+	if (xhp->mirrors) {
+		xbps_object_release(xhp->mirrors);
+		xhp->mirrors = NULL;
+	}
 	xbps_pkgdb_release(xhp);
 }
@@ -70,6 +70,8 @@ xbps_entry_install_conf_file(struct xbps_handle *xhp,
 	xbps_object_iterator_t iter, iter2;
 	const char *version = NULL, *cffile, *sha256_new = NULL;
 	char buf[PATH_MAX], *sha256_cur = NULL, *sha256_orig = NULL;
+	char *sha256_curnew = NULL;
+	const char *algo_orig, *algo_new;
 	int rv = 0;
 
 	assert(xbps_object_type(binpkg_filesd) == XBPS_TYPE_DICTIONARY);
@@ -139,9 +141,20 @@ xbps_entry_install_conf_file(struct xbps_handle *xhp,
 		if (strcmp(entry_pname, buf)) {
 			continue;
 		}
-		sha256_cur = xbps_file_hash(buf);
 		xbps_dictionary_get_cstring_nocopy(obj, "sha256", &sha256_new);
-		if (sha256_cur == NULL) {
+		/*
+		 * The installed file is hashed with the algorithm of the
+		 * original and new hashes; if they differ, the original
+		 * and new hashes never match.
+		 */
+		algo_orig = xbps_digest_algo(sha256_orig);
+		algo_new = xbps_digest_algo(sha256_new);
+		sha256_cur = xbps_file_digest(buf, algo_orig);
+		if (sha256_cur && algo_orig != algo_new)
+			sha256_curnew = xbps_file_digest(buf, algo_new);
+		else if (sha256_cur)
+			sha256_curnew = strdup(sha256_cur);
+		if (sha256_cur == NULL || sha256_curnew == NULL) {
 			if (errno == ENOENT) {
 				/*
 				 * File not installed, install new one.
@@ -162,7 +175,7 @@ xbps_entry_install_conf_file(struct xbps_handle *xhp,
 		 */
 		if ((strcmp(sha256_orig, sha256_cur) == 0) &&
 		    (strcmp(sha256_orig, sha256_new) == 0) &&
-		    (strcmp(sha256_cur, sha256_new) == 0)) {
+		    (strcmp(sha256_curnew, sha256_new) == 0)) {
 			xbps_dbg_printf(xhp, "%s: conf_file %s orig = X, "
 			    "cur = X, new = X\n", pkgver, entry_pname);
 			rv = 0;
@@ -174,7 +187,7 @@ xbps_entry_install_conf_file(struct xbps_handle *xhp,
 		 */
 		} else if ((strcmp(sha256_orig, sha256_cur) == 0) &&
 			   (strcmp(sha256_orig, sha256_new)) &&
-			   (strcmp(sha256_cur, sha256_new))) {
+			   (strcmp(sha256_curnew, sha256_new))) {
 			xbps_set_cb_state(xhp, XBPS_STATE_CONFIG_FILE,
 			    0, pkgver,
 			    "Updating configuration file `%s' provided "
@@ -189,7 +202,7 @@ xbps_entry_install_conf_file(struct xbps_handle *xhp,
 		 * to the original version.
 		 */
 		} else if ((strcmp(sha256_orig, sha256_new) == 0) &&
-			   (strcmp(sha256_cur, sha256_new)) &&
+			   (strcmp(sha256_curnew, sha256_new)) &&
 			   (strcmp(sha256_orig, sha256_cur))) {
 			xbps_set_cb_state(xhp, XBPS_STATE_CONFIG_FILE,
 			    0, pkgver,
@@ -203,7 +216,7 @@ xbps_entry_install_conf_file(struct xbps_handle *xhp,
 		 * Keep file as is because changes made are compatible
 		 * with new version.
 		 */
-		} else if ((strcmp(sha256_cur, sha256_new) == 0) &&
+		} else if ((strcmp(sha256_curnew, sha256_new) == 0) &&
 			   (strcmp(sha256_orig, sha256_new)) &&
 			   (strcmp(sha256_orig, sha256_cur))) {
 			xbps_dbg_printf(xhp, "%s: conf_file %s orig = X, "
@@ -216,7 +229,7 @@ xbps_entry_install_conf_file(struct xbps_handle *xhp,
 		 * Install new file as <file>.new-<version>
 		 */
 		} else  if ((strcmp(sha256_orig, sha256_cur)) &&
-			    (strcmp(sha256_cur, sha256_new)) &&
+			    (strcmp(sha256_curnew, sha256_new)) &&
 			    (strcmp(sha256_orig, sha256_new))) {
 			version = xbps_pkg_version(pkgver);
 			assert(version);
@@ -228,7 +241,8 @@ xbps_entry_install_conf_file(struct xbps_handle *xhp,
 			break;
 		}
 		free(sha256_cur);
-		sha256_cur = NULL;
+		free(sha256_curnew);
+		sha256_cur = sha256_curnew = NULL;
 	}
 
 out:
@@ -236,6 +250,8 @@ out:
 		free(sha256_orig);
 	if (sha256_cur)
 		free(sha256_cur);
+	if (sha256_curnew)
+		free(sha256_curnew);
 
 	xbps_object_iterator_release(iter);
 
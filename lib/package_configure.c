@@ -39,6 +39,7 @@
  *  - Its <b>post-install</b> target in the INSTALL script will be executed.
  *  - Its state will be changed to XBPS_PKG_STATE_INSTALLED if previous step
  *    ran successful.
+ *  - Its triggers are collected, to be executed once by xbps_triggers_run().
  *
  * @note
  * If the \a XBPS_FLAG_FORCE_CONFIGURE is set through xbps_init() in the flags
@@ -80,6 +81,11 @@ xbps_configure_packages(struct xbps_handle *xhp, xbps_array_t ignpkgs)
 	}
 	xbps_object_iterator_release(iter);
 
+	if (rv == 0)
+		rv = xbps_triggers_run(xhp);
+	else
+		(void)xbps_triggers_run(xhp);
+
 	return rv;
 }
 
@@ -133,6 +139,29 @@ xbps_configure_pkg(struct xbps_handle *xhp,
 
 	myumask = umask(022);
 
+	if ((rv = xbps_configure_pkg_script(xhp, pkgd, update)) == 0)
+		rv = xbps_configure_pkg_done(xhp, pkgd);
+
+	umask(myumask);
+	if (rv != 0)
+		return rv;
+
+	/* show install-msg if exists */
+	return xbps_cb_message(xhp, pkgd, "install-msg");
+}
+
+/*
+ * Runs the INSTALL "post" action of a package, without touching
+ * the pkgdb; this can be called concurrently for multiple packages.
+ */
+int HIDDEN
+xbps_configure_pkg_script(struct xbps_handle *xhp, xbps_dictionary_t pkgd,
+		bool update)
+{
+	const char *pkgver = NULL;
+	int rv;
+
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
 	xbps_set_cb_state(xhp, XBPS_STATE_CONFIGURE, 0, pkgver, NULL);
 
 	rv = xbps_pkg_exec_script(xhp, pkgd, "install-script", "post", update);
@@ -141,21 +170,31 @@ xbps_configure_pkg(struct xbps_handle *xhp,
 		    errno, pkgver,
 		    "%s: [configure] INSTALL script failed to execute "
 		    "the post ACTION: %s", pkgver, strerror(rv));
-		umask(myumask);
-		return rv;
 	}
+	return rv;
+}
+
+/*
+ * Marks a package as installed once its INSTALL "post" action
+ * has been executed.
+ */
+int HIDDEN
+xbps_configure_pkg_done(struct xbps_handle *xhp, xbps_dictionary_t pkgd)
+{
+	const char *pkgver = NULL;
+	int rv;
+
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+
 	rv = xbps_set_pkg_state_dictionary(pkgd, XBPS_PKG_STATE_INSTALLED);
 	if (rv != 0) {
 		xbps_set_cb_state(xhp, XBPS_STATE_CONFIGURE_FAIL, rv,
 		    pkgver, "%s: [configure] failed to set state to installed: %s",
 		    pkgver, strerror(rv));
-		umask(myumask);
 		return rv;
 	}
-	if (rv == 0)
-		xbps_set_cb_state(xhp, XBPS_STATE_CONFIGURE_DONE, 0, pkgver, NULL);
+	xbps_set_cb_state(xhp, XBPS_STATE_CONFIGURE_DONE, 0, pkgver, NULL);
+	xbps_triggers_add(xhp, pkgd);
 
-	umask(myumask);
-	/* show install-msg if exists */
-	return xbps_cb_message(xhp, pkgd, "install-msg");
+	return 0;
 }
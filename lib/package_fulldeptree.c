@@ -31,208 +31,104 @@
 
 #include "xbps_api_impl.h"
 
-struct item;
-
-struct depn {
-	struct depn *dnext;
-	struct item *item;
-};
-
-struct item {
-	struct item *hnext;
-	struct item *bnext;
-	struct depn *dbase;
-	char *pkgn;
-	const char *pkgver;
-	xbps_array_t rdeps;
+struct fulldeptree {
+	unsigned int root;
+	unsigned int *ids;
+	unsigned int nids;
 };
 
-#define ITHSIZE	1024
-#define ITHMASK	(ITHSIZE - 1)
-
-static struct item *ItemHash[ITHSIZE];
-static xbps_array_t result;
-
 static int
-itemhash(const char *pkgn)
-{
-	int hv = 0xA1B5F342;
-	int i;
-
-	assert(pkgn);
-
-	for (i = 0; pkgn[i]; ++i)
-		hv = (hv << 5) ^ (hv >> 23) ^ pkgn[i];
-
-	return hv & ITHMASK;
-}
-
-static struct item *
-lookupItem(const char *pkgn)
+collect_cb(struct xbps_depgraph *g UNUSED, const unsigned int *ids,
+		unsigned int n, void *arg)
 {
-	struct item *item;
+	struct fulldeptree *fdt = arg;
 
-	assert(pkgn);
-
-	for (item = ItemHash[itemhash(pkgn)]; item; item = item->hnext) {
-		if (strcmp(pkgn, item->pkgn) == 0)
-			return item;
+	for (unsigned int i = 0; i < n; i++) {
+		if (ids[i] != fdt->root)
+			fdt->ids[fdt->nids++] = ids[i];
 	}
-	return NULL;
-}
-
-static struct item *
-addItem(xbps_array_t rdeps, const char *pkgn)
-{
-	struct item **itemp;
-	struct item *item = calloc(sizeof(*item), 1);
-
-	assert(pkgn);
-	assert(item);
-
-	itemp = &ItemHash[itemhash(pkgn)];
-	item->hnext = *itemp;
-	item->pkgn = strdup(pkgn);
-	assert(item->pkgn);
-	item->rdeps = xbps_array_copy(rdeps);
-	*itemp = item;
-
-	return item;
-}
-
-static void
-addDepn(struct item *item, struct item *xitem)
-{
-	struct depn *depn = calloc(sizeof(*depn), 1);
-
-	assert(item);
-	assert(xitem);
-
-	depn->item = item;
-	depn->dnext = xitem->dbase;
-	xitem->dbase = depn;
-}
-
-static void
-add_deps_recursive(struct item *item, bool first)
-{
-	struct depn *dep;
-	xbps_string_t str;
-
-	if (xbps_match_string_in_array(result, item->pkgver))
-		return;
-
-	for (dep = item->dbase; dep; dep = dep->dnext)
-		add_deps_recursive(dep->item, false);
-
-	if (first)
-		return;
-
-	str = xbps_string_create_cstring(item->pkgver);
-	assert(str);
-	xbps_array_add_first(result, str);
-	xbps_object_release(str);
+	return 0;
 }
 
 /*
- * Recursively calculate all dependencies.
+ * Add all dependencies of the root package into the graph,
+ * packages are visited in the same order they are added.
  */
-static struct item *
-ordered_depends(struct xbps_handle *xhp, xbps_dictionary_t pkgd, bool rpool,
-		size_t depth)
+static int
+build_graph(struct xbps_handle *xhp, struct xbps_depgraph *g, bool rpool)
 {
-	xbps_array_t rdeps, provides;
-	xbps_string_t str;
-	struct item *item, *xitem;
-	const char *pkgver = NULL;
-	char *pkgn;
-
-	assert(xhp);
-	assert(pkgd);
-
-	rdeps = xbps_dictionary_get(pkgd, "run_depends");
-	provides = xbps_dictionary_get(pkgd, "provides");
-	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
-
-	pkgn = xbps_pkg_name(pkgver);
-	assert(pkgn);
-	item = lookupItem(pkgn);
-	if (item) {
-		add_deps_recursive(item, depth == 0);
-		return item;
-	}
-
-	item = addItem(rdeps, pkgn);
-	item->pkgver = pkgver;
-	assert(item);
-	free(pkgn);
-
-	for (unsigned int i = 0; i < xbps_array_count(rdeps); i++) {
-		xbps_dictionary_t curpkgd;
-		const char *curdep = NULL;
-		char *curdepname;
-
-		xbps_array_get_cstring_nocopy(rdeps, i, &curdep);
-		if (rpool) {
-			if ((curpkgd = xbps_rpool_get_pkg(xhp, curdep)) == NULL)
-				curpkgd = xbps_rpool_get_virtualpkg(xhp, curdep);
-		} else {
-			if ((curpkgd = xbps_pkgdb_get_pkg(xhp, curdep)) == NULL)
-				curpkgd = xbps_pkgdb_get_virtualpkg(xhp, curdep);
-			/* Ignore missing local runtime dependencies, because ignorepkg */
-			if (curpkgd == NULL)
+	for (unsigned int id = 0; id < xbps_depgraph_count(g); id++) {
+		xbps_dictionary_t pkgd;
+		xbps_array_t rdeps, provides;
+		const char *pkgver = NULL;
+
+		pkgd = xbps_depgraph_get_pkgd(g, id);
+		rdeps = xbps_dictionary_get(pkgd, "run_depends");
+		provides = xbps_dictionary_get(pkgd, "provides");
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+
+		for (unsigned int i = 0; i < xbps_array_count(rdeps); i++) {
+			xbps_dictionary_t curpkgd;
+			const char *curdep = NULL, *curpkgver = NULL;
+			char *curdepname;
+			unsigned int depid;
+			int rv;
+
+			xbps_array_get_cstring_nocopy(rdeps, i, &curdep);
+			if (rpool) {
+				if ((curpkgd = xbps_rpool_get_pkg(xhp, curdep)) == NULL)
+					curpkgd = xbps_rpool_get_virtualpkg(xhp, curdep);
+			} else {
+				if ((curpkgd = xbps_pkgdb_get_pkg(xhp, curdep)) == NULL)
+					curpkgd = xbps_pkgdb_get_virtualpkg(xhp, curdep);
+				/* Ignore missing local runtime dependencies, because ignorepkg */
+				if (curpkgd == NULL)
+					continue;
+			}
+			if (curpkgd == NULL) {
+				/* package depends on missing dependencies */
+				xbps_dbg_printf(xhp, "%s: missing dependency '%s'\n", pkgver, curdep);
+				return ENODEV;
+			}
+			if ((curdepname = xbps_pkgpattern_name(curdep)) == NULL)
+				curdepname = xbps_pkg_name(curdep);
+
+			assert(curdepname);
+
+			if (provides && xbps_match_pkgname_in_array(provides, curdepname)) {
+				xbps_dbg_printf(xhp, "%s: ignoring dependency %s "
+				    "already in provides\n", pkgver, curdep);
+				free(curdepname);
 				continue;
-		}
-		if (curpkgd == NULL) {
-			/* package depends on missing dependencies */
-			xbps_dbg_printf(xhp, "%s: missing dependency '%s'\n", pkgver, curdep);
-			errno = ENODEV;
-			return NULL;
-		}
-		if ((curdepname = xbps_pkgpattern_name(curdep)) == NULL)
-			curdepname = xbps_pkg_name(curdep);
-
-		assert(curdepname);
+			}
+			free(curdepname);
 
-		if (provides && xbps_match_pkgname_in_array(provides, curdepname)) {
-			xbps_dbg_printf(xhp, "%s: ignoring dependency %s "
-			    "already in provides\n", pkgver, curdep);
+			xbps_dictionary_get_cstring_nocopy(curpkgd, "pkgver", &curpkgver);
+			curdepname = xbps_pkg_name(curpkgver);
+			assert(curdepname);
+			rv = xbps_depgraph_add(g, curdepname, curpkgd, &depid);
 			free(curdepname);
-			continue;
-		}
-		xitem = lookupItem(curdepname);
-		if (xitem) {
-			add_deps_recursive(xitem, false);
-			continue;
-		}
-		xitem = ordered_depends(xhp, curpkgd, rpool, depth+1);
-		if (xitem == NULL) {
-			/* package depends on missing dependencies */
-			xbps_dbg_printf(xhp, "%s: missing dependency '%s'\n", pkgver, curdep);
-			errno = ENODEV;
-			return NULL;
+			if (rv != 0 && rv != EEXIST)
+				return rv;
+			if (depid == id)
+				continue;
+			if ((rv = xbps_depgraph_add_edge(g, id, depid)) != 0)
+				return rv;
 		}
-		assert(xitem);
-		addDepn(item, xitem);
-		free(curdepname);
-	}
-	/* all deps were processed, add item to head */
-	if (depth > 0 && !xbps_match_string_in_array(result, item->pkgver)) {
-		str = xbps_string_create_cstring(item->pkgver);
-		assert(str);
-		xbps_array_add_first(result, str);
-		xbps_object_release(str);
 	}
-	return item;
+	return 0;
 }
 
 xbps_array_t HIDDEN
 xbps_get_pkg_fulldeptree(struct xbps_handle *xhp, const char *pkg, bool rpool)
 {
+	struct xbps_depgraph *g;
+	struct fulldeptree fdt;
 	xbps_dictionary_t pkgd;
-
-	result = xbps_array_create();
-	assert(result);
+	xbps_array_t result = NULL;
+	const char *pkgver = NULL;
+	char *pkgname;
+	int rv;
 
 	if (rpool) {
 		if (((pkgd = xbps_rpool_get_pkg(xhp, pkg)) == NULL) &&
@@ -243,8 +139,50 @@ xbps_get_pkg_fulldeptree(struct xbps_handle *xhp, const char *pkg, bool rpool)
 		    ((pkgd = xbps_pkgdb_get_virtualpkg(xhp, pkg)) == NULL))
 			return NULL;
 	}
-	if (ordered_depends(xhp, pkgd, rpool, 0) == NULL)
+	if ((g = xbps_depgraph_create()) == NULL) {
+		errno = ENOMEM;
 		return NULL;
+	}
+	memset(&fdt, 0, sizeof(fdt));
 
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+	pkgname = xbps_pkg_name(pkgver);
+	assert(pkgname);
+	rv = xbps_depgraph_add(g, pkgname, pkgd, &fdt.root);
+	free(pkgname);
+	if (rv != 0)
+		goto out;
+	if ((rv = build_graph(xhp, g, rpool)) != 0)
+		goto out;
+
+	if ((fdt.ids = malloc(xbps_depgraph_count(g) * sizeof(*fdt.ids))) == NULL) {
+		rv = ENOMEM;
+		goto out;
+	}
+	if ((rv = xbps_depgraph_sort(g, &fdt.root, 1, collect_cb, &fdt)) != 0)
+		goto out;
+	/*
+	 * Dependencies are sorted before the packages requiring them,
+	 * the result is returned in the reverse order.
+	 */
+	if ((result = xbps_array_create()) == NULL) {
+		rv = ENOMEM;
+		goto out;
+	}
+	while (fdt.nids--) {
+		pkgd = xbps_depgraph_get_pkgd(g, fdt.ids[fdt.nids]);
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+		if (!xbps_array_add_cstring(result, pkgver)) {
+			xbps_object_release(result);
+			result = NULL;
+			rv = ENOMEM;
+			goto out;
+		}
+	}
+out:
+	free(fdt.ids);
+	xbps_depgraph_free(g);
+	if (rv != 0)
+		errno = rv;
 	return result;
 }
@@ -35,74 +35,279 @@
 
 #include "xbps_api_impl.h"
 
+/*
+ * Files are removed relative to its parent directory, grouped by
+ * directory and deepest directories first; so that directory contents
+ * are always removed before the directory itself. Directories at the
+ * same depth are independent and with many files they are processed
+ * by multiple threads.
+ */
+#define REMOVE_PARALLEL_MIN	1024
+
+struct rmentry {
+	const char *file;
+	const char *base;
+	size_t dirlen;
+	unsigned int depth;
+	unsigned int idx;
+	bool isdir;
+};
+
+struct rmgroup {
+	unsigned int start;
+	unsigned int end;
+	unsigned int depth;
+};
+
+struct rmfiles {
+	struct xbps_handle *xhp;
+	const char *pkgver;
+	struct rmentry *entries;
+	struct rmgroup *groups;
+	unsigned int nentries;
+	unsigned int ngroups;
+	uid_t euid;
+	bool obsolete;
+	/* first group of the level being removed */
+	unsigned int first;
+	bool fail;
+};
+
+static int
+rmentry_cmp(const void *l1, const void *l2)
+{
+	const struct rmentry *a = l1, *b = l2;
+	size_t len;
+	int rv;
+
+	if (a->depth != b->depth)
+		return a->depth < b->depth ? 1 : -1;
+	len = a->dirlen < b->dirlen ? a->dirlen : b->dirlen;
+	if ((rv = strncmp(a->file, b->file, len)) != 0)
+		return rv;
+	if (a->dirlen != b->dirlen)
+		return a->dirlen < b->dirlen ? -1 : 1;
+	return (a->idx > b->idx) - (a->idx < b->idx);
+}
+
+static int
+rmfiles_init(struct rmfiles *rf, xbps_array_t files)
+{
+	struct rmentry *e;
+	const char *p;
+
+	rf->nentries = xbps_array_count(files);
+	rf->entries = calloc(rf->nentries, sizeof(*rf->entries));
+	rf->groups = calloc(rf->nentries, sizeof(*rf->groups));
+	if (rf->entries == NULL || rf->groups == NULL)
+		return ENOMEM;
+
+	for (unsigned int i = 0; i < rf->nentries; i++) {
+		e = &rf->entries[i];
+		xbps_array_get_cstring_nocopy(files, i, &e->file);
+		e->idx = i;
+		for (p = e->file; *p; p++) {
+			if (*p == '/')
+				e->depth++;
+		}
+		if ((p = strrchr(e->file, '/')) != NULL) {
+			e->base = p + 1;
+			e->dirlen = (size_t)(p - e->file);
+		} else {
+			e->base = e->file;
+		}
+	}
+	qsort(rf->entries, rf->nentries, sizeof(*rf->entries), rmentry_cmp);
+
+	for (unsigned int i = 0; i < rf->nentries; i++) {
+		e = &rf->entries[i];
+		if (i == 0 || e->dirlen != e[-1].dirlen ||
+		    strncmp(e->file, e[-1].file, e->dirlen)) {
+			rf->groups[rf->ngroups].start = i;
+			rf->groups[rf->ngroups].depth = e->depth;
+			rf->ngroups++;
+		}
+		rf->groups[rf->ngroups-1].end = i + 1;
+	}
+	return 0;
+}
+
+static int
+open_dir(struct rmentry *e)
+{
+	char *dir;
+	int fd;
+
+	if (e->base == e->file)
+		return open(".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	else if (e->dirlen == 0)
+		return open("/", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+
+	dir = strndup(e->file, e->dirlen);
+	assert(dir);
+	fd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	free(dir);
+
+	return fd;
+}
+
+/*
+ * Check if effective user ID owns all files; this is enough
+ * to ensure the user has write permissions on the directory.
+ */
 static bool
-check_remove_pkg_files(struct xbps_handle *xhp,
-	xbps_array_t obsoletes, const char *pkgver, uid_t euid)
+check_group(struct rmfiles *rf, struct rmgroup *g)
 {
+	struct rmentry *e;
 	struct stat st;
+	int dfd, rv;
 	bool fail = false;
 
-	if (euid == 0)
-		return false;
-
-	for (unsigned int i = 0; i < xbps_array_count(obsoletes); i++) {
-		const char *file = NULL;
-		xbps_array_get_cstring_nocopy(obsoletes, i, &file);
+	dfd = open_dir(&rf->entries[g->start]);
+	for (unsigned int i = g->start; i < g->end; i++) {
+		e = &rf->entries[i];
+		if (dfd != -1 &&
+		    fstatat(dfd, e->base, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+			e->isdir = S_ISDIR(st.st_mode);
+			if (rf->euid == st.st_uid) {
+				/* success */
+				continue;
+			}
+			/* lstat succeeds but euid != uid */
+			rv = EPERM;
+		} else {
+			rv = errno;
+		}
 		/*
-		 * Check if effective user ID owns the file; this is
-		 * enough to ensure the user has write permissions
-		 * on the directory.
+		 * only bail out if something else than ENOENT
+		 * is returned.
 		 */
-		if (lstat(file, &st) == 0 && euid == st.st_uid) {
-			/* success */
+		if (rv == ENOENT)
 			continue;
-		}
-		if (errno != ENOENT) {
-			/*
-			 * only bail out if something else than ENOENT
-			 * is returned.
-			 */
-			int rv = errno;
-			if (rv == 0) {
-				/* lstat succeeds but euid != uid */
-				rv = EPERM;
-			}
-			fail = true;
-			xbps_set_cb_state(xhp, XBPS_STATE_REMOVE_FILE_FAIL,
-				rv, pkgver,
-				"%s: cannot remove `%s': %s",
-				pkgver, file, strerror(rv));
-		}
-		errno = 0;
+
+		fail = true;
+		xbps_set_cb_state(rf->xhp, XBPS_STATE_REMOVE_FILE_FAIL,
+			rv, rf->pkgver,
+			"%s: cannot remove `%s': %s",
+			rf->pkgver, e->file, strerror(rv));
 	}
+	if (dfd != -1)
+		(void)close(dfd);
+
 	return fail;
 }
 
-static int
-remove_pkg_files(struct xbps_handle *xhp,
-		 xbps_array_t obsoletes,
-		 const char *pkgver)
+static void
+remove_group(struct rmfiles *rf, struct rmgroup *g)
 {
-	int rv = 0;
+	struct xbps_handle *xhp = rf->xhp;
+	struct rmentry *e;
+	const char *pkgver = rf->pkgver;
+	int dfd, rv;
 
-	for (unsigned int i = 0; i < xbps_array_count(obsoletes); i++) {
-		const char *file = NULL;
-		xbps_array_get_cstring_nocopy(obsoletes, i, &file);
+	dfd = open_dir(&rf->entries[g->start]);
+	for (unsigned int i = g->start; i < g->end; i++) {
+		e = &rf->entries[i];
 		/*
-		 * Remove the object if possible.
+		 * Remove the object if possible, like remove(3).
 		 */
-		if (remove(file) == -1) {
+		rv = -1;
+		if (dfd != -1) {
+			rv = unlinkat(dfd, e->base, e->isdir ? AT_REMOVEDIR : 0);
+			if (rv == -1 && !e->isdir &&
+			    (errno == EISDIR || errno == EPERM))
+				rv = unlinkat(dfd, e->base, AT_REMOVEDIR);
+		}
+		if (rv == -1 && rf->obsolete) {
+			xbps_set_cb_state(xhp,
+			    XBPS_STATE_REMOVE_FILE_OBSOLETE_FAIL,
+			    errno, pkgver,
+			    "%s: failed to remove obsolete entry `%s': %s",
+			    pkgver, e->file, strerror(errno));
+		} else if (rv == -1) {
 			xbps_set_cb_state(xhp, XBPS_STATE_REMOVE_FILE_FAIL,
 			    errno, pkgver,
 			    "%s: failed to remove `%s': %s", pkgver,
-			    file, strerror(errno));
+			    e->file, strerror(errno));
+		} else if (rf->obsolete) {
+			xbps_set_cb_state(xhp, XBPS_STATE_REMOVE_FILE_OBSOLETE,
+			    0, pkgver, "%s: removed obsolete entry: %s",
+			    pkgver, e->file);
 		} else {
 			/* success */
 			xbps_set_cb_state(xhp, XBPS_STATE_REMOVE_FILE,
-			    0, pkgver, "Removed `%s'", file);
+			    0, pkgver, "Removed `%s'", e->file);
 		}
 	}
+	if (dfd != -1)
+		(void)close(dfd);
+}
 
+static int
+remove_job(unsigned int i, void *arg)
+{
+	struct rmfiles *rf = arg;
+
+	remove_group(rf, &rf->groups[rf->first + i]);
+	return 0;
+}
+
+static void
+remove_groups(struct rmfiles *rf)
+{
+	unsigned int i, end, nthreads;
+
+	nthreads = rf->nentries >= REMOVE_PARALLEL_MIN ? 0 : 1;
+	for (i = 0; i < rf->ngroups; i = end) {
+		/* all directories at the same depth */
+		for (end = i + 1; end < rf->ngroups; end++) {
+			if (rf->groups[end].depth != rf->groups[i].depth)
+				break;
+		}
+		rf->first = i;
+		(void)xbps_jobs_run(end - i, nthreads, remove_job, rf);
+	}
+}
+
+/*
+ * Remove all files in the `files' array, relative to the current
+ * directory (rootdir). If `check' is set and the effective user is not
+ * root, nothing is removed unless it owns all files, returning EPERM.
+ */
+int HIDDEN
+xbps_remove_files(struct xbps_handle *xhp, xbps_array_t files,
+		const char *pkgver, bool obsolete, bool check)
+{
+	struct rmfiles rf;
+	int rv;
+
+	memset(&rf, 0, sizeof(rf));
+	rf.xhp = xhp;
+	rf.pkgver = pkgver;
+	rf.euid = geteuid();
+	rf.obsolete = obsolete;
+
+	if ((rv = rmfiles_init(&rf, files)) != 0)
+		goto out;
+	/*
+	 * Do the removal in 2 phases:
+	 * 	1- check if user has enough perms to remove all entries
+	 * 	2- perform removal
+	 */
+	if (check && rf.euid != 0) {
+		for (unsigned int g = 0; g < rf.ngroups; g++) {
+			if (check_group(&rf, &rf.groups[g]))
+				rf.fail = true;
+		}
+		if (rf.fail) {
+			rv = EPERM;
+			goto out;
+		}
+	}
+	remove_groups(&rf);
+out:
+	free(rf.entries);
+	free(rf.groups);
 	return rv;
 }
 
@@ -114,7 +319,6 @@ xbps_remove_pkg(struct xbps_handle *xhp, const char *pkgver, bool update)
 	char *pkgname, metafile[PATH_MAX];
 	int rv = 0;
 	pkg_state_t state = 0;
-	uid_t euid;
 
 	assert(xhp);
 	assert(pkgver);
@@ -122,8 +326,6 @@ xbps_remove_pkg(struct xbps_handle *xhp, const char *pkgver, bool update)
 	pkgname = xbps_pkg_name(pkgver);
 	assert(pkgname);
 
-	euid = geteuid();
-
 	if ((pkgd = xbps_pkgdb_get_pkg(xhp, pkgname)) == NULL) {
 		rv = errno;
 		xbps_dbg_printf(xhp, "[remove] cannot find %s in pkgdb: %s\n",
@@ -189,17 +391,8 @@ xbps_remove_pkg(struct xbps_handle *xhp, const char *pkgver, bool update)
 		obsoletes = xbps_dictionary_get(obsd, pkgname);
 
 	if (xbps_array_count(obsoletes) > 0) {
-		/*
-		 * Do the removal in 2 phases:
-		 * 	1- check if user has enough perms to remove all entries
-		 * 	2- perform removal
-		 */
-		if (check_remove_pkg_files(xhp, obsoletes, pkgver, euid)) {
-			rv = EPERM;
-			goto out;
-		}
-		/* Remove links */
-		if ((rv = remove_pkg_files(xhp, obsoletes, pkgver)) != 0)
+		rv = xbps_remove_files(xhp, obsoletes, pkgver, false, true);
+		if (rv != 0)
 			goto out;
 	}
 
@@ -215,6 +408,7 @@ xbps_remove_pkg(struct xbps_handle *xhp, const char *pkgver, bool update)
 		    "post ACTION: %s", pkgver, strerror(rv));
 		goto out;
 	}
+	xbps_triggers_add(xhp, pkgd);
 	/*
 	 * Set package state to "half-removed".
 	 */
@@ -0,0 +1,170 @@
+/*-
+ * Copyright (c) 2026 agent <agent@local>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * Packages may declare in its "triggers" array named actions that
+ * are expensive and system-wide (i.e updating the font cache), rather
+ * than running them from its INSTALL/REMOVE scripts. Triggers are
+ * collected while packages are configured or removed and each one
+ * is executed once.
+ */
+static bool
+valid_trigger(const char *name)
+{
+	return *name && strchr(name, '/') == NULL &&
+	    strcmp(name, ".") && strcmp(name, "..");
+}
+
+void HIDDEN
+xbps_triggers_add(struct xbps_handle *xhp, xbps_dictionary_t pkgd)
+{
+	xbps_array_t triggers, pkgs;
+	const char *pkgver = NULL, *name = NULL;
+
+	triggers = xbps_dictionary_get(pkgd, "triggers");
+	if (xbps_array_count(triggers) == 0)
+		return;
+
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+	assert(pkgver);
+
+	if (xhp->triggers == NULL) {
+		xhp->triggers = xbps_dictionary_create();
+		assert(xhp->triggers);
+	}
+	for (unsigned int i = 0; i < xbps_array_count(triggers); i++) {
+		xbps_array_get_cstring_nocopy(triggers, i, &name);
+		if (!valid_trigger(name)) {
+			xbps_dbg_printf(xhp, "%s: ignoring invalid trigger "
+			    "`%s'\n", pkgver, name);
+			continue;
+		}
+		if ((pkgs = xbps_dictionary_get(xhp->triggers, name)) == NULL) {
+			pkgs = xbps_array_create();
+			assert(pkgs);
+			xbps_dictionary_set(xhp->triggers, name, pkgs);
+			xbps_object_release(pkgs);
+		}
+		if (!xbps_match_string_in_array(pkgs, pkgver))
+			xbps_array_add_cstring(pkgs, pkgver);
+
+		xbps_dbg_printf(xhp, "%s: fired trigger `%s'\n", pkgver, name);
+	}
+}
+
+static int
+run_trigger(struct xbps_handle *xhp, const char *name, xbps_array_t pkgs)
+{
+	const char **argv;
+	char *path;
+	unsigned int i, npkgs;
+	int rv = 0;
+
+	path = xbps_xasprintf("%s/%s", XBPS_TRIGGERS_PATH, name);
+	/*
+	 * path is relative to rootdir; the trigger is executed in
+	 * the chroot if possible, otherwise from rootdir.
+	 */
+	if (access(path, X_OK) == -1) {
+		xbps_dbg_printf(xhp, "[trigger] %s: %s, skipping\n",
+		    path, strerror(errno));
+		free(path);
+		return 0;
+	}
+	npkgs = xbps_array_count(pkgs);
+	argv = calloc(npkgs + 3, sizeof(*argv));
+	assert(argv);
+	argv[0] = path;
+	argv[1] = "run";
+	for (i = 0; i < npkgs; i++)
+		xbps_array_get_cstring_nocopy(pkgs, i, &argv[i + 2]);
+
+	xbps_set_cb_state(xhp, XBPS_STATE_TRIGGER, 0, name,
+	    "Running trigger `%s' (%u package%s) ...", name, npkgs,
+	    npkgs > 1 ? "s" : "");
+
+	if ((rv = xbps_file_execv(xhp, argv)) != 0) {
+		if (rv == -1)
+			rv = errno;
+		xbps_set_cb_state(xhp, XBPS_STATE_TRIGGER_FAIL, rv, name,
+		    "[trigger] `%s' failed to execute: %s", name,
+		    strerror(rv));
+	}
+	free(argv);
+	free(path);
+
+	return rv;
+}
+
+int
+xbps_triggers_run(struct xbps_handle *xhp)
+{
+	xbps_array_t allkeys;
+	xbps_dictionary_t triggers;
+	const char *name;
+	int rv = 0, error;
+
+	assert(xhp);
+
+	if ((triggers = xhp->triggers) == NULL)
+		return 0;
+	xhp->triggers = NULL;
+
+	if (xhp->target_arch) {
+		xbps_dbg_printf(xhp, "not executing triggers for "
+		    "target arch.\n");
+		goto out;
+	}
+	if (chdir(xhp->rootdir) == -1) {
+		rv = errno;
+		xbps_set_cb_state(xhp, XBPS_STATE_TRIGGER_FAIL, rv, NULL,
+		    "[trigger] failed to chdir to rootdir `%s': %s",
+		    xhp->rootdir, strerror(rv));
+		goto out;
+	}
+	/* sorted by name, to always run triggers in the same order */
+	allkeys = xbps_dictionary_all_keys(triggers);
+	for (unsigned int i = 0; i < xbps_array_count(allkeys); i++) {
+		name = xbps_dictionary_keysym_cstring_nocopy(
+		    xbps_array_get(allkeys, i));
+		error = run_trigger(xhp, name,
+		    xbps_dictionary_get(triggers, name));
+		if (error && rv == 0)
+			rv = error;
+	}
+	xbps_object_release(allkeys);
+out:
+	xbps_object_release(triggers);
+	return rv;
+}
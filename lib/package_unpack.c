@@ -32,6 +32,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <pthread.h>
 
 #include "xbps_api_impl.h"
 
@@ -66,40 +67,1004 @@ match_preserved_file(struct xbps_handle *xhp, const char *entry)
 	return xbps_match_string_in_array(xhp->preserved_files, file);
 }
 
+/*
+ * Binary packages bigger than this are extracted by a pool of writer
+ * threads, while the caller keeps decompressing the archive.
+ */
+#define UNPACK_PIPELINE_MINSIZE	(8 * 1024 * 1024)
+#define UNPACK_MAXWORKERS	4
+#define UNPACK_QUEUE_SIZE	64
+#define UNPACK_QUEUE_MAXBYTES	(32 * 1024 * 1024)
+
+/*
+ * Otherwise small regular files are written in batches through
+ * io_uring(7), if available.
+ */
+#define UNPACK_URING_ENTRIES	128
+#define UNPACK_URING_MAXFILESIZE	(1024 * 1024)
+#define UNPACK_URING_MAXBYTES	(16 * 1024 * 1024)
+
+struct unpack_entry {
+	struct archive_entry *entry;
+	void *buf;
+	size_t bufsiz;
+};
+
+struct uring_file {
+	struct unpack_entry ue;
+	int fd;
+	int res;
+	size_t off;
+	bool conf;
+	bool done;
+};
+
+struct unpack_ctx {
+	struct xbps_handle *xhp;
+	xbps_dictionary_t binpkg_filesd;
+	xbps_dictionary_t pkg_filesd;
+	xbps_dictionary_t binfiles;
+	xbps_dictionary_t instfiles;
+	struct xbps_unpack_cb_data xucd;
+	const char *pkgver;
+	uid_t euid;
+	int flags;
+	bool force;
+	/* writer threads */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct unpack_entry queue[UNPACK_QUEUE_SIZE];
+	unsigned int qhead;
+	unsigned int qcount;
+	unsigned int busy;
+	size_t qbytes;
+	int error;
+	bool done;
+	/* io_uring writer */
+	struct xbps_uring *ur;
+	struct archive *aw;
+	struct uring_file ufiles[UNPACK_URING_ENTRIES];
+	unsigned int nufiles;
+	size_t ubytes;
+};
+
+/*
+ * Returns a dictionary with all "files" objects keyed by its path.
+ */
+static xbps_dictionary_t
+files_index(xbps_dictionary_t filesd)
+{
+	xbps_array_t array;
+	xbps_dictionary_t d;
+
+	if ((d = xbps_dictionary_create()) == NULL)
+		return NULL;
+
+	array = xbps_dictionary_get(filesd, "files");
+	for (unsigned int i = 0; i < xbps_array_count(array); i++) {
+		xbps_dictionary_t filed = xbps_array_get(array, i);
+		const char *file = NULL;
+
+		if (xbps_dictionary_get_cstring_nocopy(filed, "file", &file))
+			xbps_dictionary_set(d, file, filed);
+	}
+	return d;
+}
+
+/*
+ * Check if the file on disk matches the hash of the new file.
+ * Returns 0 if matched, 1 if not matched and -1 on error.
+ *
+ * If the file on disk did not change since it was installed (same
+ * size, mtime and inode), the hash recorded in the installed pkg
+ * files metadata is compared rather than hashing the file again,
+ * unless XBPS_FLAG_STRICT_HASH is set.
+ */
+static int
+check_file_hash(struct unpack_ctx *ctx, const char *file,
+		const struct stat *st)
+{
+	struct xbps_handle *xhp = ctx->xhp;
+	xbps_dictionary_t filed;
+	const char *sha256 = NULL, *instsha256 = NULL;
+	uint64_t size, mtime, mtime_nsec, inode;
+	char *buf;
+	int rv;
+
+	filed = xbps_dictionary_get(ctx->binfiles, file);
+	if (!xbps_dictionary_get_cstring_nocopy(filed, "sha256", &sha256))
+		return 1; /* no match, file not found */
+
+	filed = xbps_dictionary_get(ctx->instfiles, file);
+	if (!(xhp->flags & XBPS_FLAG_STRICT_HASH) &&
+	    xbps_dictionary_get_uint64(filed, "inode", &inode) &&
+	    xbps_dictionary_get_uint64(filed, "size", &size) &&
+	    xbps_dictionary_get_uint64(filed, "mtime", &mtime) &&
+	    xbps_dictionary_get_uint64(filed, "mtime_nsec", &mtime_nsec) &&
+	    xbps_dictionary_get_cstring_nocopy(filed, "sha256", &instsha256) &&
+	    xbps_digest_algo(sha256) == xbps_digest_algo(instsha256) &&
+	    inode == (uint64_t)st->st_ino &&
+	    size == (uint64_t)st->st_size &&
+	    mtime == (uint64_t)st->st_mtim.tv_sec &&
+	    mtime_nsec == (uint64_t)st->st_mtim.tv_nsec) {
+		return strcmp(sha256, instsha256) ? 1 : 0;
+	}
+
+	if (strcmp(xhp->rootdir, "/") == 0) {
+		rv = xbps_file_hash_check(file, sha256);
+	} else {
+		buf = xbps_xasprintf("%s/%s", xhp->rootdir, file);
+		rv = xbps_file_hash_check(buf, sha256);
+		free(buf);
+	}
+	if (rv == 0)
+		return 0; /* matched */
+	else if (rv == ERANGE || rv == ENOENT)
+		return 1; /* no match */
+
+	errno = rv;
+	return -1; /* error */
+}
+
+/*
+ * Record size, mtime and inode of an unpacked file in the pkg files
+ * metadata, used by check_file_hash() in the next update.
+ */
+static void
+record_file(struct unpack_ctx *ctx, struct archive_entry *entry)
+{
+	xbps_dictionary_t filed;
+	struct stat st;
+	const char *entry_pname;
+
+	if (archive_entry_filetype(entry) != AE_IFREG)
+		return;
+
+	entry_pname = archive_entry_pathname(entry);
+	filed = xbps_dictionary_get(ctx->binfiles, entry_pname + 1);
+	if (filed == NULL || lstat(entry_pname, &st) == -1)
+		return;
+
+	xbps_dictionary_set_uint64(filed, "size", (uint64_t)st.st_size);
+	xbps_dictionary_set_uint64(filed, "mtime", (uint64_t)st.st_mtim.tv_sec);
+	xbps_dictionary_set_uint64(filed, "mtime_nsec", (uint64_t)st.st_mtim.tv_nsec);
+	xbps_dictionary_set_uint64(filed, "inode", (uint64_t)st.st_ino);
+}
+
+static void
+unpack_cb(struct unpack_ctx *ctx, struct archive_entry *entry, bool conf)
+{
+	struct xbps_unpack_cb_data xucd;
+
+	if (ctx->xhp->unpack_cb == NULL)
+		return;
+
+	pthread_mutex_lock(&ctx->lock);
+	ctx->xucd.entry_extract_count++;
+	xucd = ctx->xucd;
+	pthread_mutex_unlock(&ctx->lock);
+
+	xucd.entry = archive_entry_pathname(entry);
+	xucd.entry_size = archive_entry_size(entry);
+	xucd.entry_is_conf = conf;
+	xbps_set_cb_unpack(ctx->xhp, &xucd);
+}
+
+/*
+ * Check if the entry must be extracted, and update metadata
+ * of the existing file otherwise.
+ */
+static int
+check_entry(struct unpack_ctx *ctx, struct archive_entry *entry,
+		bool *extract, bool *conf)
+{
+	struct xbps_handle *xhp = ctx->xhp;
+	const struct stat *entry_statp;
+	struct stat st;
+	const char *entry_pname, *pkgver = ctx->pkgver;
+	char *buf = NULL;
+	int rv, entry_type;
+	bool file_exists, keep_conf_file, skip_extract;
+
+	entry_pname = archive_entry_pathname(entry);
+	entry_type = archive_entry_filetype(entry);
+	entry_statp = archive_entry_stat(entry);
+	*extract = *conf = false;
+
+	/*
+	 * Always check that extracted file exists and hash
+	 * doesn't match, in that case overwrite the file.
+	 * Otherwise skip extracting it.
+	 */
+	skip_extract = file_exists = keep_conf_file = false;
+	if (lstat(entry_pname, &st) == 0)
+		file_exists = true;
+	/*
+	 * Check if the file to be extracted must be preserved, if true,
+	 * pass to the next file.
+	 */
+	if (file_exists && match_preserved_file(xhp, entry_pname)) {
+		xbps_dbg_printf(xhp, "[unpack] `%s' exists on disk "
+		    "and must be preserved, skipping.\n", entry_pname);
+		xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FILE_PRESERVED, 0,
+		    pkgver, "%s: file `%s' won't be extracted, "
+		    "it's preserved.\n", pkgver, entry_pname);
+		return 0;
+	}
+
+	/*
+	 * Check if current entry is a configuration file,
+	 * that should be kept.
+	 */
+	if (!ctx->force && (entry_type == AE_IFREG)) {
+		buf = strchr(entry_pname, '.') + 1;
+		assert(buf != NULL);
+		keep_conf_file = xbps_entry_is_a_conf_file(ctx->binpkg_filesd, buf);
+	}
+
+	/*
+	 * If file to be extracted does not match the file type of
+	 * file currently stored on disk and is not a conf file
+	 * that should be kept, remove file on disk.
+	 */
+	if (file_exists && !keep_conf_file &&
+	    ((entry_statp->st_mode & S_IFMT) != (st.st_mode & S_IFMT)))
+		(void)remove(entry_pname);
+
+	if (!ctx->force && (entry_type == AE_IFREG)) {
+		if (file_exists && (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode))) {
+			/*
+			 * Handle configuration files.
+			 * Skip packages that don't have "conf_files"
+			 * array on its XBPS_PKGPROPS
+			 * dictionary.
+			 */
+			if (keep_conf_file) {
+				*conf = true;
+
+				rv = xbps_entry_install_conf_file(xhp,
+				    ctx->binpkg_filesd, ctx->pkg_filesd, entry,
+				    entry_pname, pkgver, S_ISLNK(st.st_mode));
+				if (rv == -1) {
+					/* error */
+					return rv;
+				} else if (rv == 0) {
+					/*
+					 * Keep curfile as is.
+					 */
+					skip_extract = true;
+				}
+			} else {
+				rv = check_file_hash(ctx, buf, &st);
+				if (rv == -1) {
+					/* error */
+					xbps_dbg_printf(xhp,
+					    "%s: failed to check"
+					    " hash for `%s': %s\n",
+					    pkgver, entry_pname,
+					    strerror(errno));
+					return rv;
+				} else if (rv == 0) {
+					/*
+					 * hash match, skip extraction.
+					 */
+					xbps_dbg_printf(xhp,
+					    "%s: file %s "
+					    "matches existing SHA256, "
+					    "skipping...\n",
+					    pkgver, entry_pname);
+					skip_extract = true;
+				}
+			}
+		}
+	}
+	/*
+	 * Check if current uid/gid differs from file in binpkg,
+	 * and change permissions if true.
+	 */
+	if ((!ctx->force && file_exists && skip_extract && (ctx->euid == 0)) &&
+	    (((archive_entry_uid(entry) != st.st_uid)) ||
+	    ((archive_entry_gid(entry) != st.st_gid)))) {
+		if (lchown(entry_pname,
+		    archive_entry_uid(entry),
+		    archive_entry_gid(entry)) != 0) {
+			xbps_dbg_printf(xhp,
+			    "%s: failed "
+			    "to set uid/gid to %"PRIu64":%"PRIu64" (%s)\n",
+			    pkgver, archive_entry_uid(entry),
+			    archive_entry_gid(entry),
+			    strerror(errno));
+		} else {
+			xbps_dbg_printf(xhp, "%s: entry %s changed "
+			    "uid/gid to %"PRIu64":%"PRIu64".\n", pkgver, entry_pname,
+			    archive_entry_uid(entry),
+			    archive_entry_gid(entry));
+		}
+	}
+	/*
+	 * Check if current file mode differs from file mode
+	 * in binpkg and apply perms if true.
+	 */
+	if (!ctx->force && file_exists && skip_extract &&
+	    (archive_entry_mode(entry) != st.st_mode)) {
+		if (chmod(entry_pname,
+		    archive_entry_mode(entry)) != 0) {
+			xbps_dbg_printf(xhp,
+			    "%s: failed "
+			    "to set perms %s to %s: %s\n",
+			    pkgver, archive_entry_strmode(entry),
+			    entry_pname,
+			    strerror(errno));
+			return EINVAL;
+		}
+		xbps_dbg_printf(xhp, "%s: entry %s changed file "
+		    "mode to %s.\n", pkgver, entry_pname,
+		    archive_entry_strmode(entry));
+	}
+	/*
+	 * Check if current file mtime differs from archive entry
+	 * in binpkg and apply mtime if true.
+	 */
+	if (!ctx->force && file_exists && skip_extract &&
+	    (archive_entry_mtime_nsec(entry) != st.st_mtime)) {
+		struct timespec ts[2];
+
+		ts[0].tv_sec = archive_entry_atime(entry);
+		ts[0].tv_nsec = archive_entry_atime_nsec(entry);
+		ts[1].tv_sec = archive_entry_mtime(entry);
+		ts[1].tv_nsec = archive_entry_mtime_nsec(entry);
+
+		if (utimensat(AT_FDCWD, entry_pname, ts,
+			      AT_SYMLINK_NOFOLLOW) == -1) {
+			xbps_dbg_printf(xhp,
+			    "%s: failed "
+			    "to set mtime %lu to %s: %s\n",
+			    pkgver, archive_entry_mtime_nsec(entry),
+			    entry_pname,
+			    strerror(errno));
+			return EINVAL;
+		}
+		xbps_dbg_printf(xhp, "%s: updated file timestamps to %s\n",
+		    pkgver, entry_pname);
+	}
+	if (ctx->force || !skip_extract)
+		*extract = true;
+	else
+		record_file(ctx, entry);
+
+	return 0;
+}
+
+static int
+write_data(struct unpack_ctx *ctx, struct archive *aw,
+		struct unpack_entry *ue, bool conf)
+{
+	const char *entry_pname;
+	int rv;
+
+	/*
+	 * Reset entry_pname again because if entry's pathname
+	 * has been changed it will become a dangling pointer.
+	 */
+	entry_pname = archive_entry_pathname(ue->entry);
+	if (archive_write_header(aw, ue->entry) != ARCHIVE_OK ||
+	    (ue->bufsiz &&
+	     archive_write_data(aw, ue->buf, ue->bufsiz) != (ssize_t)ue->bufsiz) ||
+	    archive_write_finish_entry(aw) != ARCHIVE_OK) {
+		rv = archive_errno(aw);
+		xbps_set_cb_state(ctx->xhp, XBPS_STATE_UNPACK_FAIL,
+		    rv, ctx->pkgver,
+		    "%s: [unpack] failed to extract file `%s': %s",
+		    ctx->pkgver, entry_pname, strerror(rv));
+		return rv ? rv : EIO;
+	}
+	record_file(ctx, ue->entry);
+	unpack_cb(ctx, ue->entry, conf);
+	return 0;
+}
+
+static int
+write_entry(struct unpack_ctx *ctx, struct archive *aw,
+		struct unpack_entry *ue)
+{
+	int rv;
+	bool extract, conf;
+
+	if ((rv = check_entry(ctx, ue->entry, &extract, &conf)) != 0)
+		return rv;
+	if (!extract)
+		return 0;
+
+	return write_data(ctx, aw, ue, conf);
+}
+
+static void *
+unpack_worker(void *arg)
+{
+	struct unpack_ctx *ctx = arg;
+	struct unpack_entry ue;
+	struct archive *aw;
+	int rv;
+
+	aw = archive_write_disk_new();
+	assert(aw);
+	archive_write_disk_set_options(aw, ctx->flags);
+	archive_write_disk_set_standard_lookup(aw);
+
+	for (;;) {
+		pthread_mutex_lock(&ctx->lock);
+		while (ctx->qcount == 0 && !ctx->done)
+			pthread_cond_wait(&ctx->cond, &ctx->lock);
+		if (ctx->qcount == 0) {
+			pthread_mutex_unlock(&ctx->lock);
+			break;
+		}
+		ue = ctx->queue[ctx->qhead];
+		ctx->qhead = (ctx->qhead + 1) % UNPACK_QUEUE_SIZE;
+		ctx->qcount--;
+		ctx->busy++;
+		rv = ctx->error;
+		pthread_mutex_unlock(&ctx->lock);
+
+		/* once an error is set, just drain the queue */
+		if (rv == 0)
+			rv = write_entry(ctx, aw, &ue);
+
+		archive_entry_free(ue.entry);
+		free(ue.buf);
+
+		pthread_mutex_lock(&ctx->lock);
+		if (rv != 0 && ctx->error == 0)
+			ctx->error = rv;
+		ctx->qbytes -= ue.bufsiz;
+		ctx->busy--;
+		pthread_cond_broadcast(&ctx->cond);
+		pthread_mutex_unlock(&ctx->lock);
+	}
+	archive_write_free(aw);
+
+	return NULL;
+}
+
+static int
+read_entry(struct unpack_ctx *ctx, struct archive *ar,
+		struct archive_entry *entry, struct unpack_entry *ue)
+{
+	ssize_t r;
+	size_t off = 0;
+	int rv;
+
+	ue->bufsiz = (size_t)archive_entry_size(entry);
+	ue->buf = NULL;
+	if (ue->bufsiz) {
+		ue->buf = malloc(ue->bufsiz);
+		assert(ue->buf);
+	}
+	/*
+	 * Read entry data from archive.
+	 */
+	while (off < ue->bufsiz) {
+		r = archive_read_data(ar, (char *)ue->buf + off, ue->bufsiz - off);
+		if (r <= 0) {
+			rv = r ? archive_errno(ar) : EINVAL;
+			xbps_set_cb_state(ctx->xhp, XBPS_STATE_UNPACK_FAIL,
+			    rv, ctx->pkgver,
+			    "%s: [unpack] failed to read file `%s': %s",
+			    ctx->pkgver, archive_entry_pathname(entry),
+			    strerror(rv));
+			free(ue->buf);
+			return rv ? rv : EINVAL;
+		}
+		off += (size_t)r;
+	}
+	ue->entry = archive_entry_clone(entry);
+	assert(ue->entry);
+
+	return 0;
+}
+
+static int
+queue_entry(struct unpack_ctx *ctx, struct archive *ar,
+		struct archive_entry *entry)
+{
+	struct unpack_entry ue;
+	int rv;
+
+	if ((rv = read_entry(ctx, ar, entry, &ue)) != 0)
+		return rv;
+
+	pthread_mutex_lock(&ctx->lock);
+	while (ctx->error == 0 && (ctx->qcount == UNPACK_QUEUE_SIZE ||
+	    ctx->qbytes + ue.bufsiz > UNPACK_QUEUE_MAXBYTES))
+		pthread_cond_wait(&ctx->cond, &ctx->lock);
+	if ((rv = ctx->error) != 0) {
+		pthread_mutex_unlock(&ctx->lock);
+		archive_entry_free(ue.entry);
+		free(ue.buf);
+		return rv;
+	}
+	ctx->queue[(ctx->qhead + ctx->qcount) % UNPACK_QUEUE_SIZE] = ue;
+	ctx->qcount++;
+	ctx->qbytes += ue.bufsiz;
+	pthread_cond_broadcast(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+
+	return 0;
+}
+
+static void
+uring_res_cb(uint64_t data, int res, void *arg)
+{
+	struct unpack_ctx *ctx = arg;
+
+	ctx->ufiles[data].res = res;
+}
+
+/*
+ * Write a batched file with the libarchive disk writer, used when
+ * io_uring failed for any reason (i.e missing parent directory); this
+ * also reports errors as usual.
+ */
+static int
+uring_fallback(struct unpack_ctx *ctx, struct uring_file *uf)
+{
+	if (uf->fd != -1) {
+		(void)close(uf->fd);
+		(void)unlink(archive_entry_pathname(uf->ue.entry));
+		uf->fd = -1;
+	}
+	uf->done = true;
+	return write_data(ctx, ctx->aw, &uf->ue, uf->conf);
+}
+
+static int
+uring_open(struct unpack_ctx *ctx)
+{
+	struct uring_file *uf;
+	const char *path, *dir, *lastdir = NULL;
+	unsigned int i, pending;
+	size_t dirlen, lastlen = 0;
+	int rv;
+
+	for (;;) {
+		pending = 0;
+		for (i = 0; i < ctx->nufiles; i++) {
+			uf = &ctx->ufiles[i];
+			if (uf->done || uf->fd != -1)
+				continue;
+			xbps_uring_openat(ctx->ur, AT_FDCWD,
+			    archive_entry_pathname(uf->ue.entry),
+			    O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC|O_NOFOLLOW,
+			    0600, i);
+			pending++;
+		}
+		if (pending == 0)
+			break;
+		if ((rv = xbps_uring_wait(ctx->ur, uring_res_cb, ctx)) != 0)
+			return rv;
+
+		lastdir = NULL;
+		for (i = 0; i < ctx->nufiles; i++) {
+			uf = &ctx->ufiles[i];
+			if (uf->done || uf->fd != -1)
+				continue;
+			path = archive_entry_pathname(uf->ue.entry);
+			if (uf->res >= 0) {
+				uf->fd = uf->res;
+				continue;
+			} else if (uf->res == -EEXIST && unlink(path) == 0) {
+				/* ARCHIVE_EXTRACT_UNLINK, try again */
+				continue;
+			} else if (uf->res == -ENOENT) {
+				/*
+				 * Parent directory does not exist; let
+				 * libarchive create it with the first file
+				 * and retry the others in the same directory.
+				 */
+				dir = strrchr(path, '/');
+				dirlen = dir ? (size_t)(dir - path) : 0;
+				if (lastdir && dirlen == lastlen &&
+				    strncmp(path, lastdir, dirlen) == 0)
+					continue;
+				lastdir = path;
+				lastlen = dirlen;
+			}
+			if ((rv = uring_fallback(ctx, uf)) != 0)
+				return rv;
+		}
+	}
+	return 0;
+}
+
+static int
+uring_write(struct unpack_ctx *ctx)
+{
+	struct uring_file *uf;
+	unsigned int i, pending;
+	int rv;
+
+	for (;;) {
+		pending = 0;
+		for (i = 0; i < ctx->nufiles; i++) {
+			uf = &ctx->ufiles[i];
+			if (uf->fd == -1 || uf->off == uf->ue.bufsiz)
+				continue;
+			xbps_uring_write(ctx->ur, uf->fd,
+			    (char *)uf->ue.buf + uf->off,
+			    uf->ue.bufsiz - uf->off, uf->off, i);
+			pending++;
+		}
+		if (pending == 0)
+			break;
+		if ((rv = xbps_uring_wait(ctx->ur, uring_res_cb, ctx)) != 0)
+			return rv;
+
+		for (i = 0; i < ctx->nufiles; i++) {
+			uf = &ctx->ufiles[i];
+			if (uf->fd == -1 || uf->off == uf->ue.bufsiz)
+				continue;
+			if (uf->res > 0) {
+				/* short writes are resubmitted */
+				uf->off += (size_t)uf->res;
+			} else if ((rv = uring_fallback(ctx, uf)) != 0) {
+				return rv;
+			}
+		}
+	}
+	return 0;
+}
+
+static void
+uring_free(struct unpack_ctx *ctx)
+{
+	struct uring_file *uf;
+
+	for (unsigned int i = 0; i < ctx->nufiles; i++) {
+		uf = &ctx->ufiles[i];
+		if (uf->fd != -1)
+			(void)close(uf->fd);
+		archive_entry_free(uf->ue.entry);
+		free(uf->ue.buf);
+	}
+	ctx->nufiles = 0;
+	ctx->ubytes = 0;
+}
+
+/*
+ * Write all batched files: open them, write its data and close them
+ * in a single io_uring submission each; owner, mode and timestamps
+ * (as set by ARCHIVE_EXTRACT_{OWNER,PERM,TIME}) are applied in between.
+ */
+static int
+uring_flush(struct unpack_ctx *ctx)
+{
+	struct archive_entry *entry;
+	struct uring_file *uf;
+	struct timespec ts[2];
+	unsigned int i, pending = 0;
+	int rv;
+
+	for (i = 0; i < ctx->nufiles; i++) {
+		uf = &ctx->ufiles[i];
+		uf->fd = -1;
+		uf->off = 0;
+		uf->done = false;
+	}
+	if ((rv = uring_open(ctx)) != 0)
+		goto out;
+	if ((rv = uring_write(ctx)) != 0)
+		goto out;
+
+	for (i = 0; i < ctx->nufiles; i++) {
+		uf = &ctx->ufiles[i];
+		if (uf->fd == -1)
+			continue;
+		entry = uf->ue.entry;
+		if ((ctx->flags & ARCHIVE_EXTRACT_OWNER) &&
+		    fchown(uf->fd, archive_entry_uid(entry),
+		    archive_entry_gid(entry)) == -1) {
+			xbps_dbg_printf(ctx->xhp, "%s: failed to set uid/gid "
+			    "of %s: %s\n", ctx->pkgver,
+			    archive_entry_pathname(entry), strerror(errno));
+		}
+		ts[0].tv_sec = archive_entry_atime(entry);
+		ts[0].tv_nsec = archive_entry_atime_nsec(entry);
+		if (!archive_entry_atime_is_set(entry))
+			ts[0].tv_nsec = UTIME_NOW;
+		ts[1].tv_sec = archive_entry_mtime(entry);
+		ts[1].tv_nsec = archive_entry_mtime_nsec(entry);
+		if (!archive_entry_mtime_is_set(entry))
+			ts[1].tv_nsec = UTIME_NOW;
+		if (fchmod(uf->fd, archive_entry_mode(entry) & 07777) == -1 ||
+		    futimens(uf->fd, ts) == -1) {
+			if ((rv = uring_fallback(ctx, uf)) != 0)
+				goto out;
+			continue;
+		}
+		xbps_uring_close(ctx->ur, uf->fd, i);
+		pending++;
+	}
+	if (pending && (rv = xbps_uring_wait(ctx->ur, uring_res_cb, ctx)) != 0)
+		goto out;
+
+	for (i = 0; i < ctx->nufiles; i++) {
+		uf = &ctx->ufiles[i];
+		if (uf->fd == -1)
+			continue;
+		uf->fd = -1;
+		if (uf->res < 0) {
+			rv = -uf->res;
+			xbps_set_cb_state(ctx->xhp, XBPS_STATE_UNPACK_FAIL,
+			    rv, ctx->pkgver,
+			    "%s: [unpack] failed to extract file `%s': %s",
+			    ctx->pkgver, archive_entry_pathname(uf->ue.entry),
+			    strerror(rv));
+			goto out;
+		}
+		record_file(ctx, uf->ue.entry);
+		unpack_cb(ctx, uf->ue.entry, uf->conf);
+	}
+out:
+	uring_free(ctx);
+	return rv;
+}
+
+static int
+uring_entry(struct unpack_ctx *ctx, struct archive *ar,
+		struct archive_entry *entry, bool conf)
+{
+	struct uring_file *uf;
+	int rv;
+
+	if (ctx->nufiles == UNPACK_URING_ENTRIES ||
+	    ctx->ubytes + (size_t)archive_entry_size(entry) > UNPACK_URING_MAXBYTES) {
+		if ((rv = uring_flush(ctx)) != 0)
+			return rv;
+	}
+	uf = &ctx->ufiles[ctx->nufiles];
+	if ((rv = read_entry(ctx, ar, entry, &uf->ue)) != 0)
+		return rv;
+	uf->fd = -1;
+	uf->conf = conf;
+	ctx->nufiles++;
+	ctx->ubytes += uf->ue.bufsiz;
+
+	return 0;
+}
+
+/*
+ * Wait until all queued entries have been written.
+ */
+static int
+wait_entries(struct unpack_ctx *ctx)
+{
+	int rv;
+
+	pthread_mutex_lock(&ctx->lock);
+	while (ctx->qcount || ctx->busy)
+		pthread_cond_wait(&ctx->cond, &ctx->lock);
+	rv = ctx->error;
+	pthread_mutex_unlock(&ctx->lock);
+
+	return rv;
+}
+
+/*
+ * Extract all remaining entries in the archive. If `nworkers' is set,
+ * regular files and symlinks are read into memory and written to disk
+ * by that number of threads; any other entry (i.e hardlinks) is
+ * extracted by the caller once all queued entries have been written.
+ * Otherwise small regular files are batched through io_uring when
+ * supported and not disabled by XBPS_FLAG_DISABLE_IO_URING, and the
+ * rest is extracted by libarchive.
+ */
+static int
+extract_files(struct unpack_ctx *ctx, struct archive *ar,
+		unsigned int nworkers)
+{
+	struct xbps_handle *xhp = ctx->xhp;
+	struct archive_entry *entry;
+	pthread_t *thds = NULL;
+	const char *entry_pname, *pkgver = ctx->pkgver;
+	int ar_rv, rv = 0, error = 0, entry_type;
+	bool extract, conf;
+
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+	if (nworkers) {
+		xbps_dbg_printf(xhp, "%s: [unpack] using %u writer threads\n",
+		    pkgver, nworkers);
+		thds = calloc(nworkers, sizeof(*thds));
+		assert(thds);
+		for (unsigned int i = 0; i < nworkers; i++)
+			pthread_create(&thds[i], NULL, unpack_worker, ctx);
+	} else if (!(xhp->flags & XBPS_FLAG_DISABLE_IO_URING) &&
+	    (ctx->ur = xbps_uring_init(UNPACK_URING_ENTRIES))) {
+		xbps_dbg_printf(xhp, "%s: [unpack] using io_uring\n", pkgver);
+		ctx->aw = archive_write_disk_new();
+		assert(ctx->aw);
+		archive_write_disk_set_options(ctx->aw, ctx->flags);
+		archive_write_disk_set_standard_lookup(ctx->aw);
+	}
+	for (;;) {
+		ar_rv = archive_read_next_header(ar, &entry);
+		if (ar_rv == ARCHIVE_EOF || ar_rv == ARCHIVE_FATAL)
+			break;
+		else if (ar_rv == ARCHIVE_RETRY)
+			continue;
+
+		entry_type = archive_entry_filetype(entry);
+		/*
+		 * Ignore directories from archive.
+		 */
+		if (entry_type == AE_IFDIR) {
+			archive_read_data_skip(ar);
+			continue;
+		}
+		if (nworkers &&
+		    (entry_type == AE_IFREG || entry_type == AE_IFLNK) &&
+		    archive_entry_hardlink(entry) == NULL &&
+		    archive_entry_size(entry) <= UNPACK_QUEUE_MAXBYTES) {
+			if ((error = queue_entry(ctx, ar, entry)) != 0)
+				break;
+			continue;
+		}
+		if (nworkers && (error = wait_entries(ctx)) != 0)
+			break;
+
+		if ((rv = check_entry(ctx, entry, &extract, &conf)) != 0)
+			break;
+		if (!extract) {
+			archive_read_data_skip(ar);
+			continue;
+		}
+		if (ctx->ur && entry_type == AE_IFREG &&
+		    archive_entry_hardlink(entry) == NULL &&
+		    archive_entry_size(entry) <= UNPACK_URING_MAXFILESIZE) {
+			if ((error = uring_entry(ctx, ar, entry, conf)) != 0)
+				break;
+			continue;
+		}
+		if (ctx->nufiles && (error = uring_flush(ctx)) != 0)
+			break;
+		/*
+		 * Reset entry_pname again because if entry's pathname
+		 * has been changed it will become a dangling pointer.
+		 */
+		entry_pname = archive_entry_pathname(entry);
+		/*
+		 * Extract entry from archive.
+		 */
+		if (archive_read_extract(ar, entry, ctx->flags) != 0) {
+			error = archive_errno(ar);
+			xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL,
+			    error, pkgver,
+			    "%s: [unpack] failed to extract file `%s': %s",
+			    pkgver, entry_pname, strerror(error));
+			break;
+		}
+		record_file(ctx, entry);
+		unpack_cb(ctx, entry, conf);
+	}
+	if (nworkers) {
+		int werror = wait_entries(ctx);
+
+		if (!rv && !error)
+			error = werror;
+
+		pthread_mutex_lock(&ctx->lock);
+		ctx->done = true;
+		pthread_cond_broadcast(&ctx->cond);
+		pthread_mutex_unlock(&ctx->lock);
+		for (unsigned int i = 0; i < nworkers; i++)
+			pthread_join(thds[i], NULL);
+
+		free(thds);
+	}
+	if (ctx->ur) {
+		if (!rv && !error && ar_rv != ARCHIVE_FATAL)
+			error = uring_flush(ctx);
+		else
+			uring_free(ctx);
+
+		archive_write_free(ctx->aw);
+		xbps_uring_free(ctx->ur);
+	}
+	pthread_cond_destroy(&ctx->cond);
+	pthread_mutex_destroy(&ctx->lock);
+
+	if (rv != 0)
+		return rv;
+	/*
+	 * If there was any error extracting files from archive, error out.
+	 */
+	if (error || ar_rv == ARCHIVE_FATAL) {
+		rv = error;
+		if (!rv)
+			rv = ar_rv;
+		xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL, rv, pkgver,
+		    "%s: [unpack] failed to extract files: %s",
+		    pkgver, strerror(rv));
+	}
+	return rv;
+}
+
+/*
+ * Wait until the packages before `pos' in `turn' have executed their
+ * INSTALL "pre" action, returns ECANCELED if any of them failed.
+ */
+static int
+turn_wait(struct xbps_unpack_turn *turn, unsigned int pos)
+{
+	int rv = 0;
+
+	if (turn == NULL)
+		return 0;
+
+	pthread_mutex_lock(&turn->lock);
+	while (turn->next != pos)
+		pthread_cond_wait(&turn->cond, &turn->lock);
+	if (turn->failed)
+		rv = ECANCELED;
+	pthread_mutex_unlock(&turn->lock);
+
+	return rv;
+}
+
+/*
+ * Let the next package execute its INSTALL "pre" action. Packages that
+ * fail before reaching it pass their turn on exit, so this does nothing
+ * if the turn was passed already.
+ */
+static void
+turn_pass(struct xbps_unpack_turn *turn, unsigned int pos, bool failed)
+{
+	if (turn == NULL)
+		return;
+
+	pthread_mutex_lock(&turn->lock);
+	while (turn->next < pos)
+		pthread_cond_wait(&turn->cond, &turn->lock);
+	if (turn->next == pos) {
+		if (failed)
+			turn->failed = true;
+		turn->next++;
+		pthread_cond_broadcast(&turn->cond);
+	}
+	pthread_mutex_unlock(&turn->lock);
+}
+
 static int
 unpack_archive(struct xbps_handle *xhp,
 	       xbps_dictionary_t pkg_repod,
 	       const char *pkgver,
 	       const char *fname,
-	       struct archive *ar)
+	       struct archive *ar,
+	       unsigned int nworkers,
+	       struct xbps_unpack_turn *turn,
+	       unsigned int pos)
 {
 	xbps_dictionary_t binpkg_propsd, binpkg_filesd, pkg_filesd, obsd;
 	xbps_array_t array, obsoletes;
 	xbps_data_t data;
-	const struct stat *entry_statp;
 	void *instbuf = NULL, *rembuf = NULL;
-	struct stat st;
-	struct xbps_unpack_cb_data xucd;
+	struct unpack_ctx ctx;
 	struct archive_entry *entry;
 	size_t  instbufsiz = 0, rembufsiz = 0;
 	ssize_t entry_size;
 	const char *entry_pname, *transact, *binpkg_pkgver;
 	char *pkgname, *buf = NULL;
-	int ar_rv, rv, error, entry_type, flags;
-	bool preserve, update, file_exists, keep_conf_file;
-	bool skip_extract, force, xucd_stats;
+	int ar_rv, rv, flags;
+	bool preserve, update, force;
 	uid_t euid;
 
 	binpkg_propsd = binpkg_filesd = pkg_filesd = NULL;
-	force = preserve = update = file_exists = false;
-	xucd_stats = false;
-	ar_rv = rv = error = entry_type = flags = 0;
+	force = preserve = update = false;
+	ar_rv = rv = flags = 0;
 
 	xbps_dictionary_get_bool(pkg_repod, "preserve", &preserve);
 	xbps_dictionary_get_cstring_nocopy(pkg_repod, "transaction", &transact);
 
-	memset(&xucd, 0, sizeof(xucd));
-
 	euid = geteuid();
 
 	pkgname = xbps_pkg_name(pkgver);
@@ -117,21 +1082,7 @@ unpack_archive(struct xbps_handle *xhp,
 	if (!preserve &&
 	    xbps_dictionary_get_dict(xhp->transd, "obsolete_files", &obsd) &&
 	    (obsoletes = xbps_dictionary_get(obsd, pkgname))) {
-		for (unsigned int i = 0; i < xbps_array_count(obsoletes); i++) {
-			const char *file = NULL;
-			xbps_array_get_cstring_nocopy(obsoletes, i, &file);
-			if (remove(file) == -1) {
-				xbps_set_cb_state(xhp,
-					XBPS_STATE_REMOVE_FILE_OBSOLETE_FAIL,
-					errno, pkgver,
-					"%s: failed to remove obsolete entry `%s': %s",
-					pkgver, file, strerror(errno));
-				continue;
-			}
-			xbps_set_cb_state(xhp,
-				XBPS_STATE_REMOVE_FILE_OBSOLETE,
-				0, pkgver, "%s: removed obsolete entry: %s", pkgver, file);
-		}
+		(void)xbps_remove_files(xhp, obsoletes, pkgver, true, false);
 	}
 
 	/*
@@ -247,284 +1198,71 @@ unpack_archive(struct xbps_handle *xhp,
 		xbps_object_release(data);
 	}
 	/*
-	 * Execute INSTALL "pre" ACTION before unpacking files.
+	 * Execute INSTALL "pre" ACTION before unpacking files, once
+	 * the previous packages in the transaction have done it.
 	 */
-	if (instbuf != NULL) {
+	if ((rv = turn_wait(turn, pos)) == 0 && instbuf != NULL) {
 		rv = xbps_pkg_exec_buffer(xhp, instbuf, instbufsiz, pkgver, "pre", update);
 		if (rv != 0) {
 			xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL, rv, pkgver,
 			    "%s: [unpack] INSTALL script failed to execute pre ACTION: %s",
 			    pkgver, strerror(rv));
-			goto out;
 		}
 	}
+	turn_pass(turn, pos, rv != 0);
+	if (rv != 0)
+		goto out;
 	/*
 	 * Unpack all files on archive now.
 	 */
-	for (;;) {
-		ar_rv = archive_read_next_header(ar, &entry);
-		if (ar_rv == ARCHIVE_EOF || ar_rv == ARCHIVE_FATAL)
-			break;
-		else if (ar_rv == ARCHIVE_RETRY)
-			continue;
-
-		entry_pname = archive_entry_pathname(entry);
-		entry_size = archive_entry_size(entry);
-		entry_type = archive_entry_filetype(entry);
-		entry_statp = archive_entry_stat(entry);
-		/*
-		 * Ignore directories from archive.
-		 */
-		if (entry_type == AE_IFDIR) {
-			archive_read_data_skip(ar);
-			continue;
-		}
-		/*
-		 * Prepare unpack callback ops.
-		 */
-		if (xhp->unpack_cb != NULL) {
-			xucd.xhp = xhp;
-			xucd.pkgver = pkgver;
-			xucd.entry = entry_pname;
-			xucd.entry_size = entry_size;
-			xucd.entry_is_conf = false;
-			/*
-			 * Compute total entries in progress data, if set.
-			 * total_entries = files + conf_files + links.
-			 */
-			if (binpkg_filesd && !xucd_stats) {
-				array = xbps_dictionary_get(binpkg_filesd, "files");
-				xucd.entry_total_count +=
-				    (ssize_t)xbps_array_count(array);
-				array = xbps_dictionary_get(binpkg_filesd, "conf_files");
-				xucd.entry_total_count +=
-				    (ssize_t)xbps_array_count(array);
-				array = xbps_dictionary_get(binpkg_filesd, "links");
-				xucd.entry_total_count +=
-				    (ssize_t)xbps_array_count(array);
-				xucd_stats = true;
-			}
-		}
-		/*
-		 * Always check that extracted file exists and hash
-		 * doesn't match, in that case overwrite the file.
-		 * Otherwise skip extracting it.
-		 */
-		skip_extract = file_exists = keep_conf_file = false;
-		if (lstat(entry_pname, &st) == 0)
-			file_exists = true;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.xhp = xhp;
+	ctx.binpkg_filesd = binpkg_filesd;
+	ctx.pkg_filesd = pkg_filesd;
+	ctx.binfiles = files_index(binpkg_filesd);
+	ctx.instfiles = files_index(pkg_filesd);
+	assert(ctx.binfiles && ctx.instfiles);
+	ctx.pkgver = pkgver;
+	ctx.euid = euid;
+	ctx.flags = flags;
+	ctx.force = force;
+	if (xhp->unpack_cb != NULL) {
 		/*
-		 * Check if the file to be extracted must be preserved, if true,
-		 * pass to the next file.
+		 * Compute total entries in progress data, if set.
+		 * total_entries = files + conf_files + links.
 		 */
-		if (file_exists && match_preserved_file(xhp, entry_pname)) {
-			archive_read_data_skip(ar);
-			xbps_dbg_printf(xhp, "[unpack] `%s' exists on disk "
-			    "and must be preserved, skipping.\n", entry_pname);
-			xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FILE_PRESERVED, 0,
-			    pkgver, "%s: file `%s' won't be extracted, "
-			    "it's preserved.\n", pkgver, entry_pname);
-			continue;
-		}
-
-		/*
-		 * Check if current entry is a configuration file,
-		 * that should be kept.
-		 */
-		if (!force && (entry_type == AE_IFREG)) {
-			buf = strchr(entry_pname, '.') + 1;
-			assert(buf != NULL);
-			keep_conf_file = xbps_entry_is_a_conf_file(binpkg_filesd, buf);
-		}
-
-		/*
-		 * If file to be extracted does not match the file type of
-		 * file currently stored on disk and is not a conf file
-		 * that should be kept, remove file on disk.
-		 */
-		if (file_exists && !keep_conf_file &&
-		    ((entry_statp->st_mode & S_IFMT) != (st.st_mode & S_IFMT)))
-			(void)remove(entry_pname);
-
-		if (!force && (entry_type == AE_IFREG)) {
-			if (file_exists && (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode))) {
-				/*
-				 * Handle configuration files.
-				 * Skip packages that don't have "conf_files"
-				 * array on its XBPS_PKGPROPS
-				 * dictionary.
-				 */
-				if (keep_conf_file) {
-					if (xhp->unpack_cb != NULL)
-						xucd.entry_is_conf = true;
-
-					rv = xbps_entry_install_conf_file(xhp,
-					    binpkg_filesd, pkg_filesd, entry,
-					    entry_pname, pkgver, S_ISLNK(st.st_mode));
-					if (rv == -1) {
-						/* error */
-						goto out;
-					} else if (rv == 0) {
-						/*
-						 * Keep curfile as is.
-						 */
-						skip_extract = true;
-					}
-					rv = 0;
-				} else {
-					rv = xbps_file_hash_check_dictionary(
-					    xhp, binpkg_filesd, "files", buf);
-					if (rv == -1) {
-						/* error */
-						xbps_dbg_printf(xhp,
-						    "%s: failed to check"
-						    " hash for `%s': %s\n",
-						    pkgver, entry_pname,
-						    strerror(errno));
-						goto out;
-					} else if (rv == 0) {
-						/*
-						 * hash match, skip extraction.
-						 */
-						xbps_dbg_printf(xhp,
-						    "%s: file %s "
-						    "matches existing SHA256, "
-						    "skipping...\n",
-						    pkgver, entry_pname);
-						skip_extract = true;
-					}
-					rv = 0;
-				}
-			}
-		}
-		/*
-		 * Check if current uid/gid differs from file in binpkg,
-		 * and change permissions if true.
-		 */
-		if ((!force && file_exists && skip_extract && (euid == 0)) &&
-		    (((archive_entry_uid(entry) != st.st_uid)) ||
-		    ((archive_entry_gid(entry) != st.st_gid)))) {
-			if (lchown(entry_pname,
-			    archive_entry_uid(entry),
-			    archive_entry_gid(entry)) != 0) {
-				xbps_dbg_printf(xhp,
-				    "%s: failed "
-				    "to set uid/gid to %"PRIu64":%"PRIu64" (%s)\n",
-				    pkgver, archive_entry_uid(entry),
-				    archive_entry_gid(entry),
-				    strerror(errno));
-			} else {
-				xbps_dbg_printf(xhp, "%s: entry %s changed "
-				    "uid/gid to %"PRIu64":%"PRIu64".\n", pkgver, entry_pname,
-				    archive_entry_uid(entry),
-				    archive_entry_gid(entry));
-			}
-		}
-		/*
-		 * Check if current file mode differs from file mode
-		 * in binpkg and apply perms if true.
-		 */
-		if (!force && file_exists && skip_extract &&
-		    (archive_entry_mode(entry) != st.st_mode)) {
-			if (chmod(entry_pname,
-			    archive_entry_mode(entry)) != 0) {
-				xbps_dbg_printf(xhp,
-				    "%s: failed "
-				    "to set perms %s to %s: %s\n",
-				    pkgver, archive_entry_strmode(entry),
-				    entry_pname,
-				    strerror(errno));
-				rv = EINVAL;
-				goto out;
-			}
-			xbps_dbg_printf(xhp, "%s: entry %s changed file "
-			    "mode to %s.\n", pkgver, entry_pname,
-			    archive_entry_strmode(entry));
-		}
-		/*
-		 * Check if current file mtime differs from archive entry
-		 * in binpkg and apply mtime if true.
-		 */
-		if (!force && file_exists && skip_extract &&
-		    (archive_entry_mtime_nsec(entry) != st.st_mtime)) {
-			struct timespec ts[2];
-
-			ts[0].tv_sec = archive_entry_atime(entry);
-			ts[0].tv_nsec = archive_entry_atime_nsec(entry);
-			ts[1].tv_sec = archive_entry_mtime(entry);
-			ts[1].tv_nsec = archive_entry_mtime_nsec(entry);
-
-			if (utimensat(AT_FDCWD, entry_pname, ts,
-				      AT_SYMLINK_NOFOLLOW) == -1) {
-				xbps_dbg_printf(xhp,
-				    "%s: failed "
-				    "to set mtime %lu to %s: %s\n",
-				    pkgver, archive_entry_mtime_nsec(entry),
-				    entry_pname,
-				    strerror(errno));
-				rv = EINVAL;
-				goto out;
-			}
-			xbps_dbg_printf(xhp, "%s: updated file timestamps to %s\n",
-			    pkgver, entry_pname);
-		}
-		if (!force && skip_extract) {
-			archive_read_data_skip(ar);
-			continue;
-		}
-		/*
-		 * Reset entry_pname again because if entry's pathname
-		 * has been changed it will become a dangling pointer.
-		 */
-		entry_pname = archive_entry_pathname(entry);
-		/*
-		 * Extract entry from archive.
-		 */
-		if (archive_read_extract(ar, entry, flags) != 0) {
-			error = archive_errno(ar);
-			xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL,
-			    error, pkgver,
-			    "%s: [unpack] failed to extract file `%s': %s",
-			    pkgver, entry_pname, strerror(error));
-			break;
-		} else {
-			if (xhp->unpack_cb != NULL) {
-				xucd.entry = entry_pname;
-				xucd.entry_extract_count++;
-				(*xhp->unpack_cb)(&xucd, xhp->unpack_cb_data);
-			}
-		}
+		ctx.xucd.xhp = xhp;
+		ctx.xucd.pkgver = pkgver;
+		array = xbps_dictionary_get(binpkg_filesd, "files");
+		ctx.xucd.entry_total_count += (ssize_t)xbps_array_count(array);
+		array = xbps_dictionary_get(binpkg_filesd, "conf_files");
+		ctx.xucd.entry_total_count += (ssize_t)xbps_array_count(array);
+		array = xbps_dictionary_get(binpkg_filesd, "links");
+		ctx.xucd.entry_total_count += (ssize_t)xbps_array_count(array);
 	}
-	/*
-	 * If there was any error extracting files from archive, error out.
-	 */
-	if (error || ar_rv == ARCHIVE_FATAL) {
-		rv = error;
-		if (!rv)
-			rv = ar_rv;
-		xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL, rv, pkgver,
-		    "%s: [unpack] failed to extract files: %s",
-		    pkgver, strerror(rv));
+	rv = extract_files(&ctx, ar, nworkers);
+	xbps_object_release(ctx.binfiles);
+	xbps_object_release(ctx.instfiles);
+	if (rv != 0)
 		goto out;
-	}
 	/*
 	 * Externalize binpkg files.plist to disk, if not empty.
 	 */
 	if (xbps_dictionary_count(binpkg_filesd)) {
-		mode_t prev_umask;
-		prev_umask = umask(022);
+		/*
+		 * With XBPS_FLAG_DURABLE it's synced at once with all
+		 * unpacked files in the transaction.
+		 */
 		buf = xbps_xasprintf("%s/.%s-files.plist", xhp->metadir, pkgname);
-		if (!xbps_dictionary_externalize_to_file(binpkg_filesd, buf)) {
-			rv = errno;
-			umask(prev_umask);
-			free(buf);
+		rv = xbps_plist_write_file(binpkg_filesd, buf, 0644,
+		    !(xhp->flags & XBPS_FLAG_DURABLE));
+		free(buf);
+		if (rv != 0) {
 			xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL,
 			    rv, pkgver, "%s: [unpack] failed to externalize pkg "
 			    "pkg metadata files: %s", pkgver, strerror(rv));
 			goto out;
 		}
-		umask(prev_umask);
-		free(buf);
 	}
 out:
 	/*
@@ -549,13 +1287,21 @@ out:
 	return rv;
 }
 
+/*
+ * Unpack a binary package. If `turn' is set, packages are being unpacked
+ * concurrently and `pos' is the position of this package in the
+ * transaction, see struct xbps_unpack_turn.
+ */
 int HIDDEN
-xbps_unpack_binary_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
+xbps_unpack_binary_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod,
+		struct xbps_unpack_turn *turn, unsigned int pos)
 {
 	struct archive *ar = NULL;
 	struct stat st;
 	const char *pkgver;
 	char *bpkg = NULL;
+	long ncpus;
+	unsigned int nworkers = 0;
 	int pkg_fd = -1, rv = 0;
 	mode_t myumask;
 
@@ -570,11 +1316,14 @@ xbps_unpack_binary_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
 		    errno, pkgver,
 		    "%s: [unpack] cannot determine binary package "
 		    "file for `%s': %s", pkgver, bpkg, strerror(errno));
-		return errno;
+		rv = errno;
+		turn_pass(turn, pos, true);
+		return rv;
 	}
 
 	if ((ar = archive_read_new()) == NULL) {
 		free(bpkg);
+		turn_pass(turn, pos, true);
 		return ENOMEM;
 	}
 	/*
@@ -628,9 +1377,19 @@ xbps_unpack_binary_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
 		}
 	}
 	/*
-	 * Extract archive files.
+	 * Extract archive files, big packages are extracted by
+	 * multiple threads.
 	 */
-	if ((rv = unpack_archive(xhp, pkg_repod, pkgver, bpkg, ar)) != 0) {
+	if (st.st_size >= UNPACK_PIPELINE_MINSIZE) {
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nworkers = ncpus > UNPACK_MAXWORKERS ? UNPACK_MAXWORKERS :
+		    ncpus > 1 ? (unsigned int)ncpus : 2;
+	}
+	rv = unpack_archive(xhp, pkg_repod, pkgver, bpkg, ar, nworkers, turn, pos);
+	if (rv == ECANCELED) {
+		/* a previous package failed, this one was not unpacked */
+		goto out;
+	} else if (rv != 0) {
 		xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL, rv, pkgver,
 		    "%s: [unpack] failed to unpack files from archive: %s",
 		    pkgver, strerror(rv));
@@ -646,15 +1405,8 @@ xbps_unpack_binary_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
 		    "%s: [unpack] failed to set state to unpacked: %s",
 		    pkgver, strerror(rv));
 	}
-	/* register alternatives */
-	if ((rv = xbps_alternatives_register(xhp, pkg_repod)) != 0) {
-		xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL,
-		    rv, pkgver,
-		    "%s: [unpack] failed to register alternatives: %s",
-		    pkgver, strerror(rv));
-	}
-
 out:
+	turn_pass(turn, pos, rv != 0);
 	if (pkg_fd != -1)
 		close(pkg_fd);
 	if (ar)
@@ -28,6 +28,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <pthread.h>
 
 #include "xbps_api_impl.h"
@@ -276,3 +278,47 @@ xbps_array_replace_dict_by_pattern(xbps_array_t array,
 {
 	return array_replace_dict(array, dict, pattern, true);
 }
+
+/*
+ * Externalizes a dictionary to `path' atomically with `mode' permissions.
+ * Unlike xbps_dictionary_externalize_to_file() it does not change the
+ * process umask, and data is only synced to disk if `sync' is set.
+ */
+int HIDDEN
+xbps_plist_write_file(xbps_dictionary_t d, const char *path,
+		mode_t mode, bool sync)
+{
+	char *xml, *tname;
+	size_t len;
+	int fd, rv = 0;
+
+	if ((xml = xbps_dictionary_externalize(d)) == NULL)
+		return errno ? errno : EINVAL;
+
+	tname = xbps_xasprintf("%s.XXXXXX", path);
+	if ((fd = mkstemp(tname)) == -1) {
+		rv = errno;
+		goto out;
+	}
+	len = strlen(xml);
+	if (write(fd, xml, len) != (ssize_t)len)
+		rv = errno ? errno : EIO;
+#ifdef HAVE_FDATASYNC
+	else if (sync && fdatasync(fd) == -1)
+#else
+	else if (sync && fsync(fd) == -1)
+#endif
+		rv = errno;
+	else if (fchmod(fd, mode) == -1)
+		rv = errno;
+
+	(void)close(fd);
+	if (rv == 0 && rename(tname, path) == -1)
+		rv = errno;
+	if (rv != 0)
+		(void)unlink(tname);
+out:
+	free(tname);
+	free(xml);
+	return rv;
+}
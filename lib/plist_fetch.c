@@ -26,10 +26,13 @@
  * From: $NetBSD: pkg_io.c,v 1.9 2009/08/16 21:10:15 joerg Exp $
  */
 
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "xbps_api_impl.h"
 
@@ -144,8 +147,208 @@ open_archive(const char *url)
 	return a;
 }
 
-char *
-xbps_archive_fetch_file(const char *url, const char *fname)
+/*
+ * Seekable packages end with an index of the zstd frame every member
+ * is stored in (see xbps-create(1) --seekable); a member is read by
+ * fetching and decompressing just its frame, with pread(2) or an
+ * HTTP range request. The index is only a hint: if the decoded frame
+ * doesn't start with the member the index lists for it, or doesn't
+ * contain fname, NULL is returned and the whole stream is read.
+ */
+struct seek_src {
+	struct url *url;
+	int fd;
+};
+
+static ssize_t
+seek_src_read(struct seek_src *src, off_t off, void *buf, size_t len)
+{
+	struct fetchIO *f;
+	size_t done = 0;
+	ssize_t r;
+
+	if (src->url == NULL) {
+		while (done < len) {
+			r = pread(src->fd, (char *)buf + done, len - done,
+			    off + (off_t)done);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r <= 0)
+				return -1;
+			done += (size_t)r;
+		}
+		return (ssize_t)done;
+	}
+
+	src->url->offset = off;
+	src->url->length = (off_t)len;
+	if ((f = fetchGet(src->url, NULL)) == NULL)
+		return -1;
+	/* the server must honor the range */
+	if (src->url->offset != off) {
+		fetchIO_close(f);
+		return -1;
+	}
+	while (done < len) {
+		if ((r = fetchIO_read(f, (char *)buf + done, len - done)) <= 0)
+			break;
+		done += (size_t)r;
+	}
+	fetchIO_close(f);
+
+	return done == len ? (ssize_t)len : -1;
+}
+
+static uint32_t
+le32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+	    (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static char *
+seek_fetch_file(const char *url, const char *fname)
+{
+	struct seek_src src = { .url = NULL, .fd = -1 };
+	struct url_stat ust;
+	struct archive *a = NULL;
+	struct archive_entry *entry;
+	unsigned char *tail = NULL, *frame = NULL;
+	char *buf = NULL, *idx = NULL, *line, *name, *endp, *saveptr;
+	char *first = NULL;
+	uint64_t start = 0, end = 0, o;
+	off_t size;
+	size_t n, ilen;
+	bool found = false;
+
+	if (xbps_repository_is_remote(url)) {
+		if ((src.url = fetchParseURL(url)) == NULL)
+			return NULL;
+		if (fetchStat(src.url, &ust, NULL) == -1 || ust.size <= 0)
+			goto out;
+		size = ust.size;
+	} else {
+		struct stat st;
+
+		if ((src.fd = open(url, O_RDONLY|O_CLOEXEC)) == -1)
+			return NULL;
+		if (fstat(src.fd, &st) == -1)
+			goto out;
+		size = st.st_size;
+	}
+	if (size < 20)
+		goto out;
+
+	/* the whole index frame is usually in the last 16KB */
+	n = size < 16384 ? (size_t)size : 16384;
+	for (;;) {
+		free(tail);
+		if ((tail = malloc(n)) == NULL)
+			goto out;
+		if (seek_src_read(&src, size - (off_t)n, tail, n) == -1)
+			goto out;
+		if (memcmp(tail + n - 8, XBPS_SEEK_MAGIC, 8))
+			goto out;
+		ilen = le32(tail + n - 12);
+		if ((off_t)ilen + 20 > size)
+			goto out;
+		if (ilen + 20 <= n)
+			break;
+		n = ilen + 20;
+	}
+	/* skippable frame header */
+	if (le32(tail + n - ilen - 20) != XBPS_SEEK_FRAME_MAGIC ||
+	    le32(tail + n - ilen - 16) != ilen + 12)
+		goto out;
+	if ((idx = malloc(ilen + 1)) == NULL)
+		goto out;
+	memcpy(idx, tail + n - ilen - 12, ilen);
+	idx[ilen] = '\0';
+
+	/*
+	 * Find the frame of fname; it ends where the next frame, or
+	 * the index frame, starts.
+	 */
+	end = (uint64_t)size - ilen - 20;
+	for (line = strtok_r(idx, "\n", &saveptr); line;
+	    line = strtok_r(NULL, "\n", &saveptr)) {
+		o = strtoull(line, &endp, 10);
+		if (*endp != ' ' || o >= (uint64_t)size - ilen - 20)
+			goto out;
+		name = endp + 1;
+		if (name[0] == '.')
+			name++;
+		if (!found && strcmp(name, fname) == 0) {
+			found = true;
+			start = o;
+		}
+		if (found && o > start && o < end)
+			end = o;
+	}
+	if (!found || end <= start)
+		goto out;
+	/* the first member stored in that frame */
+	for (line = idx; line < idx + ilen; line += strlen(line) + 1) {
+		if (strtoull(line, &endp, 10) == start) {
+			first = endp + 1;
+			if (first[0] == '.')
+				first++;
+			break;
+		}
+	}
+	if (first == NULL)
+		goto out;
+
+	n = end - start;
+	if ((frame = malloc(n)) == NULL)
+		goto out;
+	if (seek_src_read(&src, (off_t)start, frame, n) == -1)
+		goto out;
+
+	if ((a = archive_read_new()) == NULL)
+		goto out;
+	archive_read_support_filter_zstd(a);
+	archive_read_support_format_tar(a);
+	if (archive_read_open_memory(a, frame, n) != ARCHIVE_OK)
+		goto out;
+	while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+		name = __UNCONST(archive_entry_pathname(entry));
+		if (name[0] == '.')
+			name++;
+		if (first != NULL) {
+			/* the index doesn't match the frame */
+			if (strcmp(name, first))
+				break;
+			first = NULL;
+		}
+		if (strcmp(name, fname) == 0) {
+			/* hardlinks have their data in another member */
+			if (archive_entry_hardlink(entry) == NULL)
+				buf = xbps_archive_get_file(a, entry);
+			break;
+		}
+		archive_read_data_skip(a);
+	}
+out:
+	if (a != NULL)
+		archive_read_finish(a);
+	if (src.url != NULL)
+		fetchFreeURL(src.url);
+	if (src.fd != -1)
+		close(src.fd);
+	free(frame);
+	free(idx);
+	free(tail);
+	return buf;
+}
+
+/*
+ * Remote packages are only looked up by their index if the repository
+ * marks them seekable, otherwise it would cost two more requests for
+ * every package.
+ */
+static char *
+archive_fetch_file(const char *url, const char *fname, bool seekable)
 {
 	struct archive *a;
 	struct archive_entry *entry;
@@ -154,6 +357,10 @@ xbps_archive_fetch_file(const char *url, const char *fname)
 	assert(url);
 	assert(fname);
 
+	if ((seekable || !xbps_repository_is_remote(url)) &&
+	    (buf = seek_fetch_file(url, fname)) != NULL)
+		return buf;
+
 	if ((a = open_archive(url)) == NULL)
 		return NULL;
 
@@ -175,6 +382,12 @@ xbps_archive_fetch_file(const char *url, const char *fname)
 	return buf;
 }
 
+char *
+xbps_archive_fetch_file(const char *url, const char *fname)
+{
+	return archive_fetch_file(url, fname, false);
+}
+
 bool
 xbps_repo_fetch_remote(struct xbps_repo *repo, const char *url)
 {
@@ -258,16 +471,32 @@ xbps_archive_fetch_file_into_fd(const char *url, const char *fname, int fd)
 	return rv;
 }
 
-xbps_dictionary_t
-xbps_archive_fetch_plist(const char *url, const char *plistf)
+static xbps_dictionary_t
+archive_fetch_plist(const char *url, const char *plistf, bool seekable)
 {
 	xbps_dictionary_t d;
 	char *buf;
 
-	if ((buf = xbps_archive_fetch_file(url, plistf)) == NULL)
+	if ((buf = archive_fetch_file(url, plistf, seekable)) == NULL)
 		return NULL;
 
 	d = xbps_dictionary_internalize(buf);
 	free(buf);
 	return d;
 }
+
+xbps_dictionary_t
+xbps_archive_fetch_plist(const char *url, const char *plistf)
+{
+	return archive_fetch_plist(url, plistf, false);
+}
+
+xbps_dictionary_t HIDDEN
+xbps_archive_fetch_pkg_plist(xbps_dictionary_t pkgd, const char *url,
+		const char *plistf)
+{
+	bool seekable = false;
+
+	xbps_dictionary_get_bool(pkgd, "seekable", &seekable);
+	return archive_fetch_plist(url, plistf, seekable);
+}
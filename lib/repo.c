@@ -258,6 +258,36 @@ out:
 	return NULL;
 }
 
+static bool
+repo_store_mirrors(struct xbps_handle *xhp, const char *repos)
+{
+	char *buf, *repo, *mirror, *last = NULL;
+	bool rv;
+
+	buf = strdup(repos);
+	assert(buf);
+	repo = strtok_r(buf, " \t", &last);
+	if (repo == NULL) {
+		free(buf);
+		return false;
+	}
+	rv = xbps_repo_store(xhp, repo);
+	while ((mirror = strtok_r(NULL, " \t", &last)) != NULL) {
+		if (!xbps_repository_is_remote(repo) ||
+		    !xbps_repository_is_remote(mirror)) {
+			xbps_dbg_printf(xhp, "[repo] ignoring mirror `%s' of "
+			    "`%s', only remote mirrors are supported\n",
+			    mirror, repo);
+			continue;
+		}
+		xbps_repo_mirror_add(xhp, repo, mirror);
+		rv = true;
+	}
+	free(buf);
+
+	return rv;
+}
+
 bool
 xbps_repo_store(struct xbps_handle *xhp, const char *repo)
 {
@@ -266,6 +296,13 @@ xbps_repo_store(struct xbps_handle *xhp, const char *repo)
 	assert(xhp);
 	assert(repo);
 
+	/*
+	 * Several equivalent mirrors separated by blanks, the first one
+	 * identifies the repository.
+	 */
+	if (strpbrk(repo, " \t"))
+		return repo_store_mirrors(xhp, repo);
+
 	if (xhp->repositories == NULL) {
 		xhp->repositories = xbps_array_create();
 		assert(xhp->repositories);
@@ -442,7 +479,7 @@ xbps_repo_get_pkg_plist(struct xbps_handle *xhp, xbps_dictionary_t pkgd,
 	if (url == NULL)
 		return NULL;
 
-	bpkgd = xbps_archive_fetch_plist(url, plist);
+	bpkgd = xbps_archive_fetch_pkg_plist(pkgd, url, plist);
 	free(url);
 	return bpkgd;
 }
@@ -0,0 +1,448 @@
+/*-
+ * Copyright (c) 2026 agent <agent@local>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "xbps_api_impl.h"
+#include "fetch.h"
+
+/*
+ * Repository mirrors.
+ *
+ * A repository entry can list several equivalent URLs separated by
+ * blanks. The first one identifies the repository (local repodata,
+ * pkgdb "repository" object), and files are fetched from the mirrors in
+ * ranking order, failing over to the next mirror on errors.
+ *
+ * Mirrors are ranked by probing them when the repository is synchronized:
+ * the time to connect and fetch the first bytes of the repodata file.
+ * The ranking is stored in <cachedir>/mirrors.plist for later invocations.
+ *
+ * Probes have their own connect and read timeout, and mirrors are ranked
+ * once all probes finished or MIRROR_PROBE_TIMEOUT passed; the mirrors
+ * whose probe did not finish are ranked as unreachable, without waiting
+ * for them.
+ */
+#define MIRRORS_PLIST		"mirrors.plist"
+#define MIRROR_PROBE_SIZE	4096
+#define MIRROR_PROBE_TIMEOUT	3	/* seconds */
+
+struct mirror_probe {
+	struct mirror_probes *set;
+	const char *mirror;
+	char *uri;
+	double elapsed;
+	bool ok;
+	bool done;
+};
+
+/*
+ * Shared by the caller and the probe threads, freed by the last one
+ * that releases it.
+ */
+struct mirror_probes {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	unsigned int refs;
+	unsigned int pending;
+	struct mirror_probe *probes;
+};
+
+static pthread_mutex_t mirror_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+void HIDDEN
+xbps_repo_mirror_add(struct xbps_handle *xhp, const char *repo,
+    const char *mirror)
+{
+	xbps_array_t array;
+
+	if (xhp->mirrors == NULL) {
+		xhp->mirrors = xbps_dictionary_create();
+		assert(xhp->mirrors);
+	}
+	if ((array = xbps_dictionary_get(xhp->mirrors, repo)) == NULL) {
+		array = xbps_array_create();
+		assert(array);
+		xbps_array_add_cstring(array, repo);
+		xbps_dictionary_set(xhp->mirrors, repo, array);
+		xbps_object_release(array);
+	}
+	if (!xbps_match_string_in_array(array, mirror)) {
+		xbps_array_add_cstring(array, mirror);
+		xbps_dbg_printf(xhp, "[repo] `%s' mirror `%s' stored\n",
+		    repo, mirror);
+	}
+}
+
+/*
+ * Returns the mirrors array for the repository that contains uri,
+ * and the length of the repository URL prefix in uri.
+ */
+static xbps_array_t
+mirror_array(struct xbps_handle *xhp, const char *uri, size_t *prefixlen)
+{
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	xbps_array_t array = NULL;
+	const char *repo;
+	size_t len;
+
+	if (xhp->mirrors == NULL)
+		return NULL;
+
+	iter = xbps_dictionary_iterator(xhp->mirrors);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		repo = xbps_dictionary_keysym_cstring_nocopy(obj);
+		len = strlen(repo);
+		if (strncmp(uri, repo, len) == 0 &&
+		    (uri[len] == '/' || uri[len] == '\0')) {
+			array = xbps_dictionary_get_keysym(xhp->mirrors, obj);
+			if (prefixlen)
+				*prefixlen = len;
+			break;
+		}
+	}
+	xbps_object_iterator_release(iter);
+
+	return array;
+}
+
+xbps_array_t HIDDEN
+xbps_repo_mirrors(struct xbps_handle *xhp, const char *uri, size_t *prefixlen)
+{
+	xbps_array_t array, copy = NULL;
+
+	pthread_mutex_lock(&mirror_mtx);
+	array = mirror_array(xhp, uri, prefixlen);
+	if (array != NULL && xbps_array_count(array) > 1)
+		copy = xbps_array_copy(array);
+	pthread_mutex_unlock(&mirror_mtx);
+
+	return copy;
+}
+
+static void
+ranking_save(struct xbps_handle *xhp)
+{
+	xbps_dictionary_t d;
+	char *path;
+
+	if (xbps_mkpath(xhp->cachedir, 0755) == -1 && errno != EEXIST) {
+		xbps_dbg_printf(xhp, "[repo] failed to create cachedir %s: %s\n",
+		    xhp->cachedir, strerror(errno));
+		return;
+	}
+	path = xbps_xasprintf("%s/%s", xhp->cachedir, MIRRORS_PLIST);
+	if ((d = xbps_dictionary_internalize_from_file(path)) == NULL) {
+		d = xbps_dictionary_copy_mutable(xhp->mirrors);
+	} else {
+		xbps_object_iterator_t iter;
+		xbps_object_t obj;
+
+		iter = xbps_dictionary_iterator(xhp->mirrors);
+		assert(iter);
+		while ((obj = xbps_object_iterator_next(iter))) {
+			xbps_dictionary_set_keysym(d, obj,
+			    xbps_dictionary_get_keysym(xhp->mirrors, obj));
+		}
+		xbps_object_iterator_release(iter);
+	}
+	if (d == NULL || !xbps_dictionary_externalize_to_file(d, path))
+		xbps_dbg_printf(xhp, "[repo] failed to write mirror ranking "
+		    "to %s: %s\n", path, strerror(errno));
+	if (d != NULL)
+		xbps_object_release(d);
+	free(path);
+}
+
+void HIDDEN
+xbps_repo_mirrors_init(struct xbps_handle *xhp)
+{
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	xbps_dictionary_t d;
+	xbps_array_t ranked, array, sorted;
+	const char *mirror;
+	char *path;
+
+	if (xhp->mirrors == NULL)
+		return;
+
+	path = xbps_xasprintf("%s/%s", xhp->cachedir, MIRRORS_PLIST);
+	d = xbps_dictionary_internalize_from_file(path);
+	free(path);
+	if (d == NULL)
+		return;
+
+	/*
+	 * Sort configured mirrors by the stored ranking, mirrors not
+	 * ranked yet keep their configuration order after the rest.
+	 */
+	iter = xbps_dictionary_iterator(xhp->mirrors);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		array = xbps_dictionary_get_keysym(xhp->mirrors, obj);
+		ranked = xbps_dictionary_get_keysym(d, obj);
+		if (ranked == NULL)
+			continue;
+		sorted = xbps_array_create();
+		assert(sorted);
+		for (unsigned int i = 0; i < xbps_array_count(ranked); i++) {
+			xbps_array_get_cstring_nocopy(ranked, i, &mirror);
+			if (xbps_match_string_in_array(array, mirror) &&
+			    !xbps_match_string_in_array(sorted, mirror))
+				xbps_array_add_cstring(sorted, mirror);
+		}
+		for (unsigned int i = 0; i < xbps_array_count(array); i++) {
+			xbps_array_get_cstring_nocopy(array, i, &mirror);
+			if (!xbps_match_string_in_array(sorted, mirror))
+				xbps_array_add_cstring(sorted, mirror);
+		}
+		xbps_dictionary_set_keysym(xhp->mirrors, obj, sorted);
+		xbps_object_release(sorted);
+	}
+	xbps_object_iterator_release(iter);
+	xbps_object_release(d);
+}
+
+/*
+ * Move a mirror that failed to the end of the ranking.
+ */
+void HIDDEN
+xbps_repo_mirror_failed(struct xbps_handle *xhp, const char *uri,
+    const char *mirror)
+{
+	xbps_array_t array;
+	const char *str;
+	unsigned int i, cnt;
+
+	pthread_mutex_lock(&mirror_mtx);
+	if ((array = mirror_array(xhp, uri, NULL)) == NULL) {
+		pthread_mutex_unlock(&mirror_mtx);
+		return;
+	}
+	cnt = xbps_array_count(array);
+	for (i = 0; i < cnt - 1; i++) {
+		xbps_array_get_cstring_nocopy(array, i, &str);
+		if (strcmp(str, mirror) == 0)
+			break;
+	}
+	if (i < cnt - 1) {
+		xbps_array_remove(array, i);
+		xbps_array_add_cstring(array, mirror);
+		ranking_save(xhp);
+	}
+	pthread_mutex_unlock(&mirror_mtx);
+}
+
+static void
+probes_release(struct mirror_probes *set)
+{
+	bool last;
+
+	last = (--set->refs == 0);
+	pthread_mutex_unlock(&set->mtx);
+	if (!last)
+		return;
+
+	pthread_cond_destroy(&set->cond);
+	pthread_mutex_destroy(&set->mtx);
+	free(set->probes);
+	free(set);
+}
+
+static void *
+probe_thread(void *arg)
+{
+	struct mirror_probe *p = arg;
+	struct mirror_probes *set = p->set;
+	struct timespec ts, te;
+	struct url *url;
+	fetchIO *fio;
+	char buf[MIRROR_PROBE_SIZE];
+	double elapsed = 0;
+	ssize_t rd = 0;
+	bool ok = false;
+
+	if ((url = fetchParseURL(p->uri)) != NULL) {
+		url->length = MIRROR_PROBE_SIZE;
+		url->timeout = MIRROR_PROBE_TIMEOUT * 1000;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if ((fio = fetchGet(url, "")) != NULL) {
+			while ((rd = fetchIO_read(fio, buf, sizeof(buf))) > 0)
+				;
+			fetchIO_close(fio);
+			clock_gettime(CLOCK_MONOTONIC, &te);
+			elapsed = (te.tv_sec - ts.tv_sec) +
+			    (te.tv_nsec - ts.tv_nsec) / 1e9;
+			ok = (rd == 0);
+		}
+		fetchFreeURL(url);
+	}
+	free(p->uri);
+
+	pthread_mutex_lock(&set->mtx);
+	p->elapsed = elapsed;
+	p->ok = ok;
+	p->done = true;
+	set->pending--;
+	pthread_cond_signal(&set->cond);
+	probes_release(set);
+
+	return NULL;
+}
+
+/*
+ * Start a detached thread for every mirror, and copy into probes the
+ * results of those that finished before the deadline. Returns the
+ * number of started probes, the rest were not probed.
+ */
+static unsigned int
+probes_run(struct mirror_probe *probes, unsigned int cnt)
+{
+	struct mirror_probes *set;
+	pthread_condattr_t attr;
+	pthread_t thread;
+	struct timespec deadline;
+	unsigned int n;
+
+	set = calloc(1, sizeof(*set));
+	assert(set);
+	set->probes = calloc(cnt, sizeof(*set->probes));
+	assert(set->probes);
+	pthread_mutex_init(&set->mtx, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&set->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	set->refs = 1;
+
+	pthread_mutex_lock(&set->mtx);
+	for (n = 0; n < cnt; n++) {
+		set->probes[n] = probes[n];
+		set->probes[n].set = set;
+		if (pthread_create(&thread, NULL, probe_thread,
+		    &set->probes[n]) != 0)
+			break;
+		pthread_detach(thread);
+		set->refs++;
+		set->pending++;
+	}
+	for (unsigned int i = n; i < cnt; i++)
+		free(probes[i].uri);
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += MIRROR_PROBE_TIMEOUT;
+	while (set->pending) {
+		if (pthread_cond_timedwait(&set->cond, &set->mtx,
+		    &deadline) == ETIMEDOUT)
+			break;
+	}
+	for (unsigned int i = 0; i < n; i++) {
+		probes[i].ok = set->probes[i].done && set->probes[i].ok;
+		probes[i].elapsed = set->probes[i].elapsed;
+	}
+	probes_release(set);
+
+	return n;
+}
+
+/*
+ * Probe all mirrors of the repository containing uri by fetching the
+ * first bytes of the same file, and rank them by elapsed time; mirrors
+ * that failed go last.
+ */
+void HIDDEN
+xbps_repo_mirrors_probe(struct xbps_handle *xhp, const char *uri)
+{
+	struct mirror_probe *probes, tmp;
+	xbps_array_t array, ranked;
+	size_t prefixlen = 0;
+	unsigned int i, j, cnt, n;
+	const char *mirror;
+	char *repo;
+
+	if ((array = xbps_repo_mirrors(xhp, uri, &prefixlen)) == NULL)
+		return;
+
+	cnt = xbps_array_count(array);
+	probes = calloc(cnt, sizeof(*probes));
+	assert(probes);
+	for (i = 0; i < cnt; i++) {
+		xbps_array_get_cstring_nocopy(array, i, &probes[i].mirror);
+		probes[i].uri = xbps_xasprintf("%s%s", probes[i].mirror,
+		    uri + prefixlen);
+	}
+	n = probes_run(probes, cnt);
+	for (i = 0; i < n; i++) {
+		if (probes[i].ok)
+			xbps_dbg_printf(xhp, "[repo] mirror `%s': %.3fs\n",
+			    probes[i].mirror, probes[i].elapsed);
+		else
+			xbps_dbg_printf(xhp, "[repo] mirror `%s': "
+			    "unreachable\n", probes[i].mirror);
+	}
+	/* stable sort: fastest first, unreachable mirrors last */
+	for (i = 1; i < n; i++) {
+		tmp = probes[i];
+		for (j = i; j > 0; j--) {
+			if (probes[j-1].ok &&
+			    (!tmp.ok || probes[j-1].elapsed <= tmp.elapsed))
+				break;
+			if (!probes[j-1].ok && !tmp.ok)
+				break;
+			probes[j] = probes[j-1];
+		}
+		probes[j] = tmp;
+	}
+	ranked = xbps_array_create();
+	assert(ranked);
+	for (i = 0; i < n; i++)
+		xbps_array_add_cstring(ranked, probes[i].mirror);
+	for (i = n; i < cnt; i++) {
+		xbps_array_get_cstring_nocopy(array, i, &mirror);
+		xbps_array_add_cstring(ranked, mirror);
+	}
+	repo = strndup(uri, prefixlen);
+	assert(repo);
+
+	pthread_mutex_lock(&mirror_mtx);
+	xbps_dictionary_set(xhp->mirrors, repo, ranked);
+	ranking_save(xhp);
+	pthread_mutex_unlock(&mirror_mtx);
+
+	xbps_object_release(ranked);
+	xbps_object_release(array);
+	free(probes);
+	free(repo);
+}
@@ -113,29 +113,24 @@ out:
 	return rv;
 }
 
-#define MAX_DEPTH	512
-
 static int
 find_repo_deps(struct xbps_handle *xhp,
 	       xbps_array_t unsorted,		/* array of unsorted deps */
+	       xbps_array_t queue,		/* pkgs with pending rundeps */
 	       xbps_array_t pkg_rdeps_array,	/* current pkg rundeps array  */
 	       xbps_array_t pkg_provides,	/* current pkg provides array */
-	       const char *curpkg,		/* current pkgver */
-	       unsigned short *depth)		/* max recursion depth */
+	       const char *curpkg)		/* current pkgver */
 {
 	xbps_dictionary_t curpkgd = NULL;
 	xbps_object_t obj;
 	xbps_object_iterator_t iter;
-	xbps_array_t curpkgrdeps = NULL, curpkgprovides = NULL;
+	xbps_array_t curpkgrdeps = NULL;
 	pkg_state_t state;
 	const char *reqpkg, *pkgver_q, *reason = NULL;
 	char *pkgname, *reqpkgname;
 	int rv = 0;
 	bool foundvpkg;
 
-	if (*depth >= MAX_DEPTH)
-		return ELOOP;
-
 	/*
 	 * Iterate over the list of required run dependencies for
 	 * current package.
@@ -146,13 +141,7 @@ find_repo_deps(struct xbps_handle *xhp,
 	while ((obj = xbps_object_iterator_next(iter))) {
 		foundvpkg = false;
 		reqpkg = xbps_string_cstring_nocopy(obj);
-		if (xhp->flags & XBPS_FLAG_DEBUG) {
-			xbps_dbg_printf(xhp, "%s", "");
-			for (unsigned short x = 0; x < *depth; x++) {
-				xbps_dbg_printf_append(xhp, " ");
-			}
-			xbps_dbg_printf_append(xhp, "%s: requires dependency '%s': ", curpkg ? curpkg : " ", reqpkg);
-		}
+		xbps_dbg_printf(xhp, " %s: requires dependency '%s': ", curpkg ? curpkg : " ", reqpkg);
 		if (((pkgname = xbps_pkgpattern_name(reqpkg)) == NULL) &&
 		    ((pkgname = xbps_pkg_name(reqpkg)) == NULL)) {
 			xbps_dbg_printf(xhp, "%s: can't guess pkgname for dependency: %s\n", curpkg, reqpkg);
@@ -182,8 +171,8 @@ find_repo_deps(struct xbps_handle *xhp,
 		 * Pass 2: check if required dependency has been already
 		 * added in the transaction dictionary.
 		 */
-		if ((curpkgd = xbps_find_pkg_in_array(unsorted, reqpkg, NULL)) ||
-		    (curpkgd = xbps_find_virtualpkg_in_array(xhp, unsorted, reqpkg, NULL))) {
+		if ((curpkgd = xbps_transaction_pkgset_get(xhp, reqpkg)) ||
+		    (curpkgd = xbps_transaction_pkgset_get_virtual(xhp, reqpkg))) {
 			xbps_dictionary_get_cstring_nocopy(curpkgd, "pkgver", &pkgver_q);
 			xbps_dbg_printf_append(xhp, " (%s queued)\n", pkgver_q);
 			free(pkgname);
@@ -335,40 +324,6 @@ find_repo_deps(struct xbps_handle *xhp,
 		}
 		free(pkgname);
 		free(reqpkgname);
-		/*
-		 * If package doesn't have rundeps, pass to the next one.
-		 */
-		curpkgrdeps = xbps_dictionary_get(curpkgd, "run_depends");
-		if (curpkgrdeps == NULL) {
-			/*
-			 * Package is on repo, add it into the transaction dictionary.
-			 */
-			xbps_dictionary_set_cstring_nocopy(curpkgd, "transaction", reason);
-			rv = xbps_transaction_store(xhp, unsorted, curpkgd, reason, true);
-			if (rv != 0) {
-				xbps_dbg_printf(xhp, "xbps_transaction_store failed for `%s': %s\n", reqpkg, strerror(rv));
-				break;
-			}
-			continue;
-		}
-
-		if (xhp->flags & XBPS_FLAG_DEBUG) {
-			xbps_dbg_printf(xhp, "%s", "");
-			for (unsigned short x = 0; x < *depth; x++) {
-				xbps_dbg_printf_append(xhp, " ");
-			}
-			xbps_dbg_printf_append(xhp, "%s: finding dependencies:\n", pkgver_q);
-		}
-		/*
-		 * Recursively find rundeps for current pkg dictionary.
-		 */
-		(*depth)++;
-		curpkgprovides = xbps_dictionary_get(curpkgd, "provides");
-		rv = find_repo_deps(xhp, unsorted, curpkgrdeps, curpkgprovides, pkgver_q, depth);
-		if (rv != 0) {
-			xbps_dbg_printf(xhp, "Error checking %s for rundeps: %s\n", reqpkg, strerror(rv));
-			break;
-		}
 		/*
 		 * Package is on repo, add it into the transaction dictionary.
 		 */
@@ -378,9 +333,16 @@ find_repo_deps(struct xbps_handle *xhp,
 			xbps_dbg_printf(xhp, "xbps_transaction_store failed for `%s': %s\n", reqpkg, strerror(rv));
 			break;
 		}
+		/*
+		 * If package has rundeps, queue it to find them later.
+		 */
+		curpkgrdeps = xbps_dictionary_get(curpkgd, "run_depends");
+		if (xbps_array_count(curpkgrdeps) && !xbps_array_add(queue, curpkgd)) {
+			rv = ENOMEM;
+			break;
+		}
 	}
 	xbps_object_iterator_release(iter);
-	(*depth)--;
 
 	return rv;
 }
@@ -390,20 +352,38 @@ xbps_repository_find_deps(struct xbps_handle *xhp,
 			  xbps_array_t unsorted,
 			  xbps_dictionary_t repo_pkgd)
 {
-	xbps_array_t pkg_rdeps, pkg_provides = NULL;
-	const char *pkgver;
-	unsigned short depth = 0;
+	xbps_array_t queue;
+	int rv = 0;
 
-	pkg_rdeps = xbps_dictionary_get(repo_pkgd, "run_depends");
-	if (xbps_array_count(pkg_rdeps) == 0)
+	if (xbps_array_count(xbps_dictionary_get(repo_pkgd, "run_depends")) == 0)
 		return 0;
 
-	xbps_dictionary_get_cstring_nocopy(repo_pkgd, "pkgver", &pkgver);
-	xbps_dbg_printf(xhp, "Finding required dependencies for '%s':\n", pkgver);
+	if ((queue = xbps_array_create()) == NULL)
+		return ENOMEM;
 	/*
 	 * This will find direct and indirect deps, if any of them is not
 	 * there it will be added into the missing_deps array.
+	 *
+	 * Dependencies are queued in the transaction before its own
+	 * dependencies are found, so that cyclic dependencies are resolved;
+	 * the transaction is sorted later by xbps_transaction_prepare().
 	 */
-	pkg_provides = xbps_dictionary_get(repo_pkgd, "provides");
-	return find_repo_deps(xhp, unsorted, pkg_rdeps, pkg_provides, pkgver, &depth);
+	xbps_array_add(queue, repo_pkgd);
+	for (unsigned int i = 0; i < xbps_array_count(queue); i++) {
+		xbps_dictionary_t pkgd;
+		xbps_array_t pkg_rdeps, pkg_provides;
+		const char *pkgver = NULL;
+
+		pkgd = xbps_array_get(queue, i);
+		pkg_rdeps = xbps_dictionary_get(pkgd, "run_depends");
+		pkg_provides = xbps_dictionary_get(pkgd, "provides");
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+		xbps_dbg_printf(xhp, "Finding required dependencies for '%s':\n", pkgver);
+		rv = find_repo_deps(xhp, unsorted, queue, pkg_rdeps, pkg_provides, pkgver);
+		if (rv != 0)
+			break;
+	}
+	xbps_object_release(queue);
+
+	return rv;
 }
@@ -131,6 +131,10 @@ xbps_repo_sync(struct xbps_handle *xhp, const char *uri)
 
 	/* reposync start cb */
 	xbps_set_cb_state(xhp, XBPS_STATE_REPOSYNC, 0, repodata, NULL);
+	/*
+	 * Rank the repository mirrors, if any.
+	 */
+	xbps_repo_mirrors_probe(xhp, repodata);
 	/*
 	 * Download plist index file from repository.
 	 */
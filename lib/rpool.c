@@ -374,7 +374,7 @@ xbps_rpool_get_pkg_plist(struct xbps_handle *xhp,
 		errno = EINVAL;
 		goto out;
 	}
-	plistd = xbps_archive_fetch_plist(url, plistf);
+	plistd = xbps_archive_fetch_pkg_plist(pkgd, url, plistf);
 	free(url);
 
 out:
@@ -23,6 +23,10 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifdef HAVE_SYNCFS
+# define _GNU_SOURCE	/* for syncfs(2) */
+#endif
+
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -32,6 +36,8 @@
 #include <unistd.h>
 #include <limits.h>
 #include <locale.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include "xbps_api_impl.h"
 
@@ -106,6 +112,9 @@ check_binpkgs(struct xbps_handle *xhp, xbps_object_iterator_t iter)
 				sigfile = xbps_xasprintf("%s.sig", binfile);
 				(void)remove(sigfile);
 				free(sigfile);
+				sigfile = xbps_xasprintf("%s.sha256", binfile);
+				(void)remove(sigfile);
+				free(sigfile);
 				free(binfile);
 				break;
 			}
@@ -203,12 +212,471 @@ download_binpkgs(struct xbps_handle *xhp, xbps_object_iterator_t iter)
 	return rv;
 }
 
+struct pkg_jobs {
+	struct xbps_handle *xhp;
+	xbps_array_t pkgs;
+	const unsigned int *idx;
+	int *rv;
+	int (*fn)(struct xbps_handle *, xbps_dictionary_t, unsigned int, void *);
+	void *arg;
+};
+
+static bool
+unpack_tract(const char *tract)
+{
+	return strcmp(tract, "remove") && strcmp(tract, "configure") &&
+	    strcmp(tract, "hold");
+}
+
+static int
+pkg_job(unsigned int i, void *arg)
+{
+	struct pkg_jobs *pj = arg;
+
+	pj->rv[i] = (*pj->fn)(pj->xhp, xbps_array_get(pj->pkgs, pj->idx[i]),
+	    i, pj->arg);
+	return pj->rv[i];
+}
+
+/*
+ * Run `fn' for a set of packages that do not depend on each other,
+ * with a thread per core unless `serial' is set; `fn' gets the
+ * position of the package in `idx' and `arg'. Once a package fails
+ * no more packages are processed, their rv is left at -1.
+ */
+static void
+run_pkgs(struct xbps_handle *xhp, xbps_array_t pkgs,
+		const unsigned int *idx, int *rv, unsigned int npkgs,
+		int (*fn)(struct xbps_handle *, xbps_dictionary_t, unsigned int, void *),
+		void *arg, bool serial)
+{
+	struct pkg_jobs pj = {
+		.xhp = xhp,
+		.pkgs = pkgs,
+		.idx = idx,
+		.rv = rv,
+		.fn = fn,
+		.arg = arg,
+	};
+
+	for (unsigned int i = 0; i < npkgs; i++)
+		rv[i] = -1;
+
+	(void)xbps_jobs_run(npkgs, serial ? 1 : 0, pkg_job, &pj);
+}
+
+static int
+unpack_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkgd,
+		unsigned int pos, void *arg)
+{
+	const char *pkgver;
+	int rv;
+
+	rv = xbps_unpack_binary_pkg(xhp, pkgd, arg, pos);
+	if (rv != 0 && rv != ECANCELED) {
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+		xbps_dbg_printf(xhp, "[trans] failed to unpack "
+		    "%s: %s\n", pkgver, strerror(rv));
+	}
+	return rv;
+}
+
+static int
+register_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkgd)
+{
+	const char *pkgver;
+	int rv;
+
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+	/* register alternatives */
+	if ((rv = xbps_alternatives_register(xhp, pkgd)) != 0) {
+		xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL,
+		    rv, pkgver,
+		    "%s: [unpack] failed to register alternatives: %s",
+		    pkgver, strerror(rv));
+		return rv;
+	}
+	/*
+	 * Register package.
+	 */
+	if ((rv = xbps_register_pkg(xhp, pkgd)) != 0) {
+		xbps_dbg_printf(xhp, "[trans] failed to register "
+		    "%s: %s\n", pkgver, strerror(rv));
+	}
+	return rv;
+}
+
+static unsigned int
+dep_level(xbps_dictionary_t levels, const char *pattern)
+{
+	char *pkgname;
+	unsigned int level = 0;
+
+	if ((pkgname = xbps_pkgpattern_name(pattern)) == NULL &&
+	    (pkgname = xbps_pkg_name(pattern)) == NULL)
+		return 0;
+
+	if (xbps_dictionary_get_uint32(levels, pkgname, &level))
+		level++;
+
+	free(pkgname);
+	return level;
+}
+
+static void
+set_level(xbps_dictionary_t levels, const char *pkgver, unsigned int level)
+{
+	char *pkgname;
+	unsigned int cur;
+
+	if ((pkgname = xbps_pkg_name(pkgver)) == NULL)
+		return;
+
+	if (!xbps_dictionary_get_uint32(levels, pkgname, &cur) || cur < level)
+		xbps_dictionary_set_uint32(levels, pkgname, level);
+
+	free(pkgname);
+}
+
+/*
+ * Assign every package in `idx' a level: one more than the highest
+ * level of its dependencies in the set, returns the highest level.
+ * Packages in the same level do not depend on each other.
+ */
+static unsigned int
+pkg_levels(xbps_array_t pkgs, const unsigned int *idx, unsigned int npkgs,
+		unsigned int *pkglevel)
+{
+	xbps_dictionary_t levels;
+	unsigned int maxlevel = 0;
+
+	levels = xbps_dictionary_create();
+	assert(levels);
+	for (unsigned int i = 0; i < npkgs; i++) {
+		xbps_dictionary_t pkgd;
+		xbps_array_t array;
+		const char *str = NULL;
+		unsigned int level = 0, dlevel;
+
+		pkgd = xbps_array_get(pkgs, idx[i]);
+		array = xbps_dictionary_get(pkgd, "run_depends");
+		for (unsigned int x = 0; x < xbps_array_count(array); x++) {
+			xbps_array_get_cstring_nocopy(array, x, &str);
+			if ((dlevel = dep_level(levels, str)) > level)
+				level = dlevel;
+		}
+		pkglevel[i] = level;
+		if (level > maxlevel)
+			maxlevel = level;
+
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &str);
+		set_level(levels, str, level);
+		array = xbps_dictionary_get(pkgd, "provides");
+		for (unsigned int x = 0; x < xbps_array_count(array); x++) {
+			xbps_array_get_cstring_nocopy(array, x, &str);
+			set_level(levels, str, level);
+		}
+	}
+	xbps_object_release(levels);
+
+	return maxlevel;
+}
+
+/*
+ * Unpack and register packages from `start' to `end' in the transaction.
+ *
+ * Levels are processed in order, so that INSTALL "pre" actions still
+ * run after all their dependencies have been unpacked, and packages
+ * in the same level are unpacked in parallel. Their INSTALL "pre"
+ * actions are executed one at a time and in transaction order, only
+ * extracting files is done concurrently. The pkgdb is only updated
+ * from this thread.
+ */
+static int
+unpack_range(struct xbps_handle *xhp, xbps_array_t pkgs,
+		unsigned int start, unsigned int end)
+{
+	struct xbps_unpack_turn turn;
+	unsigned int *pkglevel, *idx, maxlevel, npkgs = end - start;
+	int *rvs, rv = 0;
+	mode_t myumask;
+
+	pkglevel = calloc(npkgs, sizeof(*pkglevel));
+	idx = calloc(npkgs, sizeof(*idx));
+	rvs = calloc(npkgs, sizeof(*rvs));
+	assert(pkglevel && idx && rvs);
+
+	for (unsigned int i = 0; i < npkgs; i++)
+		idx[i] = start + i;
+	maxlevel = pkg_levels(pkgs, idx, npkgs, pkglevel);
+
+	/*
+	 * xbps_unpack_binary_pkg() changes the umask temporarily,
+	 * set it here once so that threads restore the same value.
+	 */
+	myumask = umask(022);
+	pthread_mutex_init(&turn.lock, NULL);
+	pthread_cond_init(&turn.cond, NULL);
+
+	for (unsigned int level = 0; level <= maxlevel; level++) {
+		unsigned int n = 0;
+
+		for (unsigned int i = 0; i < npkgs; i++) {
+			xbps_dictionary_t pkgd;
+			const char *pkgver, *tract;
+
+			if (pkglevel[i] != level)
+				continue;
+
+			pkgd = xbps_array_get(pkgs, start + i);
+			xbps_dictionary_get_cstring_nocopy(pkgd, "transaction", &tract);
+			xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+			if (strcmp(tract, "update") == 0) {
+				/*
+				 * Update a package: execute pre-remove action of
+				 * existing package before unpacking new version.
+				 */
+				xbps_set_cb_state(xhp, XBPS_STATE_UPDATE, 0, pkgver, NULL);
+				rv = xbps_remove_pkg(xhp, pkgver, true);
+				if (rv != 0) {
+					xbps_set_cb_state(xhp,
+					    XBPS_STATE_UPDATE_FAIL,
+					    rv, pkgver,
+					    "%s: [trans] failed to update "
+					    "package `%s'", pkgver,
+					    strerror(rv));
+					goto out;
+				}
+			} else {
+				/* Install a package */
+				xbps_set_cb_state(xhp, XBPS_STATE_INSTALL, 0,
+				    pkgver, NULL);
+			}
+			idx[n++] = start + i;
+		}
+		/*
+		 * Unpack binary packages. The file sets were already
+		 * verified to be disjoint by xbps_transaction_files().
+		 */
+		turn.next = 0;
+		turn.failed = false;
+		run_pkgs(xhp, pkgs, idx, rvs, n, unpack_pkg, &turn,
+		    xhp->flags & XBPS_FLAG_IGNORE_FILE_CONFLICTS);
+		/*
+		 * Register all unpacked packages in order, and return
+		 * the first error found.
+		 */
+		for (unsigned int i = 0; i < n; i++) {
+			if (rvs[i] == 0)
+				rvs[i] = register_pkg(xhp, xbps_array_get(pkgs, idx[i]));
+			if (rvs[i] != 0 && rv == 0)
+				rv = rvs[i];
+		}
+		if (rv != 0)
+			break;
+	}
+out:
+	pthread_cond_destroy(&turn.cond);
+	pthread_mutex_destroy(&turn.lock);
+	umask(myumask);
+	free(pkglevel);
+	free(idx);
+	free(rvs);
+
+	return rv;
+}
+
+static xbps_dictionary_t
+configure_pkgd(struct xbps_handle *xhp, xbps_dictionary_t pkgd)
+{
+	xbps_dictionary_t pkgdb_pkgd;
+	const char *pkgver;
+	char *pkgname;
+
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+	pkgname = xbps_pkg_name(pkgver);
+	assert(pkgname);
+	pkgdb_pkgd = xbps_pkgdb_get_pkg(xhp, pkgname);
+	free(pkgname);
+
+	return pkgdb_pkgd;
+}
+
+static int
+configure_script(struct xbps_handle *xhp, xbps_dictionary_t pkgd,
+		unsigned int pos UNUSED, void *arg UNUSED)
+{
+	const char *tract;
+
+	xbps_dictionary_get_cstring_nocopy(pkgd, "transaction", &tract);
+	return xbps_configure_pkg_script(xhp, configure_pkgd(xhp, pkgd),
+	    strcmp(tract, "update") == 0);
+}
+
+/*
+ * Configure all unpacked packages in the transaction, one by one in
+ * transaction order.
+ *
+ * With XBPS_FLAG_PARALLEL_CONFIGURE packages are configured by levels
+ * as in unpack_range(): a package is configured once its dependencies
+ * are, and the INSTALL "post" actions of packages in the same level
+ * run concurrently, with a process per core. The package state is
+ * always set from this thread, in transaction order.
+ */
+static int
+configure_pkgs(struct xbps_handle *xhp, xbps_array_t pkgs)
+{
+	xbps_dictionary_t pkgd, pkgdb_pkgd;
+	unsigned int *pkglevel, *idx, *lidx, maxlevel, npkgs = 0;
+	unsigned int cnt = xbps_array_count(pkgs);
+	const char *pkgver, *tract;
+	int *rvs, rv = 0;
+	mode_t myumask;
+	bool update;
+
+	pkglevel = calloc(cnt, sizeof(*pkglevel));
+	idx = calloc(cnt, sizeof(*idx));
+	lidx = calloc(cnt, sizeof(*lidx));
+	rvs = calloc(cnt, sizeof(*rvs));
+	assert(pkglevel && idx && lidx && rvs);
+
+	for (unsigned int i = 0; i < cnt; i++) {
+		pkgd = xbps_array_get(pkgs, i);
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+		xbps_dictionary_get_cstring_nocopy(pkgd, "transaction", &tract);
+		if (!unpack_tract(tract)) {
+			xbps_dbg_printf(xhp, "%s: skipping configuration for "
+			    "%s: %s\n", __func__, pkgver, tract);
+			continue;
+		}
+		if (configure_pkgd(xhp, pkgd) == NULL) {
+			xbps_dbg_printf(xhp, "[configure] cannot find %s "
+			    "in pkgdb\n", pkgver);
+			rv = ENOENT;
+			goto out;
+		}
+		idx[npkgs++] = i;
+	}
+	if (xhp->flags & XBPS_FLAG_PARALLEL_CONFIGURE) {
+		maxlevel = pkg_levels(pkgs, idx, npkgs, pkglevel);
+	} else {
+		/* a level per package */
+		for (unsigned int i = 0; i < npkgs; i++)
+			pkglevel[i] = i;
+		maxlevel = npkgs ? npkgs - 1 : 0;
+	}
+
+	myumask = umask(022);
+
+	for (unsigned int level = 0; level <= maxlevel && npkgs; level++) {
+		unsigned int n = 0;
+
+		for (unsigned int i = 0; i < npkgs; i++) {
+			if (pkglevel[i] == level)
+				lidx[n++] = idx[i];
+		}
+		run_pkgs(xhp, pkgs, lidx, rvs, n, configure_script, NULL, false);
+
+		for (unsigned int i = 0; i < n; i++) {
+			pkgd = xbps_array_get(pkgs, lidx[i]);
+			xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+			xbps_dictionary_get_cstring_nocopy(pkgd, "transaction", &tract);
+			update = strcmp(tract, "update") == 0;
+			pkgdb_pkgd = configure_pkgd(xhp, pkgd);
+
+			if (rvs[i] == 0)
+				rvs[i] = xbps_configure_pkg_done(xhp, pkgdb_pkgd);
+			if (rvs[i] == 0)
+				rvs[i] = xbps_cb_message(xhp, pkgdb_pkgd, "install-msg");
+			if (rvs[i] != 0) {
+				if (rv == 0) {
+					xbps_dbg_printf(xhp, "%s: configure failed for "
+					    "%s: %s\n", __func__, pkgver, strerror(rvs[i]));
+					rv = rvs[i];
+				}
+				continue;
+			}
+			/*
+			 * Notify client callback when a package has been
+			 * installed or updated.
+			 */
+			if (update) {
+				xbps_set_cb_state(xhp, XBPS_STATE_UPDATE_DONE, 0,
+				    pkgver, NULL);
+			} else {
+				xbps_set_cb_state(xhp, XBPS_STATE_INSTALL_DONE, 0,
+				    pkgver, NULL);
+			}
+		}
+		if (rv != 0)
+			break;
+	}
+	umask(myumask);
+out:
+	free(pkglevel);
+	free(idx);
+	free(lidx);
+	free(rvs);
+
+	return rv;
+}
+
+static int
+sync_dir(const char *path, bool fs)
+{
+	int fd, rv = 0;
+
+	if ((fd = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) == -1)
+		return errno;
+#ifdef HAVE_SYNCFS
+	if (fs && syncfs(fd) == -1)
+		rv = errno;
+#else
+	if (fs)
+		sync();
+#endif
+	if (!fs && fsync(fd) == -1)
+		rv = errno;
+
+	(void)close(fd);
+	return rv;
+}
+
+/*
+ * Write the pkgdb to storage. With XBPS_FLAG_DURABLE, all files
+ * unpacked so far (that were not synced) are flushed first, so that
+ * the pkgdb never references data that is not on disk yet.
+ */
+static int
+pkgdb_flush(struct xbps_handle *xhp)
+{
+	int rv;
+
+	if (xhp->flags & XBPS_FLAG_DURABLE) {
+		if ((rv = sync_dir(xhp->rootdir, true)) != 0 ||
+		    (rv = sync_dir(xhp->metadir, true)) != 0) {
+			xbps_dbg_printf(xhp, "[trans] failed to sync "
+			    "filesystem: %s\n", strerror(rv));
+			return rv;
+		}
+	}
+	if ((rv = xbps_pkgdb_update(xhp, true, true)) != 0)
+		return rv;
+
+	if (xhp->flags & XBPS_FLAG_DURABLE)
+		rv = sync_dir(xhp->metadir, false);
+
+	return rv;
+}
+
 int
 xbps_transaction_commit(struct xbps_handle *xhp)
 {
+	xbps_array_t pkgs;
 	xbps_object_t obj;
 	xbps_object_iterator_t iter;
 	const char *pkgver, *tract;
+	unsigned int cnt;
 	int rv = 0;
 	bool update;
 
@@ -295,9 +763,13 @@ xbps_transaction_commit(struct xbps_handle *xhp)
 		    xhp->rootdir, strerror(errno));
 		goto out;
 	}
-	while ((obj = xbps_object_iterator_next(iter)) != NULL) {
+	pkgs = xbps_dictionary_get(xhp->transd, "packages");
+	cnt = xbps_array_count(pkgs);
+	for (unsigned int i = 0, j; i < cnt; i = j) {
+		obj = xbps_array_get(pkgs, i);
 		xbps_dictionary_get_cstring_nocopy(obj, "transaction", &tract);
 		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+		j = i + 1;
 
 		if (strcmp(tract, "remove") == 0) {
 			/*
@@ -311,8 +783,6 @@ xbps_transaction_commit(struct xbps_handle *xhp)
 				    "remove %s: %s\n", pkgver, strerror(rv));
 				goto out;
 			}
-			continue;
-
 		} else if (strcmp(tract, "configure") == 0) {
 			/*
 			 * Reconfigure pending package.
@@ -323,49 +793,24 @@ xbps_transaction_commit(struct xbps_handle *xhp)
 				    "configure %s: %s\n", pkgver, strerror(rv));
 				goto out;
 			}
-			continue;
-
-		} else if (strcmp(tract, "update") == 0) {
-			/*
-			 * Update a package: execute pre-remove action of
-			 * existing package before unpacking new version.
-			 */
-			xbps_set_cb_state(xhp, XBPS_STATE_UPDATE, 0, pkgver, NULL);
-			rv = xbps_remove_pkg(xhp, pkgver, true);
-			if (rv != 0) {
-				xbps_set_cb_state(xhp,
-				    XBPS_STATE_UPDATE_FAIL,
-				    rv, pkgver,
-				    "%s: [trans] failed to update "
-				    "package `%s'", pkgver,
-				    strerror(rv));
-				goto out;
-			}
 		} else if (strcmp(tract, "hold") == 0) {
 			/*
 			 * Package is on hold mode, ignore it.
 			 */
 			continue;
 		} else {
-			/* Install a package */
-			xbps_set_cb_state(xhp, XBPS_STATE_INSTALL, 0,
-			    pkgver, NULL);
-		}
-		/*
-		 * Unpack binary package.
-		 */
-		if ((rv = xbps_unpack_binary_pkg(xhp, obj)) != 0) {
-			xbps_dbg_printf(xhp, "[trans] failed to unpack "
-			    "%s: %s\n", pkgver, strerror(rv));
-			goto out;
-		}
-		/*
-		 * Register package.
-		 */
-		if ((rv = xbps_register_pkg(xhp, obj)) != 0) {
-			xbps_dbg_printf(xhp, "[trans] failed to register "
-			    "%s: %s\n", pkgver, strerror(rv));
-			goto out;
+			/*
+			 * Install or update a run of packages.
+			 */
+			for (; j < cnt; j++) {
+				obj = xbps_array_get(pkgs, j);
+				xbps_dictionary_get_cstring_nocopy(obj,
+				    "transaction", &tract);
+				if (!unpack_tract(tract))
+					break;
+			}
+			if ((rv = unpack_range(xhp, pkgs, i, j)) != 0)
+				goto out;
 		}
 	}
 	/* if there are no packages to install or update we are done */
@@ -383,50 +828,27 @@ xbps_transaction_commit(struct xbps_handle *xhp)
 
 	xbps_object_iterator_reset(iter);
 	/* Force a pkgdb write for all unpacked pkgs in transaction */
-	(void)xbps_pkgdb_update(xhp, true, true);
+	(void)pkgdb_flush(xhp);
 
 	/*
 	 * Configure all unpacked packages.
 	 */
 	xbps_set_cb_state(xhp, XBPS_STATE_TRANS_CONFIGURE, 0, NULL, NULL);
 
-	while ((obj = xbps_object_iterator_next(iter)) != NULL) {
-		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
-		xbps_dictionary_get_cstring_nocopy(obj, "transaction", &tract);
-		if ((strcmp(tract, "remove") == 0) ||
-		    (strcmp(tract, "hold") == 0) ||
-		    (strcmp(tract, "configure") == 0)) {
-			xbps_dbg_printf(xhp, "%s: skipping configuration for "
-			    "%s: %s\n", __func__, pkgver, tract);
-			continue;
-		}
-		update = false;
-		if (strcmp(tract, "update") == 0)
-			update = true;
-
-		rv = xbps_configure_pkg(xhp, pkgver, false, update);
-		if (rv != 0) {
-			xbps_dbg_printf(xhp, "%s: configure failed for "
-			    "%s: %s\n", __func__, pkgver, strerror(rv));
-			goto out;
-		}
-		/*
-		 * Notify client callback when a package has been
-		 * installed or updated.
-		 */
-		if (update) {
-			xbps_set_cb_state(xhp, XBPS_STATE_UPDATE_DONE, 0,
-			    pkgver, NULL);
-		} else {
-			xbps_set_cb_state(xhp, XBPS_STATE_INSTALL_DONE, 0,
-			    pkgver, NULL);
-		}
-	}
+	rv = configure_pkgs(xhp, pkgs);
 
 out:
 	xbps_object_iterator_release(iter);
 	/* Force a pkgdb write for all unpacked pkgs in transaction */
-	(void)xbps_pkgdb_update(xhp, true, true);
+	(void)pkgdb_flush(xhp);
+	/*
+	 * Execute once the triggers fired by configured and removed
+	 * packages, even if the transaction failed.
+	 */
+	if (rv == 0)
+		rv = xbps_triggers_run(xhp);
+	else
+		(void)xbps_triggers_run(xhp);
 
 	return rv;
 }
@@ -32,8 +32,7 @@
 #include "xbps_api_impl.h"
 
 static void
-pkg_conflicts_trans(struct xbps_handle *xhp, xbps_array_t array,
-		xbps_dictionary_t pkg_repod)
+pkg_conflicts_trans(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
 {
 	xbps_array_t pkg_cflicts, trans_cflicts;
 	xbps_dictionary_t pkgd, tpkgd;
@@ -85,7 +84,7 @@ pkg_conflicts_trans(struct xbps_handle *xhp, xbps_array_t array,
 			 * If there's a pkg for the conflict in transaction,
 			 * ignore it.
 			 */
-			if ((tpkgd = xbps_find_pkg_in_array(array, pkgname, NULL))) {
+			if ((tpkgd = xbps_transaction_pkgset_get(xhp, pkgname))) {
 				xbps_dictionary_get_cstring_nocopy(tpkgd,
 				    "transaction", &tract);
 				if (!strcmp(tract, "install") ||
@@ -111,8 +110,8 @@ pkg_conflicts_trans(struct xbps_handle *xhp, xbps_array_t array,
 		/*
 		 * Check if current pkg conflicts with any pkg in transaction.
 		 */
-		if ((pkgd = xbps_find_pkg_in_array(array, cfpkg, NULL)) ||
-		    (pkgd = xbps_find_virtualpkg_in_array(xhp, array, cfpkg, NULL))) {
+		if ((pkgd = xbps_transaction_pkgset_get(xhp, cfpkg)) ||
+		    (pkgd = xbps_transaction_pkgset_get_virtual(xhp, cfpkg))) {
 			/* ignore pkgs to be removed or on hold */
 			if (xbps_dictionary_get_cstring_nocopy(pkgd,
 			    "transaction", &tract)) {
@@ -148,9 +147,9 @@ pkg_conflicts_trans(struct xbps_handle *xhp, xbps_array_t array,
 
 static int
 pkgdb_conflicts_cb(struct xbps_handle *xhp, xbps_object_t obj,
-		const char *key UNUSED, void *arg, bool *done UNUSED)
+		const char *key UNUSED, void *arg UNUSED, bool *done UNUSED)
 {
-	xbps_array_t pkg_cflicts, trans_cflicts, pkgs = arg;
+	xbps_array_t pkg_cflicts, trans_cflicts;
 	xbps_dictionary_t pkgd;
 	xbps_object_t obj2;
 	xbps_object_iterator_t iter;
@@ -167,7 +166,7 @@ pkgdb_conflicts_cb(struct xbps_handle *xhp, xbps_object_t obj,
 	assert(repopkgname);
 
 	/* if a pkg is in the transaction, ignore the one from pkgdb */
-	if (xbps_find_pkg_in_array(pkgs, repopkgname, NULL)) {
+	if (xbps_transaction_pkgset_get(xhp, repopkgname)) {
 		free(repopkgname);
 		return 0;
 	}
@@ -177,8 +176,8 @@ pkgdb_conflicts_cb(struct xbps_handle *xhp, xbps_object_t obj,
 
 	while ((obj2 = xbps_object_iterator_next(iter))) {
 		cfpkg = xbps_string_cstring_nocopy(obj2);
-		if ((pkgd = xbps_find_pkg_in_array(pkgs, cfpkg, NULL)) ||
-		    (pkgd = xbps_find_virtualpkg_in_array(xhp, pkgs, cfpkg, NULL))) {
+		if ((pkgd = xbps_transaction_pkgset_get(xhp, cfpkg)) ||
+		    (pkgd = xbps_transaction_pkgset_get_virtual(xhp, cfpkg))) {
 			xbps_dictionary_get_cstring_nocopy(pkgd,
 			    "pkgver", &pkgver);
 			/* ignore pkgs to be removed or on hold */
@@ -222,8 +221,8 @@ xbps_transaction_conflicts(struct xbps_handle *xhp, xbps_array_t pkgs)
 	/* find conflicts in transaction */
 	for (i = 0; i < xbps_array_count(pkgs); i++) {
 		pkgd = xbps_array_get(pkgs, i);
-		pkg_conflicts_trans(xhp, pkgs, pkgd);
+		pkg_conflicts_trans(xhp, pkgd);
 	}
 	/* find conflicts in pkgdb */
-	(void)xbps_pkgdb_foreach_cb_multi(xhp, pkgdb_conflicts_cb, pkgs);
+	(void)xbps_pkgdb_foreach_cb_multi(xhp, pkgdb_conflicts_cb, NULL);
 }
@@ -175,7 +175,7 @@ trans_find_pkg(struct xbps_handle *xhp, const char *pkg, bool reinstall,
 	 * in transaction, in that case ignore it.
 	 */
 	if (action == TRANS_UPDATE) {
-		if (xbps_find_pkg_in_array(pkgs, repopkgver, NULL)) {
+		if (xbps_transaction_pkgset_get(xhp, repopkgver)) {
 			xbps_dbg_printf(xhp, "[update] `%s' already queued in "
 			    "transaction.\n", repopkgver);
 			return EEXIST;
@@ -509,6 +509,8 @@ xbps_transaction_autoremove_pkgs(struct xbps_handle *xhp)
 		xbps_dictionary_set_cstring_nocopy(obj,
 		    "transaction", "remove");
 		xbps_array_add(pkgs, obj);
+		if ((rv = xbps_transaction_pkgset_add(xhp, obj, false)) != 0)
+			goto out;
 		xbps_dbg_printf(xhp, "%s: added (remove).\n", pkgver);
 	}
 out:
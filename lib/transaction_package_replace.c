@@ -86,7 +86,7 @@ xbps_transaction_package_replace(struct xbps_handle *xhp, xbps_array_t pkgs)
 			 * Make sure to not add duplicates.
 			 */
 			xbps_dictionary_get_bool(instd, "automatic-install", &instd_auto);
-			reppkgd = xbps_find_pkg_in_array(pkgs, curpkgname, NULL);
+			reppkgd = xbps_transaction_pkgset_get(xhp, curpkgname);
 			if (reppkgd) {
 				const char *rpkgver;
 
@@ -137,7 +137,8 @@ xbps_transaction_package_replace(struct xbps_handle *xhp, xbps_array_t pkgs)
 			xbps_dictionary_set_cstring_nocopy(instd,
 			    "transaction", "remove");
 			xbps_dictionary_set_bool(instd, "replaced", true);
-			if (!xbps_array_add_first(pkgs, instd)) {
+			if (!xbps_array_add_first(pkgs, instd) ||
+			    xbps_transaction_pkgset_add(xhp, instd, true) != 0) {
 				xbps_object_iterator_release(iter);
 				free(pkgname);
 				free(curpkgname);
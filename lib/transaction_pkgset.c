@@ -0,0 +1,198 @@
+/*-
+ * Copyright (c) 2026 agent <agent@local>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * The transaction "packages" array is indexed by pkgname ("pkgset_names")
+ * and by the virtual package names it provides ("pkgset_vpkgs"), so that
+ * checking if a package has been already queued does not need to walk
+ * the whole array. Both dictionaries map a name to an array of package
+ * dictionaries, in the same order they were queued.
+ *
+ * The indexes are only used while building the transaction, they are
+ * removed from the transaction dictionary by xbps_transaction_prepare().
+ */
+
+static char *
+pkgset_key(const char *str)
+{
+	char *pkgname;
+
+	if ((pkgname = xbps_pkgpattern_name(str)) != NULL)
+		return pkgname;
+	if ((pkgname = xbps_pkg_name(str)) != NULL)
+		return pkgname;
+
+	return strdup(str);
+}
+
+static int
+pkgset_add(xbps_dictionary_t idx, const char *key, xbps_dictionary_t pkgd,
+		bool first)
+{
+	xbps_array_t array;
+
+	if ((array = xbps_dictionary_get(idx, key)) == NULL) {
+		if ((array = xbps_array_create()) == NULL)
+			return ENOMEM;
+		if (!xbps_dictionary_set(idx, key, array)) {
+			xbps_object_release(array);
+			return EINVAL;
+		}
+		xbps_object_release(array);
+	}
+	if (first) {
+		if (!xbps_array_add_first(array, pkgd))
+			return EINVAL;
+	} else {
+		if (!xbps_array_add(array, pkgd))
+			return EINVAL;
+	}
+	return 0;
+}
+
+static bool
+pkgset_match(xbps_dictionary_t pkgd, const char *str, bool virtual)
+{
+	const char *pkgver;
+
+	if (virtual)
+		return xbps_match_virtual_pkg_in_dict(pkgd, str);
+
+	if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver))
+		return false;
+
+	if (xbps_pkgpattern_version(str)) {
+		/* match by pattern against pkgver */
+		return xbps_pkgpattern_match(pkgver, str);
+	} else if (xbps_pkg_version(str)) {
+		/* match by exact pkgver */
+		return strcmp(str, pkgver) == 0;
+	}
+	/* match by pkgname, already matched by the index key */
+	return true;
+}
+
+static xbps_dictionary_t
+pkgset_get(struct xbps_handle *xhp, const char *str, bool virtual)
+{
+	xbps_array_t array;
+	xbps_dictionary_t idx, pkgd;
+	char *key;
+
+	if (strpbrk(str, "*?[]")) {
+		/*
+		 * Glob patterns might match more than one pkgname,
+		 * check all packages in transaction.
+		 */
+		array = xbps_dictionary_get(xhp->transd, "packages");
+	} else {
+		idx = xbps_dictionary_get(xhp->transd,
+		    virtual ? "pkgset_vpkgs" : "pkgset_names");
+		if ((key = pkgset_key(str)) == NULL) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		array = xbps_dictionary_get(idx, key);
+		free(key);
+	}
+	for (unsigned int i = 0; i < xbps_array_count(array); i++) {
+		pkgd = xbps_array_get(array, i);
+		if (pkgset_match(pkgd, str, virtual))
+			return pkgd;
+	}
+	errno = ENOENT;
+	return NULL;
+}
+
+int HIDDEN
+xbps_transaction_pkgset_add(struct xbps_handle *xhp, xbps_dictionary_t pkgd,
+		bool first)
+{
+	xbps_array_t provides;
+	xbps_dictionary_t names, vpkgs;
+	const char *pkgver, *vpkg;
+	char *key;
+	int rv;
+
+	names = xbps_dictionary_get(xhp->transd, "pkgset_names");
+	vpkgs = xbps_dictionary_get(xhp->transd, "pkgset_vpkgs");
+	assert(names);
+	assert(vpkgs);
+
+	if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver))
+		return EINVAL;
+	if ((key = xbps_pkg_name(pkgver)) == NULL)
+		return EINVAL;
+	rv = pkgset_add(names, key, pkgd, first);
+	free(key);
+	if (rv != 0)
+		return rv;
+
+	provides = xbps_dictionary_get(pkgd, "provides");
+	for (unsigned int i = 0; i < xbps_array_count(provides); i++) {
+		xbps_array_get_cstring_nocopy(provides, i, &vpkg);
+		if ((key = pkgset_key(vpkg)) == NULL)
+			return ENOMEM;
+		rv = pkgset_add(vpkgs, key, pkgd, first);
+		free(key);
+		if (rv != 0)
+			return rv;
+	}
+	return 0;
+}
+
+xbps_dictionary_t HIDDEN
+xbps_transaction_pkgset_get(struct xbps_handle *xhp, const char *pkg)
+{
+	assert(xhp->transd);
+	assert(pkg);
+
+	return pkgset_get(xhp, pkg, false);
+}
+
+xbps_dictionary_t HIDDEN
+xbps_transaction_pkgset_get_virtual(struct xbps_handle *xhp, const char *pkg)
+{
+	xbps_dictionary_t pkgd;
+	const char *vpkg;
+
+	assert(xhp->transd);
+	assert(pkg);
+
+	if ((vpkg = vpkg_user_conf(xhp, pkg, false))) {
+		if ((pkgd = pkgset_get(xhp, vpkg, true)))
+			return pkgd;
+	}
+
+	return pkgset_get(xhp, pkg, true);
+}
@@ -269,13 +269,148 @@ xbps_transaction_init(struct xbps_handle *xhp)
 	}
 	xbps_object_release(dict);
 
+	if ((dict = xbps_dictionary_create()) == NULL) {
+		xbps_object_release(xhp->transd);
+		xhp->transd = NULL;
+		return ENOMEM;
+	}
+	if (!xbps_dictionary_set(xhp->transd, "pkgset_names", dict)) {
+		xbps_object_release(xhp->transd);
+		xhp->transd = NULL;
+		return EINVAL;
+	}
+	xbps_object_release(dict);
+
+	if ((dict = xbps_dictionary_create()) == NULL) {
+		xbps_object_release(xhp->transd);
+		xhp->transd = NULL;
+		return ENOMEM;
+	}
+	if (!xbps_dictionary_set(xhp->transd, "pkgset_vpkgs", dict)) {
+		xbps_object_release(xhp->transd);
+		xhp->transd = NULL;
+		return EINVAL;
+	}
+	xbps_object_release(dict);
+
 	return 0;
 }
 
+static bool
+is_edge(xbps_dictionary_t pkgd)
+{
+	const char *tract = NULL;
+
+	xbps_dictionary_get_cstring_nocopy(pkgd, "transaction", &tract);
+	if ((strcmp(tract, "remove") == 0) || strcmp(tract, "hold") == 0)
+		return false;
+
+	return true;
+}
+
+static int
+sort_cb(struct xbps_depgraph *g, const unsigned int *ids, unsigned int n,
+		void *arg)
+{
+	struct xbps_handle *xhp = arg;
+	xbps_array_t pkgs;
+	xbps_dictionary_t pkgd;
+	const char *pkgver = NULL;
+
+	pkgs = xbps_dictionary_get(xhp->transd, "packages");
+	if (n > 1 && (xhp->flags & XBPS_FLAG_DEBUG)) {
+		xbps_dbg_printf(xhp, "[trans] cyclic dependencies:");
+		for (unsigned int i = 0; i < n; i++) {
+			pkgd = xbps_depgraph_get_pkgd(g, ids[i]);
+			xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+			xbps_dbg_printf_append(xhp, " %s", pkgver);
+		}
+		xbps_dbg_printf_append(xhp, "\n");
+	}
+	for (unsigned int i = 0; i < n; i++) {
+		pkgd = xbps_depgraph_get_pkgd(g, ids[i]);
+		if (!xbps_array_add(pkgs, pkgd))
+			return ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Sorts the packages in transaction: packages to be removed or on hold
+ * are kept at the head in the same order, the rest are sorted by its
+ * run time dependencies, so that dependencies always come first.
+ */
+static int
+sort_transaction(struct xbps_handle *xhp)
+{
+	struct xbps_depgraph *g;
+	xbps_array_t pkgs, newpkgs;
+	xbps_dictionary_t pkgd;
+	const char *pkgver = NULL;
+	unsigned int id;
+	int rv = 0;
+
+	if ((g = xbps_depgraph_create()) == NULL)
+		return ENOMEM;
+	if ((newpkgs = xbps_array_create()) == NULL) {
+		xbps_depgraph_free(g);
+		return ENOMEM;
+	}
+	/* keep the unsorted array alive until the graph is released */
+	pkgs = xbps_dictionary_get(xhp->transd, "packages");
+	xbps_object_retain(pkgs);
+	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
+		pkgd = xbps_array_get(pkgs, i);
+		if (!is_edge(pkgd)) {
+			if (!xbps_array_add(newpkgs, pkgd)) {
+				rv = ENOMEM;
+				goto out;
+			}
+			continue;
+		}
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+		rv = xbps_depgraph_add(g, pkgver, pkgd, &id);
+		if (rv != 0 && rv != EEXIST)
+			goto out;
+		rv = 0;
+	}
+	for (id = 0; id < xbps_depgraph_count(g); id++) {
+		xbps_array_t rdeps;
+
+		pkgd = xbps_depgraph_get_pkgd(g, id);
+		rdeps = xbps_dictionary_get(pkgd, "run_depends");
+		for (unsigned int i = 0; i < xbps_array_count(rdeps); i++) {
+			xbps_dictionary_t curpkgd;
+			const char *curdep = NULL;
+			unsigned int depid;
+
+			xbps_array_get_cstring_nocopy(rdeps, i, &curdep);
+			if (((curpkgd = xbps_transaction_pkgset_get(xhp, curdep)) == NULL) &&
+			    ((curpkgd = xbps_transaction_pkgset_get_virtual(xhp, curdep)) == NULL))
+				continue;
+			xbps_dictionary_get_cstring_nocopy(curpkgd, "pkgver", &pkgver);
+			if (!xbps_depgraph_lookup(g, pkgver, &depid) || depid == id)
+				continue;
+			if ((rv = xbps_depgraph_add_edge(g, id, depid)) != 0)
+				goto out;
+		}
+	}
+	if (!xbps_dictionary_set(xhp->transd, "packages", newpkgs)) {
+		rv = EINVAL;
+		goto out;
+	}
+	rv = xbps_depgraph_sort(g, NULL, 0, sort_cb, xhp);
+out:
+	xbps_object_release(newpkgs);
+	xbps_object_release(pkgs);
+	xbps_depgraph_free(g);
+	return rv;
+}
+
 int
 xbps_transaction_prepare(struct xbps_handle *xhp)
 {
-	xbps_array_t array, pkgs, edges;
+	xbps_array_t array, pkgs;
 	unsigned int i, cnt;
 	int rv = 0;
 
@@ -286,46 +421,26 @@ xbps_transaction_prepare(struct xbps_handle *xhp)
 		return ENXIO;
 
 	/*
-	 * Collect dependencies for pkgs in transaction.
-	 */
-	if ((edges = xbps_array_create()) == NULL)
-		return ENOMEM;
-	/*
-	 * The edges are also appended after its dependencies have been
-	 * collected; the edges at the original array are removed later.
+	 * Collect dependencies for pkgs in transaction, they are
+	 * appended to the array and sorted later.
 	 */
 	pkgs = xbps_dictionary_get(xhp->transd, "packages");
 	assert(xbps_object_type(pkgs) == XBPS_TYPE_ARRAY);
 	cnt = xbps_array_count(pkgs);
 	for (i = 0; i < cnt; i++) {
 		xbps_dictionary_t pkgd;
-		xbps_string_t str;
-		const char *tract = NULL;
 
 		pkgd = xbps_array_get(pkgs, i);
-		str = xbps_dictionary_get(pkgd, "pkgver");
-		xbps_dictionary_get_cstring_nocopy(pkgd, "transaction", &tract);
-		if ((strcmp(tract, "remove") == 0) || strcmp(tract, "hold") == 0)
+		if (!is_edge(pkgd))
 			continue;
 
-		assert(xbps_object_type(str) == XBPS_TYPE_STRING);
-
-		if (!xbps_array_add(edges, str))
-			return ENOMEM;
-
 		if ((rv = xbps_repository_find_deps(xhp, pkgs, pkgd)) != 0)
 			return rv;
-
-		if (!xbps_array_add(pkgs, pkgd))
-			return ENOMEM;
 	}
-	/* ... remove dup edges at head */
-	for (i = 0; i < xbps_array_count(edges); i++) {
-		const char *pkgver = NULL;
-		xbps_array_get_cstring_nocopy(edges, i, &pkgver);
-		xbps_remove_pkg_from_array_by_pkgver(pkgs, pkgver);
-	}
-	xbps_object_release(edges);
+	if ((rv = sort_transaction(xhp)) != 0)
+		return rv;
+
+	pkgs = xbps_dictionary_get(xhp->transd, "packages");
 
 	/*
 	 * Check for packages to be replaced.
@@ -379,6 +494,8 @@ xbps_transaction_prepare(struct xbps_handle *xhp)
 	xbps_dictionary_remove(xhp->transd, "missing_shlibs");
 	xbps_dictionary_remove(xhp->transd, "missing_deps");
 	xbps_dictionary_remove(xhp->transd, "conflicts");
+	xbps_dictionary_remove(xhp->transd, "pkgset_names");
+	xbps_dictionary_remove(xhp->transd, "pkgset_vpkgs");
 	xbps_dictionary_make_immutable(xhp->transd);
 
 	return 0;
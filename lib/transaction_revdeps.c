@@ -158,7 +158,7 @@ xbps_transaction_revdeps(struct xbps_handle *xhp, xbps_array_t pkgs)
 			xbps_array_get_cstring_nocopy(pkgrdeps, x, &curpkgver);
 			pkgname = xbps_pkg_name(curpkgver);
 			assert(pkgname);
-			if ((revpkgd = xbps_find_pkg_in_array(pkgs, pkgname, NULL))) {
+			if ((revpkgd = xbps_transaction_pkgset_get(xhp, pkgname))) {
 				xbps_dictionary_get_cstring_nocopy(revpkgd, "transaction", &curtract);
 				if (strcmp(curtract, "remove") == 0)
 					revpkgd = NULL;
@@ -177,7 +177,7 @@ xbps_transaction_revdeps(struct xbps_handle *xhp, xbps_array_t pkgs)
 					free(pkgname);
 					continue;
 				}
-				if (xbps_find_pkg_in_array(pkgs, pkgname, "remove")) {
+				if (xbps_transaction_pkgset_get(xhp, pkgname)) {
 					free(pkgname);
 					continue;
 				}
@@ -231,7 +231,7 @@ xbps_transaction_revdeps(struct xbps_handle *xhp, xbps_array_t pkgs)
 			 * if a new version of this conflicting package
 			 * is in the transaction.
 			 */
-			if (xbps_find_pkg_in_array(pkgs, pkgname, "update")) {
+			if (xbps_transaction_pkgset_get(xhp, pkgname)) {
 				free(pkgname);
 				continue;
 			}
@@ -40,7 +40,7 @@ xbps_transaction_store(struct xbps_handle *xhp, xbps_array_t pkgs,
 
 	xbps_dictionary_get_cstring_nocopy(pkgd, "repository", &repo);
 	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
-	if (xbps_find_pkg_in_array(pkgs, pkgver, NULL))
+	if (xbps_transaction_pkgset_get(xhp, pkgver))
 		return 0;
 	/*
 	 * Add required objects into package dep's dictionary.
@@ -69,6 +69,8 @@ xbps_transaction_store(struct xbps_handle *xhp, xbps_array_t pkgs,
 	 */
 	if (!xbps_array_add(pkgs, pkgd))
 		return EINVAL;
+	if (xbps_transaction_pkgset_add(xhp, pkgd, false) != 0)
+		return EINVAL;
 
 	xbps_set_cb_state(xhp, XBPS_STATE_TRANS_ADDPKG, 0, pkgver,
 	    "Found %s (%s) in repository %s", pkgver, tract, repo);
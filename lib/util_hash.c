@@ -23,6 +23,7 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -30,7 +31,10 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <inttypes.h>
+#include <unistd.h>
 
+#include <openssl/evp.h>
 #include <openssl/sha.h>
 
 #include "xbps_api_impl.h"
@@ -108,66 +112,385 @@ xbps_mmap_file(const char *file, void **mmf, size_t *mmflen, size_t *filelen)
 	return true;
 }
 
+/*
+ * Supported digest algorithms. Digests are stored as "<algo>:<hex>",
+ * except sha256 digests that are stored without prefix to remain
+ * compatible with existing metadata.
+ */
+struct digest_algo {
+	const char *name;
+	const EVP_MD *(*md)(void);
+};
+
+static const struct digest_algo digest_algos[] = {
+	{ "sha256",	EVP_sha256 },
+	{ "blake2b",	EVP_blake2b512 },
+	{ NULL,		NULL }
+};
+
+static const struct digest_algo *
+digest_algo_find(const char *name, size_t len)
+{
+	for (const struct digest_algo *da = digest_algos; da->name; da++) {
+		if (strlen(da->name) == len && strncmp(da->name, name, len) == 0)
+			return da;
+	}
+	return NULL;
+}
+
+/*
+ * Returns the algorithm of a digest string, and its hex part in \a hex.
+ */
+static const struct digest_algo *
+digest_algo_of(const char *digest, const char **hex)
+{
+	const char *p;
+
+	if ((p = strchr(digest, ':')) == NULL) {
+		*hex = digest;
+		return &digest_algos[0];
+	}
+	*hex = p + 1;
+	return digest_algo_find(digest, p - digest);
+}
+
+static int
+fd_digest(int fd, const struct digest_algo *da,
+		unsigned char *digest, unsigned int *digestlen)
+{
+	EVP_MD_CTX *ctx;
+	ssize_t len;
+	unsigned char buf[65536];
+	int rv = 0;
+
+	if ((ctx = EVP_MD_CTX_new()) == NULL)
+		return ENOMEM;
+	if (!EVP_DigestInit_ex(ctx, da->md(), NULL)) {
+		rv = ENOTSUP;
+		goto out;
+	}
+	while ((len = read(fd, buf, sizeof(buf))) > 0)
+		EVP_DigestUpdate(ctx, buf, len);
+	if (len < 0)
+		rv = errno;
+	else if (!EVP_DigestFinal_ex(ctx, digest, digestlen))
+		rv = EINVAL;
+out:
+	EVP_MD_CTX_free(ctx);
+	return rv;
+}
+
+static int
+file_digest(const char *file, const struct digest_algo *da,
+		unsigned char *digest, unsigned int *digestlen)
+{
+	int fd, rv;
+
+	if ((fd = open(file, O_RDONLY|O_CLOEXEC)) < 0)
+		return errno;
+	rv = fd_digest(fd, da, digest, digestlen);
+	(void)close(fd);
+	return rv;
+}
+
+static void
+digest_string(const struct digest_algo *da, const unsigned char *digest,
+		unsigned int len, char *string)
+{
+	if (da != &digest_algos[0])
+		string += sprintf(string, "%s:", da->name);
+	digest2string(digest, string, len);
+}
+
+static const char *
+digest_hex(const char *digest)
+{
+	const char *p;
+
+	if ((p = strchr(digest, ':')) != NULL)
+		return p + 1;
+	return digest;
+}
+
+/*
+ * Computes the digest string of \a file, consulting the hash cache
+ * of \a xhp if enabled. The digest is only cached if the file didn't
+ * change while it was being hashed.
+ */
+static int
+file_digest_string(struct xbps_handle *xhp, const char *file,
+		const struct digest_algo *da, char *hash)
+{
+	struct stat st, nst;
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int len;
+	bool cache;
+	int fd, rv;
+
+	if ((fd = open(file, O_RDONLY|O_CLOEXEC)) < 0)
+		return errno;
+
+	cache = xbps_file_hash_cache_enabled(xhp) && fstat(fd, &st) == 0 &&
+	    S_ISREG(st.st_mode);
+	if (cache && xbps_file_hash_cache_get(xhp, &st, da->name, hash)) {
+		(void)close(fd);
+		return 0;
+	}
+	if ((rv = fd_digest(fd, da, digest, &len)) == 0) {
+		digest_string(da, digest, len, hash);
+		if (cache && fstat(fd, &nst) == 0 &&
+		    nst.st_size == st.st_size &&
+		    nst.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+		    nst.st_mtim.tv_nsec == st.st_mtim.tv_nsec &&
+		    nst.st_ctim.tv_sec == st.st_ctim.tv_sec &&
+		    nst.st_ctim.tv_nsec == st.st_ctim.tv_nsec)
+			xbps_file_hash_cache_put(xhp, file, &st, hash);
+	}
+	(void)close(fd);
+	return rv;
+}
+
 unsigned char *
 xbps_file_hash_raw(const char *file)
 {
-	int fd;
-	ssize_t len;
-	unsigned char *digest, buf[65536];
-	SHA256_CTX sha256;
+	unsigned char *digest;
+	unsigned int len;
+	int rv;
 
-	if ((fd = open(file, O_RDONLY)) < 0)
-		return NULL;
-	digest = malloc(SHA256_DIGEST_LENGTH);
+	digest = malloc(EVP_MAX_MD_SIZE);
 	assert(digest);
-	SHA256_Init(&sha256);
-	while ((len = read(fd, buf, sizeof(buf))) > 0)
-		SHA256_Update(&sha256, buf, len);
-	if(len < 0) {
+	if ((rv = file_digest(file, &digest_algos[0], digest, &len)) != 0) {
 		free(digest);
+		errno = rv;
+		return NULL;
+	}
+	return digest;
+}
+
+/*
+ * The SHA256 digest of a downloaded binary package is computed while
+ * fetching it, and saved in <file>.sha256 along with the identity of
+ * the file (device, inode, size, mtime and ctime). The saved digest
+ * is only used if the file did not change since then and both files
+ * are owned by the current user and not writable by others; otherwise
+ * the file is hashed again.
+ */
+#define SAVED_HASH_FMT	"%64s %ju %ju %jd %jd.%ld %jd.%ld"
+
+static bool
+file_trusted(const struct stat *st)
+{
+	return st->st_uid == geteuid() &&
+	    (st->st_mode & (S_IWGRP|S_IWOTH)) == 0;
+}
+
+void HIDDEN
+xbps_file_hash_save(const char *file, const unsigned char *digest)
+{
+	struct stat st;
+	char hash[SHA256_DIGEST_LENGTH * 2 + 1];
+	char *path, *tmp;
+	int fd, rv;
+
+	path = xbps_xasprintf("%s.sha256", file);
+	if (digest == NULL || stat(file, &st) == -1 || !file_trusted(&st)) {
+		(void)unlink(path);
+		free(path);
+		return;
+	}
+	digest2string(digest, hash, SHA256_DIGEST_LENGTH);
+	tmp = xbps_xasprintf("%s.tmp", path);
+	if ((fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644)) == -1) {
+		(void)unlink(path);
+		goto out;
+	}
+	rv = dprintf(fd, "%s %ju %ju %jd %jd.%ld %jd.%ld\n", hash,
+	    (uintmax_t)st.st_dev, (uintmax_t)st.st_ino, (intmax_t)st.st_size,
+	    (intmax_t)st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+	    (intmax_t)st.st_ctim.tv_sec, st.st_ctim.tv_nsec);
+	if (close(fd) == -1 || rv < 0 || rename(tmp, path) == -1) {
+		(void)unlink(tmp);
+		(void)unlink(path);
+	}
+out:
+	free(tmp);
+	free(path);
+}
+
+unsigned char HIDDEN *
+xbps_file_hash_saved(const char *file)
+{
+	struct stat st, sst;
+	uintmax_t dev, ino;
+	intmax_t size, msec, csec;
+	long mnsec, cnsec;
+	unsigned char *digest = NULL;
+	char buf[256], hash[SHA256_DIGEST_LENGTH * 2 + 1], *path;
+	ssize_t len;
+	int fd;
+
+	path = xbps_xasprintf("%s.sha256", file);
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	free(path);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &sst) == -1 || !file_trusted(&sst) ||
+	    (len = read(fd, buf, sizeof(buf) - 1)) <= 0) {
+		(void)close(fd);
 		return NULL;
 	}
-	SHA256_Final(digest, &sha256);
 	(void)close(fd);
+	buf[len] = '\0';
+
+	if (sscanf(buf, SAVED_HASH_FMT, hash, &dev, &ino, &size,
+	    &msec, &mnsec, &csec, &cnsec) != 8 ||
+	    strlen(hash) != SHA256_DIGEST_LENGTH * 2)
+		return NULL;
+	if (stat(file, &st) == -1 || !file_trusted(&st) ||
+	    (uintmax_t)st.st_dev != dev || (uintmax_t)st.st_ino != ino ||
+	    (intmax_t)st.st_size != size ||
+	    (intmax_t)st.st_mtim.tv_sec != msec || st.st_mtim.tv_nsec != mnsec ||
+	    (intmax_t)st.st_ctim.tv_sec != csec || st.st_ctim.tv_nsec != cnsec)
+		return NULL;
+
+	digest = malloc(SHA256_DIGEST_LENGTH);
+	assert(digest);
+	for (unsigned int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+		unsigned int byte;
 
+		if (sscanf(hash + i * 2, "%2x", &byte) != 1) {
+			free(digest);
+			return NULL;
+		}
+		digest[i] = (unsigned char)byte;
+	}
 	return digest;
 }
 
+bool
+xbps_digest_supported(const char *algo)
+{
+	return algo && digest_algo_find(algo, strlen(algo)) != NULL;
+}
+
+const char *
+xbps_digest_algo(const char *digest)
+{
+	const struct digest_algo *da;
+	const char *hex;
+
+	assert(digest);
+
+	if ((da = digest_algo_of(digest, &hex)) == NULL)
+		return NULL;
+	return da->name;
+}
+
 char *
-xbps_file_hash(const char *file)
+xbps_file_digest(const char *file, const char *algo)
 {
+	const struct digest_algo *da = &digest_algos[0];
 	char *hash;
-	unsigned char *digest;
+	int rv;
 
-	if (!(digest = xbps_file_hash_raw(file)))
+	if (algo && (da = digest_algo_find(algo, strlen(algo))) == NULL) {
+		errno = ENOTSUP;
 		return NULL;
-
-	hash = malloc(SHA256_DIGEST_LENGTH * 2 + 1);
+	}
+	hash = malloc(XBPS_DIGEST_SIZE);
 	assert(hash);
-	digest2string(digest, hash, SHA256_DIGEST_LENGTH);
-	free(digest);
-
+	if ((rv = file_digest_string(NULL, file, da, hash)) != 0) {
+		free(hash);
+		errno = rv;
+		return NULL;
+	}
 	return hash;
 }
 
-int
-xbps_file_hash_check(const char *file, const char *sha256)
+char *
+xbps_file_hash(const char *file)
 {
-	char *res;
+	return xbps_file_digest(file, NULL);
+}
+
+static int
+file_hash_check(struct xbps_handle *xhp, const char *file, const char *digest)
+{
+	const struct digest_algo *da;
+	const char *hex;
+	char res[XBPS_DIGEST_SIZE];
+	int rv;
 
 	assert(file != NULL);
-	assert(sha256 != NULL);
+	assert(digest != NULL);
 
-	res = xbps_file_hash(file);
-	if (res == NULL)
-		return errno;
+	if ((da = digest_algo_of(digest, &hex)) == NULL)
+		return ENOTSUP;
+	if ((rv = file_digest_string(xhp, file, da, res)) != 0)
+		return rv;
 
-	if (strcmp(sha256, res)) {
-		free(res);
+	if (strcmp(hex, digest_hex(res)))
 		return ERANGE;
+
+	return 0;
+}
+
+int
+xbps_file_hash_check(const char *file, const char *digest)
+{
+	return file_hash_check(NULL, file, digest);
+}
+
+struct hash_batch {
+	struct xbps_handle *xhp;
+	struct xbps_file_hash_job *jobs;
+};
+
+static int
+hash_job(unsigned int i, void *arg)
+{
+	struct hash_batch *hb = arg;
+	struct xbps_file_hash_job *job = &hb->jobs[i];
+	const struct digest_algo *da = &digest_algos[0];
+	const char *hex = NULL;
+
+	job->hash[0] = '\0';
+	if (job->digest)
+		da = digest_algo_of(job->digest, &hex);
+	else if (job->algo)
+		da = digest_algo_find(job->algo, strlen(job->algo));
+	if (da == NULL) {
+		job->rv = ENOTSUP;
+		return 0;
 	}
-	free(res);
+	if ((job->rv = file_digest_string(hb->xhp, job->file, da, job->hash)) != 0) {
+		job->hash[0] = '\0';
+		return 0;
+	}
+	if (hex && strcmp(hex, digest_hex(job->hash)))
+		job->rv = ERANGE;
+	return 0;
+}
+
+int
+xbps_file_hash_batch(struct xbps_handle *xhp, struct xbps_file_hash_job *jobs,
+		unsigned int njobs)
+{
+	struct hash_batch hb = { .xhp = xhp, .jobs = jobs };
+	unsigned int i;
 
+	if (njobs == 0)
+		return 0;
+
+	assert(jobs);
+
+	/* every file gets its own result, all of them are hashed */
+	(void)xbps_jobs_run(njobs, 0, hash_job, &hb);
+
+	for (i = 0; i < njobs; i++) {
+		if (jobs[i].rv != 0)
+			return jobs[i].rv;
+	}
 	return 0;
 }
 
@@ -226,10 +549,10 @@ xbps_file_hash_check_dictionary(struct xbps_handle *xhp,
 	}
 
 	if (strcmp(xhp->rootdir, "/") == 0) {
-		rv = xbps_file_hash_check(file, sha256d);
+		rv = file_hash_check(xhp, file, sha256d);
 	} else {
 		buf = xbps_xasprintf("%s/%s", xhp->rootdir, file);
-		rv = xbps_file_hash_check(buf, sha256d);
+		rv = file_hash_check(xhp, buf, sha256d);
 		free(buf);
 	}
 	if (rv == 0)
@@ -0,0 +1,395 @@
+/*-
+ * Copyright (c) 2026 agent <agent@local>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * Persistent file digest cache.
+ *
+ * When enabled with the `hashcache' keyword, digests computed by
+ * xbps_file_hash_batch() and xbps_file_hash_check_dictionary() are
+ * stored in <cachedir>/hashcache, keyed by device and inode. An entry
+ * is only used while the size, mtime and ctime of the file are the
+ * same as when it was hashed; ctime cannot be set by unprivileged
+ * users, so any change to the file invalidates its entry.
+ *
+ * Every line of the cache file is an entry:
+ *
+ *	<dev> <ino> <size> <mtime> <ctime> <digest> <path>
+ *
+ * The cache file is only loaded if it's owned by the current user
+ * and not writable by others. It's rewritten when an entry was added
+ * or changed; entries not used in this run are dropped if their path
+ * no longer refers to the same unchanged file, and only the first
+ * HASH_CACHE_MAX entries are kept, those used in this run first.
+ */
+#define HASH_CACHE_FILE		"hashcache"
+#define HASH_CACHE_BUCKETS	4096
+#define HASH_CACHE_MAX		262144
+
+struct hc_entry {
+	struct hc_entry *next;
+	uintmax_t dev, ino;
+	intmax_t size;
+	struct timespec mtime, ctime;
+	char *digest;
+	char *path;
+	bool used;
+};
+
+struct xbps_hash_cache {
+	struct hc_entry **buckets;
+	size_t nbuckets, nentries;
+	pthread_mutex_t mtx;
+	char *path;
+	bool dirty;
+	unsigned int hits, misses;
+};
+
+static size_t
+hc_bucket(struct xbps_hash_cache *hc, uintmax_t dev, uintmax_t ino)
+{
+	uintmax_t h = ino * 0x9e3779b97f4a7c15ULL ^ dev;
+
+	return (size_t)(h ^ (h >> 29)) & (hc->nbuckets - 1);
+}
+
+static void
+hc_resize(struct xbps_hash_cache *hc)
+{
+	struct hc_entry **obuckets = hc->buckets, *e, *next;
+	size_t onbuckets = hc->nbuckets, b;
+
+	hc->nbuckets *= 2;
+	hc->buckets = calloc(hc->nbuckets, sizeof(*hc->buckets));
+	assert(hc->buckets);
+	for (size_t i = 0; i < onbuckets; i++) {
+		for (e = obuckets[i]; e; e = next) {
+			next = e->next;
+			b = hc_bucket(hc, e->dev, e->ino);
+			e->next = hc->buckets[b];
+			hc->buckets[b] = e;
+		}
+	}
+	free(obuckets);
+}
+
+static struct hc_entry *
+hc_find(struct xbps_hash_cache *hc, uintmax_t dev, uintmax_t ino)
+{
+	struct hc_entry *e;
+
+	for (e = hc->buckets[hc_bucket(hc, dev, ino)]; e; e = e->next) {
+		if (e->dev == dev && e->ino == ino)
+			return e;
+	}
+	return NULL;
+}
+
+static struct hc_entry *
+hc_insert(struct xbps_hash_cache *hc, uintmax_t dev, uintmax_t ino)
+{
+	struct hc_entry *e;
+	size_t b;
+
+	if ((e = hc_find(hc, dev, ino)) != NULL)
+		return e;
+
+	if (hc->nentries >= hc->nbuckets)
+		hc_resize(hc);
+
+	e = calloc(1, sizeof(*e));
+	assert(e);
+	e->dev = dev;
+	e->ino = ino;
+	b = hc_bucket(hc, dev, ino);
+	e->next = hc->buckets[b];
+	hc->buckets[b] = e;
+	hc->nentries++;
+
+	return e;
+}
+
+static bool
+hc_entry_valid(const struct hc_entry *e, const struct stat *st)
+{
+	return e->size == (intmax_t)st->st_size &&
+	    e->mtime.tv_sec == st->st_mtim.tv_sec &&
+	    e->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+	    e->ctime.tv_sec == st->st_ctim.tv_sec &&
+	    e->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+/*
+ * An entry from a previous run is kept while its path still refers
+ * to the same unchanged file.
+ */
+static bool
+hc_entry_stale(const struct hc_entry *e)
+{
+	struct stat st;
+
+	if (e->used)
+		return false;
+	if (stat(e->path, &st) == -1)
+		return true;
+	return (uintmax_t)st.st_dev != e->dev ||
+	    (uintmax_t)st.st_ino != e->ino || !hc_entry_valid(e, &st);
+}
+
+static void
+hc_load(struct xbps_hash_cache *hc)
+{
+	struct hc_entry *e;
+	struct stat st;
+	FILE *fp;
+	uintmax_t dev, ino;
+	intmax_t size, msec, csec;
+	long mnsec, cnsec;
+	char *line = NULL, digest[XBPS_DIGEST_SIZE];
+	size_t linelen = 0;
+	ssize_t len;
+	int pos;
+
+	if ((fp = fopen(hc->path, "re")) == NULL)
+		return;
+	if (fstat(fileno(fp), &st) == -1 || st.st_uid != geteuid() ||
+	    (st.st_mode & (S_IWGRP|S_IWOTH))) {
+		fclose(fp);
+		return;
+	}
+	while ((len = getline(&line, &linelen, fp)) != -1) {
+		if (line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		pos = -1;
+		if (sscanf(line, "%ju %ju %jd %jd.%ld %jd.%ld %144s %n", &dev,
+		    &ino, &size, &msec, &mnsec, &csec, &cnsec, digest,
+		    &pos) != 8 || pos == -1 || line[pos] != '/')
+			continue;
+		if (xbps_digest_algo(digest) == NULL)
+			continue;
+		if (hc->nentries >= HASH_CACHE_MAX)
+			break;
+		e = hc_insert(hc, dev, ino);
+		free(e->digest);
+		free(e->path);
+		e->size = size;
+		e->mtime.tv_sec = msec;
+		e->mtime.tv_nsec = mnsec;
+		e->ctime.tv_sec = csec;
+		e->ctime.tv_nsec = cnsec;
+		e->digest = strdup(digest);
+		e->path = strdup(line + pos);
+		assert(e->digest);
+		assert(e->path);
+	}
+	free(line);
+	fclose(fp);
+}
+
+static void
+hc_save(struct xbps_handle *xhp, struct xbps_hash_cache *hc)
+{
+	struct hc_entry *e;
+	FILE *fp;
+	char *tmp;
+	size_t n = 0, dropped = 0;
+	int fd;
+
+	if (xbps_mkpath(xhp->cachedir, 0755) == -1 && errno != EEXIST)
+		return;
+
+	tmp = xbps_xasprintf("%s.XXXXXX", hc->path);
+	if ((fd = mkstemp(tmp)) == -1) {
+		free(tmp);
+		return;
+	}
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		(void)close(fd);
+		(void)unlink(tmp);
+		free(tmp);
+		return;
+	}
+	/* entries used in this run first, then the old ones */
+	for (int used = 1; used >= 0; used--) {
+		for (size_t i = 0; i < hc->nbuckets; i++) {
+			for (e = hc->buckets[i]; e; e = e->next) {
+				if (e->used != used)
+					continue;
+				if (n >= HASH_CACHE_MAX || hc_entry_stale(e)) {
+					dropped++;
+					continue;
+				}
+				fprintf(fp, "%ju %ju %jd %jd.%ld %jd.%ld %s %s\n",
+				    e->dev, e->ino, e->size,
+				    (intmax_t)e->mtime.tv_sec, e->mtime.tv_nsec,
+				    (intmax_t)e->ctime.tv_sec, e->ctime.tv_nsec,
+				    e->digest, e->path);
+				n++;
+			}
+		}
+	}
+	(void)fchmod(fd, 0644);
+	if (fclose(fp) != 0 || rename(tmp, hc->path) == -1) {
+		xbps_dbg_printf(xhp, "failed to save hash cache %s: %s\n",
+		    hc->path, strerror(errno));
+		(void)unlink(tmp);
+	} else {
+		xbps_dbg_printf(xhp, "hash cache: saved %zu entries, "
+		    "dropped %zu\n", n, dropped);
+	}
+	free(tmp);
+}
+
+void HIDDEN
+xbps_file_hash_cache_init(struct xbps_handle *xhp)
+{
+	struct xbps_hash_cache *hc;
+
+	if (xhp->hash_cache || (xhp->flags & XBPS_FLAG_HASH_CACHE) == 0)
+		return;
+
+	hc = calloc(1, sizeof(*hc));
+	assert(hc);
+	hc->nbuckets = HASH_CACHE_BUCKETS;
+	hc->buckets = calloc(hc->nbuckets, sizeof(*hc->buckets));
+	assert(hc->buckets);
+	pthread_mutex_init(&hc->mtx, NULL);
+	hc->path = xbps_xasprintf("%s/%s", xhp->cachedir, HASH_CACHE_FILE);
+	hc_load(hc);
+	xbps_dbg_printf(xhp, "hash cache: loaded %zu entries from %s\n",
+	    hc->nentries, hc->path);
+	xhp->hash_cache = hc;
+}
+
+void HIDDEN
+xbps_file_hash_cache_end(struct xbps_handle *xhp)
+{
+	struct xbps_hash_cache *hc = xhp->hash_cache;
+	struct hc_entry *e, *next;
+
+	if (hc == NULL)
+		return;
+
+	xhp->hash_cache = NULL;
+	xbps_dbg_printf(xhp, "hash cache: %u hits, %u misses\n",
+	    hc->hits, hc->misses);
+	if (hc->dirty)
+		hc_save(xhp, hc);
+
+	for (size_t i = 0; i < hc->nbuckets; i++) {
+		for (e = hc->buckets[i]; e; e = next) {
+			next = e->next;
+			free(e->digest);
+			free(e->path);
+			free(e);
+		}
+	}
+	pthread_mutex_destroy(&hc->mtx);
+	free(hc->buckets);
+	free(hc->path);
+	free(hc);
+}
+
+bool HIDDEN
+xbps_file_hash_cache_enabled(struct xbps_handle *xhp)
+{
+	return xhp != NULL && xhp->hash_cache != NULL;
+}
+
+bool HIDDEN
+xbps_file_hash_cache_get(struct xbps_handle *xhp, const struct stat *st,
+		const char *algo, char *digest)
+{
+	struct xbps_hash_cache *hc;
+	struct hc_entry *e;
+	bool found = false;
+
+	if (!xbps_file_hash_cache_enabled(xhp))
+		return false;
+
+	hc = xhp->hash_cache;
+	pthread_mutex_lock(&hc->mtx);
+	e = hc_find(hc, (uintmax_t)st->st_dev, (uintmax_t)st->st_ino);
+	if (e && hc_entry_valid(e, st) && xbps_digest_algo(e->digest) == algo) {
+		xbps_strlcpy(digest, e->digest, XBPS_DIGEST_SIZE);
+		e->used = true;
+		found = true;
+		hc->hits++;
+	} else {
+		hc->misses++;
+	}
+	pthread_mutex_unlock(&hc->mtx);
+
+	return found;
+}
+
+void HIDDEN
+xbps_file_hash_cache_put(struct xbps_handle *xhp, const char *file,
+		const struct stat *st, const char *digest)
+{
+	struct xbps_hash_cache *hc;
+	struct hc_entry *e;
+	char cwd[PATH_MAX], *path;
+
+	if (!xbps_file_hash_cache_enabled(xhp) || strchr(file, '\n'))
+		return;
+
+	if (file[0] == '/') {
+		path = strdup(file);
+		assert(path);
+	} else if (getcwd(cwd, sizeof(cwd)) != NULL) {
+		path = xbps_xasprintf("%s/%s", cwd, file);
+	} else {
+		return;
+	}
+
+	hc = xhp->hash_cache;
+	pthread_mutex_lock(&hc->mtx);
+	e = hc_insert(hc, (uintmax_t)st->st_dev, (uintmax_t)st->st_ino);
+	free(e->digest);
+	free(e->path);
+	e->size = (intmax_t)st->st_size;
+	e->mtime = st->st_mtim;
+	e->ctime = st->st_ctim;
+	e->digest = strdup(digest);
+	e->path = path;
+	e->used = true;
+	assert(e->digest);
+	hc->dirty = true;
+	pthread_mutex_unlock(&hc->mtx);
+}
@@ -0,0 +1,308 @@
+/*-
+ * Copyright (c) 2026 agent <agent@local>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_IO_URING
+# define _GNU_SOURCE	/* for syscall(2) */
+#endif
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * Minimal io_uring(7) interface used to batch file creation while
+ * unpacking packages, see package_unpack.c. It's implemented on top of
+ * the raw syscalls to avoid an additional dependency.
+ *
+ * If the kernel does not support io_uring (or XBPS was built without
+ * it), xbps_uring_init() returns NULL and callers use their default
+ * code path.
+ */
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <linux/openat2.h>
+
+struct xbps_uring {
+	int fd;
+	unsigned int entries;
+	unsigned int pending;
+	/* submission queue */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	/* openat2(2) arguments must be valid until submitted */
+	struct open_how *hows;
+	/* completion queue */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	/* mappings */
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+};
+
+struct xbps_uring *
+xbps_uring_init(unsigned int entries)
+{
+	struct io_uring_params p;
+	struct xbps_uring *ur;
+	char *sq, *cq;
+
+	if ((ur = calloc(1, sizeof(*ur))) == NULL)
+		return NULL;
+
+	memset(&p, 0, sizeof(p));
+	ur->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (ur->fd == -1) {
+		free(ur);
+		return NULL;
+	}
+	ur->entries = p.sq_entries;
+	if ((ur->hows = calloc(ur->entries, sizeof(*ur->hows))) == NULL)
+		goto fail;
+	ur->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ur->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ur->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->cq_size > ur->sq_size)
+			ur->sq_size = ur->cq_size;
+		ur->cq_size = ur->sq_size;
+	}
+	ur->sq_ptr = mmap(NULL, ur->sq_size, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+	if (ur->sq_ptr == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_ptr = ur->sq_ptr;
+	} else {
+		ur->cq_ptr = mmap(NULL, ur->cq_size, PROT_READ|PROT_WRITE,
+		    MAP_SHARED|MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+		if (ur->cq_ptr == MAP_FAILED) {
+			ur->cq_ptr = NULL;
+			goto fail;
+		}
+	}
+	ur->sqes = mmap(NULL, ur->sqes_size, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+	if (ur->sqes == MAP_FAILED) {
+		ur->sqes = NULL;
+		goto fail;
+	}
+	sq = ur->sq_ptr;
+	ur->sq_head = (unsigned int *)(void *)(sq + p.sq_off.head);
+	ur->sq_tail = (unsigned int *)(void *)(sq + p.sq_off.tail);
+	ur->sq_mask = (unsigned int *)(void *)(sq + p.sq_off.ring_mask);
+	ur->sq_array = (unsigned int *)(void *)(sq + p.sq_off.array);
+	cq = ur->cq_ptr;
+	ur->cq_head = (unsigned int *)(void *)(cq + p.cq_off.head);
+	ur->cq_tail = (unsigned int *)(void *)(cq + p.cq_off.tail);
+	ur->cq_mask = (unsigned int *)(void *)(cq + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)(void *)(cq + p.cq_off.cqes);
+
+	return ur;
+
+fail:
+	xbps_uring_free(ur);
+	return NULL;
+}
+
+void
+xbps_uring_free(struct xbps_uring *ur)
+{
+	if (ur == NULL)
+		return;
+
+	if (ur->sqes)
+		munmap(ur->sqes, ur->sqes_size);
+	if (ur->cq_ptr && ur->cq_ptr != ur->sq_ptr)
+		munmap(ur->cq_ptr, ur->cq_size);
+	if (ur->sq_ptr && ur->sq_ptr != MAP_FAILED)
+		munmap(ur->sq_ptr, ur->sq_size);
+	close(ur->fd);
+	free(ur->hows);
+	free(ur);
+}
+
+unsigned int
+xbps_uring_entries(struct xbps_uring *ur)
+{
+	return ur->entries;
+}
+
+static void
+get_sqe(struct xbps_uring *ur, uint8_t opcode, int fd, const void *addr,
+		uint32_t len, uint64_t off, uint64_t data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail, idx;
+
+	/* callers never queue more than `entries' requests */
+	assert(ur->pending < ur->entries);
+
+	tail = *ur->sq_tail;
+	idx = tail & *ur->sq_mask;
+	sqe = &ur->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)addr;
+	sqe->len = len;
+	sqe->off = off;
+	sqe->user_data = data;
+	ur->sq_array[idx] = idx;
+	__atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ur->pending++;
+}
+
+void
+xbps_uring_openat(struct xbps_uring *ur, int dirfd, const char *path,
+		int flags, mode_t mode, uint64_t data)
+{
+	struct open_how *how;
+	unsigned int idx;
+
+	idx = *ur->sq_tail & *ur->sq_mask;
+	how = &ur->hows[idx];
+	memset(how, 0, sizeof(*how));
+	how->flags = (uint64_t)flags;
+	how->mode = mode;
+	/*
+	 * never escape from dirfd nor follow symlinks in any component,
+	 * as ARCHIVE_EXTRACT_SECURE_SYMLINKS does; callers fall back
+	 * on ELOOP and EXDEV.
+	 */
+	how->resolve = RESOLVE_BENEATH|RESOLVE_NO_SYMLINKS;
+	get_sqe(ur, IORING_OP_OPENAT2, dirfd, path, sizeof(*how),
+	    (uint64_t)(uintptr_t)how, data);
+}
+
+void
+xbps_uring_write(struct xbps_uring *ur, int fd, const void *buf,
+		size_t len, uint64_t off, uint64_t data)
+{
+	get_sqe(ur, IORING_OP_WRITE, fd, buf, (uint32_t)len, off, data);
+}
+
+void
+xbps_uring_close(struct xbps_uring *ur, int fd, uint64_t data)
+{
+	get_sqe(ur, IORING_OP_CLOSE, fd, NULL, 0, 0, data);
+}
+
+int
+xbps_uring_wait(struct xbps_uring *ur,
+		void (*fn)(uint64_t, int, void *), void *arg)
+{
+	unsigned int head, submit = ur->pending;
+	int rv;
+
+	while (ur->pending) {
+		rv = (int)syscall(__NR_io_uring_enter, ur->fd, submit,
+		    1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (rv == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		submit = 0;
+		head = *ur->cq_head;
+		while (head != __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe;
+
+			cqe = &ur->cqes[head & *ur->cq_mask];
+			(*fn)(cqe->user_data, cqe->res, arg);
+			ur->pending--;
+			head++;
+		}
+		__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+#else
+struct xbps_uring *
+xbps_uring_init(unsigned int entries)
+{
+	(void)entries;
+	errno = ENOTSUP;
+	return NULL;
+}
+
+void
+xbps_uring_free(struct xbps_uring *ur)
+{
+	(void)ur;
+}
+
+unsigned int
+xbps_uring_entries(struct xbps_uring *ur)
+{
+	(void)ur;
+	return 0;
+}
+
+void
+xbps_uring_openat(struct xbps_uring *ur, int dirfd, const char *path,
+		int flags, mode_t mode, uint64_t data)
+{
+	(void)ur; (void)dirfd; (void)path;
+	(void)flags; (void)mode; (void)data;
+}
+
+void
+xbps_uring_write(struct xbps_uring *ur, int fd, const void *buf,
+		size_t len, uint64_t off, uint64_t data)
+{
+	(void)ur; (void)fd; (void)buf;
+	(void)len; (void)off; (void)data;
+}
+
+void
+xbps_uring_close(struct xbps_uring *ur, int fd, uint64_t data)
+{
+	(void)ur; (void)fd; (void)data;
+}
+
+int
+xbps_uring_wait(struct xbps_uring *ur,
+		void (*fn)(uint64_t, int, void *), void *arg)
+{
+	(void)ur; (void)fn; (void)arg;
+	return ENOTSUP;
+}
+#endif
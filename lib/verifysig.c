@@ -110,7 +110,10 @@ xbps_verify_file_signature(struct xbps_repo *repo, const char *fname)
 	/*
 	 * Prepare fname and signature data buffers.
 	 */
-	if (!(digest = xbps_file_hash_raw(fname))) {
+	if ((digest = xbps_file_hash_saved(fname)) != NULL) {
+		xbps_dbg_printf(repo->xhp, "%s: using digest computed "
+		    "while downloading\n", fname);
+	} else if (!(digest = xbps_file_hash_raw(fname))) {
 		xbps_dbg_printf(repo->xhp, "can't open file %s: %s\n", fname, strerror(errno));
 		goto out;
 	}
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Times xbps-create(1) with a synthetic destdir of many small files.
+#
+# Usage: create_many_files.sh [nfiles] [xbps-create]
+#
+# The destdir has 1000 files per directory and every 100th file is a
+# hardlink to the previous one; the package is created with
+# --compression none, so that the time is spent processing files and
+# not compressing them. Pass the path of another xbps-create binary to
+# compare two builds with the same destdir.
+#
+NFILES=${1:-200000}
+XBPS_CREATE=${2:-xbps-create}
+
+WRKDIR=$(mktemp -d) || exit 1
+trap 'rm -rf $WRKDIR' EXIT INT TERM
+
+echo "Creating $NFILES files in $WRKDIR ..."
+awk -v n=$NFILES -v dir=$WRKDIR/destdir 'BEGIN {
+	for (i = 0; i < n; i++) {
+		d = sprintf("%s/usr/share/bench/%d", dir, int(i / 1000));
+		if (i % 1000 == 0)
+			system("mkdir -p " d);
+		f = sprintf("%s/file%d", d, i);
+		if (i % 100 == 99) {
+			system(sprintf("ln %s/file%d %s", d, i - 1, f));
+			continue;
+		}
+		printf("file %d\n", i) > f;
+		close(f);
+	}
+}' || exit 1
+
+cd $WRKDIR || exit 1
+echo "Running $XBPS_CREATE ..."
+start=$(date +%s.%N)
+$XBPS_CREATE -A noarch -n bench-1.0_1 -s "bench pkg" \
+	--compression none destdir || exit 1
+end=$(date +%s.%N)
+awk -v s=$start -v e=$end 'BEGIN { printf("%d files: %.1fs\n", '$NFILES', e - s) }'
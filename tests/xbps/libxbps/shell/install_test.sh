@@ -123,6 +123,92 @@ update_to_empty_pkg_body() {
 	atf_check_equal $rv 0
 }
 
+atf_test_case install_durable
+
+install_durable_head() {
+	atf_set "descr" "Tests for pkg installations: durable transactions"
+}
+
+install_durable_body() {
+	mkdir -p repo conf pkg_A/usr/bin
+	echo "A-1.0_1" > pkg_A/usr/bin/foo
+	echo "durable=true" > conf/durable.conf
+
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -C $PWD/conf -r root --repository=repo -yd A
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/usr/bin/foo)" "A-1.0_1"
+	out=$(xbps-query -r root -p state A)
+	atf_check_equal "$out" installed
+	out=$(stat -c %a root/var/db/xbps/.A-files.plist)
+	atf_check_equal "$out" 644
+}
+
+# Creates a package bigger than UNPACK_PIPELINE_MINSIZE (8MB), with a
+# hardlink to a file that is queued to the writer threads and a file
+# bigger than UNPACK_QUEUE_MAXBYTES (32MB), both extracted by the caller.
+create_pipeline_pkg() {
+	mkdir -p repo pkg_A/usr/share/A pkg_A/usr/lib
+	for i in $(seq 1 9); do
+		head -c 1048576 /dev/urandom > pkg_A/usr/share/A/file$i
+	done
+	ln pkg_A/usr/share/A/file1 pkg_A/usr/share/A/link1
+	head -c 34603008 /dev/urandom > pkg_A/usr/lib/big
+
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a repo/*.xbps
+	atf_check_equal $? 0
+}
+
+atf_test_case install_pipeline
+
+install_pipeline_head() {
+	atf_set "descr" "Tests for pkg installations: big pkgs are extracted by writer threads"
+}
+
+install_pipeline_body() {
+	create_pipeline_pkg
+	out=$(xbps-install -C empty.conf -r root --repository=repo -yd A 2>&1)
+	atf_check_equal $? 0
+	out=$(echo "$out" | grep -c "writer threads")
+	atf_check_equal "$out" 1
+	diff -r pkg_A/usr root/usr
+	atf_check_equal $? 0
+	atf_check_equal "$(stat -c %i root/usr/share/A/file1)" \
+		"$(stat -c %i root/usr/share/A/link1)"
+	xbps-pkgdb -r root A
+	atf_check_equal $? 0
+}
+
+atf_test_case install_pipeline_error
+
+install_pipeline_error_head() {
+	atf_set "descr" "Tests for pkg installations: a failed write stops the writer threads"
+}
+
+install_pipeline_error_body() {
+	create_pipeline_pkg
+	# file5 cannot replace a non-empty directory
+	mkdir -p root/usr/share/A/file5/foo
+	xbps-install -C empty.conf -r root --repository=repo -yd A
+	atf_check_equal $? 39
+	# entries after the failed one are not extracted
+	test -e root/usr/share/A/file1
+	atf_check_equal $? 1
+	test -e root/usr/lib/big
+	atf_check_equal $? 1
+	xbps-query -r root A
+	atf_check_equal $? 2
+}
+
 atf_test_case update_if_installed
 
 update_if_installed_head() {
@@ -375,6 +461,66 @@ update_file_timestamps_body() {
 	atf_check_equal "$expected" "$result"
 }
 
+atf_test_case update_modified_file
+
+update_modified_file_head() {
+	atf_set "descr" "Test for pkg updates: restore modified files"
+}
+
+update_modified_file_body() {
+	mkdir -p repo conf pkg_A/usr/bin
+	echo abc > pkg_A/usr/bin/foo
+	echo "stricthash=true" > conf/strict.conf
+
+	cd repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -C empty.conf -r root --repository=repo -yd foo
+	atf_check_equal $? 0
+	grep -q "<key>inode</key>" root/var/db/xbps/.foo-files.plist
+	atf_check_equal $? 0
+
+	# modified file, must be restored
+	echo xyz > root/usr/bin/foo
+	cd repo
+	xbps-create -A noarch -n foo-1.1_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -C empty.conf -r root --repository=repo -yud foo
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/usr/bin/foo)" abc
+
+	# modified file with the same size, mtime and inode is
+	# only detected with stricthash.
+	touch -r root/usr/bin/foo mtime.ref
+	echo xyz > root/usr/bin/foo
+	touch -r mtime.ref root/usr/bin/foo
+	cd repo
+	xbps-create -A noarch -n foo-1.2_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -C empty.conf -r root --repository=repo -yud foo
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/usr/bin/foo)" xyz
+
+	cd repo
+	xbps-create -A noarch -n foo-1.3_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -C $PWD/conf -r root --repository=repo -yud foo
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/usr/bin/foo)" abc
+}
+
 atf_test_case update_move_unmodified_file
 
 update_move_unmodified_file_head() {
@@ -574,6 +720,128 @@ update_with_revdeps_body() {
 	atf_check_equal $(xbps-query -r root -p pkgver B) B-1.1_1
 }
 
+atf_test_case hash_cache
+
+hash_cache_head() {
+	atf_set "descr" "Tests for pkg install: verify files with the hash cache"
+}
+
+hash_cache_body() {
+	mkdir -p repo conf pkg_A/usr/bin
+	echo abc > pkg_A/usr/bin/foo
+	echo def > pkg_A/usr/bin/bar
+	echo "hashcache=true" > conf/hashcache.conf
+
+	cd repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -C empty.conf -r root --repository=repo -yd foo
+	atf_check_equal $? 0
+	xbps-pkgdb -C $PWD/conf -r root -a
+	atf_check_equal $? 0
+	sha256=$(xbps-digest root/usr/bin/foo)
+	grep -q " $sha256 /.*/usr/bin/foo\$" root/var/cache/xbps/hashcache
+	atf_check_equal $? 0
+
+	# the cached digest is used while the file does not change
+	sed -i -e "s/ $sha256 / $(echo xyz | xbps-digest) /" root/var/cache/xbps/hashcache
+	xbps-pkgdb -C $PWD/conf -r root -a
+	atf_check_equal $? 1
+
+	# a modified file with the same size and mtime is hashed again
+	touch -r root/usr/bin/foo mtime.ref
+	echo abc > root/usr/bin/foo
+	touch -r mtime.ref root/usr/bin/foo
+	xbps-pkgdb -C $PWD/conf -r root -a
+	atf_check_equal $? 0
+	grep -q " $sha256 /.*/usr/bin/foo\$" root/var/cache/xbps/hashcache
+	atf_check_equal $? 0
+
+	# entries of removed files are dropped
+	grep -q "/usr/bin/bar\$" root/var/cache/xbps/hashcache
+	atf_check_equal $? 0
+	rm root/usr/bin/bar
+	echo xyz > root/usr/bin/foo
+	xbps-pkgdb -C $PWD/conf -r root -a
+	atf_check_equal $? 1
+	grep -q "/usr/bin/bar\$" root/var/cache/xbps/hashcache
+	atf_check_equal $? 1
+	atf_check_equal $(wc -l < root/var/cache/xbps/hashcache) 1
+}
+
+atf_test_case install_iouring
+
+install_iouring_head() {
+	atf_set "descr" "Tests for pkg installations: small files with and without io_uring"
+}
+
+install_iouring_body() {
+	mkdir -p repo conf pkg_A/usr/share/A
+	for i in $(seq 1 200); do
+		echo "file $i" > pkg_A/usr/share/A/file$i
+	done
+	chmod 755 pkg_A/usr/share/A/file1
+	echo "iouring=false" > conf/iouring.conf
+
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -C empty.conf -r root --repository=repo -yd A
+	atf_check_equal $? 0
+	diff -r pkg_A/usr root/usr
+	atf_check_equal $? 0
+	atf_check_equal "$(stat -c %a root/usr/share/A/file1)" 755
+	xbps-pkgdb -r root A
+	atf_check_equal $? 0
+
+	rm -rf root
+	out=$(xbps-install -C $PWD/conf -r root --repository=repo -yd A 2>&1)
+	atf_check_equal $? 0
+	out=$(echo "$out" | grep -c "using io_uring")
+	atf_check_equal "$out" 0
+	diff -r pkg_A/usr root/usr
+	atf_check_equal $? 0
+	atf_check_equal "$(stat -c %a root/usr/share/A/file1)" 755
+}
+
+atf_test_case install_symlinked_parent
+
+install_symlinked_parent_head() {
+	atf_set "descr" "Tests for pkg installations: files are not written through symlinked parent dirs"
+}
+
+install_symlinked_parent_body() {
+	mkdir -p repo conf pkg_A/usr/lib64
+	echo foo > pkg_A/usr/lib64/foo
+	echo "iouring=false" > conf/iouring.conf
+
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a repo/*.xbps
+	atf_check_equal $? 0
+
+	for conf in empty.conf $PWD/conf; do
+		rm -rf root
+		mkdir -p root/usr/lib
+		ln -s lib root/usr/lib64
+		xbps-install -C $conf -r root --repository=repo -yd A
+		atf_check_equal $? 0
+		test -d root/usr/lib64 -a ! -L root/usr/lib64
+		atf_check_equal $? 0
+		atf_check_equal "$(cat root/usr/lib64/foo)" foo
+		test -e root/usr/lib/foo
+		atf_check_equal $? 1
+	done
+}
+
 atf_init_test_cases() {
 	atf_add_test_case install_empty
 	atf_add_test_case install_with_deps
@@ -584,12 +852,19 @@ atf_init_test_cases() {
 	atf_add_test_case install_bestmatch_deps
 	atf_add_test_case install_bestmatch_disabled
 	atf_add_test_case install_and_update_revdeps
+	atf_add_test_case install_durable
+	atf_add_test_case install_iouring
+	atf_add_test_case install_symlinked_parent
+	atf_add_test_case install_pipeline
+	atf_add_test_case install_pipeline_error
 	atf_add_test_case update_if_installed
 	atf_add_test_case update_to_empty_pkg
 	atf_add_test_case update_file_timestamps
+	atf_add_test_case update_modified_file
 	atf_add_test_case update_move_file
 	atf_add_test_case update_move_unmodified_file
 	atf_add_test_case update_xbps
 	atf_add_test_case update_xbps_virtual
 	atf_add_test_case update_with_revdeps
+	atf_add_test_case hash_cache
 }
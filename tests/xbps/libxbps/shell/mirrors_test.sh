@@ -0,0 +1,486 @@
+#!/usr/bin/env atf-sh
+#
+# Tests for downloads from remote repositories and their mirrors,
+# served by a small HTTP server with range support. Modes:
+#
+#	ok	serve files as is
+#	slow	wait 0.5s before every response, so that it ranks last
+#	error	return 500 for binary packages
+#	cut	serve different data for binary packages (an out of sync
+#		mirror), and drop the connection halfway through
+#	norange	answer bounded ranges with the whole file
+#
+create_server() {
+	cat > server.py <<_EOF
+import http.server, os, re, sys, time
+root, mode = sys.argv[1], sys.argv[2]
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+    def log_message(self, *args):
+        with open(root + '.log', 'a') as f:
+            f.write('%s %s %s\n' % (self.command, self.path,
+                self.headers.get('Range', '-')))
+    def do_HEAD(self):
+        self.do_GET(head=True)
+    def do_GET(self, head=False):
+        path = os.path.join(root, self.path.lstrip('/'))
+        if not os.path.isfile(path):
+            self.send_error(404)
+            return
+        if mode == 'slow':
+            time.sleep(0.5)
+        bad = path.endswith('.xbps') and mode in ('error', 'cut')
+        if bad and mode == 'error':
+            self.send_error(500)
+            return
+        with open(path, 'rb') as f:
+            data = f.read()
+        if bad:
+            data = bytes(b ^ 0xff for b in data)
+        start, end = 0, len(data) - 1
+        m = re.match(r'bytes=(\d+)-(\d*)', self.headers.get('Range', ''))
+        if m and m.group(2) and mode == 'norange':
+            m = None
+        if m:
+            start = int(m.group(1))
+            if m.group(2):
+                end = min(int(m.group(2)), end)
+            if start >= len(data):
+                self.send_error(416)
+                return
+            self.send_response(206)
+            self.send_header('Content-Range',
+                'bytes %d-%d/%d' % (start, end, len(data)))
+        else:
+            self.send_response(200)
+        self.send_header('Content-Length', str(end - start + 1))
+        self.send_header('Last-Modified',
+            self.date_time_string(int(os.stat(path).st_mtime)))
+        if bad:
+            self.send_header('Connection', 'close')
+            self.close_connection = True
+            end = start + (end - start) // 2
+        self.end_headers()
+        if not head:
+            self.wfile.write(data[start:end + 1])
+srv = http.server.ThreadingHTTPServer(('127.0.0.1', 0), Handler)
+with open(root + '.port', 'w') as f:
+    f.write(str(srv.server_address[1]))
+srv.serve_forever()
+_EOF
+}
+
+# start_server <dir> <mode>: serves <dir>, prints its URL.
+start_server() {
+	python3 server.py $PWD/$1 $2 >/dev/null 2>&1 &
+	echo $! >> servers.pid
+	for i in $(seq 1 50); do
+		[ -s $1.port ] && break
+		sleep 0.1
+	done
+	echo "http://127.0.0.1:$(cat $1.port)"
+}
+
+# start_listener <name>: accepts connections and never replies, prints
+# its URL.
+start_listener() {
+	python3 -c "
+import socket, time
+s = socket.socket()
+s.bind(('127.0.0.1', 0))
+s.listen(16)
+with open('$1.port', 'w') as f:
+    f.write(str(s.getsockname()[1]))
+time.sleep(3600)
+" >/dev/null 2>&1 &
+	echo $! >> servers.pid
+	for i in $(seq 1 50); do
+		[ -s $1.port ] && break
+		sleep 0.1
+	done
+	echo "http://127.0.0.1:$(cat $1.port)"
+}
+
+stop_servers() {
+	[ -f servers.pid ] && kill $(cat servers.pid) 2>/dev/null
+	rm -f servers.pid
+}
+
+# create_repo <dir> [size]: a signed repository with pkg A, 256KB (or size
+# bytes) of random data.
+create_repo() {
+	command -v python3 >/dev/null || atf_skip "python3(1) not found"
+	command -v openssl >/dev/null || atf_skip "openssl(1) not found"
+	openssl genrsa -traditional -out privkey.pem 2048 || \
+		openssl genrsa -out privkey.pem 2048
+	atf_check_equal $? 0
+	mkdir -p $1 pkg_A/usr/share/A
+	head -c ${2:-262144} /dev/urandom > pkg_A/usr/share/A/data
+	cd $1
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	xbps-rindex -d --signedby test --privkey ../privkey.pem -s $PWD
+	atf_check_equal $? 0
+	xbps-rindex -d --privkey ../privkey.pem -S $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	create_server
+}
+
+atf_test_case mirror_failover cleanup
+
+mirror_failover_head() {
+	atf_set "descr" "Tests for repository mirrors: failover to the next mirror"
+}
+
+mirror_failover_body() {
+	create_repo repo
+	cp -a repo repo2
+	url=$(start_server repo error)
+	url2=$(start_server repo2 slow)
+	mkdir -p conf
+	echo "repository=$url $url2" > conf/repo.conf
+	yes | xbps-install -C $PWD/conf -r root -Sd
+	atf_check_equal $? 0
+	xbps-install -C $PWD/conf -r root -yd A
+	atf_check_equal $? 0
+	stop_servers
+	cmp pkg_A/usr/share/A/data root/usr/share/A/data
+	atf_check_equal $? 0
+	out=$(grep -c '^GET /A-1.0_1.noarch.xbps -$' repo2.log)
+	atf_check_equal $out 1
+}
+
+mirror_failover_cleanup() {
+	stop_servers
+}
+
+atf_test_case mirror_probe_timeout cleanup
+
+mirror_probe_timeout_head() {
+	atf_set "descr" "Tests for repository mirrors: mirrors that do not reply are not waited for"
+}
+
+mirror_probe_timeout_body() {
+	create_repo repo
+	url=$(start_listener hang)
+	url2=$(start_server repo ok)
+	mkdir -p conf
+	echo "repository=$url $url2" > conf/repo.conf
+	start=$(date +%s)
+	out=$(yes | xbps-install -C $PWD/conf -r root -Sd 2>&1)
+	atf_check_equal $? 0
+	end=$(date +%s)
+	[ $((end - start)) -lt 10 ]
+	atf_check_equal $? 0
+	out=$(echo "$out" | grep -c "mirror \`$url': unreachable")
+	atf_check_equal $out 1
+	xbps-install -C $PWD/conf -r root -yd A
+	atf_check_equal $? 0
+	stop_servers
+	cmp pkg_A/usr/share/A/data root/usr/share/A/data
+	atf_check_equal $? 0
+}
+
+mirror_probe_timeout_cleanup() {
+	stop_servers
+}
+
+atf_test_case mirror_failover_partial cleanup
+
+mirror_failover_partial_head() {
+	atf_set "descr" "Tests for repository mirrors: a partial download is not resumed from another mirror"
+}
+
+mirror_failover_partial_body() {
+	create_repo repo
+	cp -a repo repo2
+	url=$(start_server repo cut)
+	url2=$(start_server repo2 slow)
+	mkdir -p conf
+	echo "repository=$url $url2" > conf/repo.conf
+	yes | xbps-install -C $PWD/conf -r root -Sd
+	atf_check_equal $? 0
+	xbps-install -C $PWD/conf -r root -yd A
+	atf_check_equal $? 0
+	stop_servers
+	cmp pkg_A/usr/share/A/data root/usr/share/A/data
+	atf_check_equal $? 0
+	# the second mirror sent the whole file
+	out=$(grep -c '^GET /A-1.0_1.noarch.xbps -$' repo2.log)
+	atf_check_equal $out 1
+}
+
+mirror_failover_partial_cleanup() {
+	stop_servers
+}
+
+atf_test_case resume_part cleanup
+
+resume_part_head() {
+	atf_set "descr" "Tests for downloads: partial files are only resumed if the remote file did not change"
+}
+
+resume_part_body() {
+	create_repo repo
+	url=$(start_server repo ok)
+	mkdir -p conf
+	echo "repository=$url" > conf/repo.conf
+	yes | xbps-install -C $PWD/conf -r root -Sd
+	atf_check_equal $? 0
+	cachedir=root/var/cache/xbps
+	mkdir -p $cachedir
+	# partial file from another file, must be fetched again
+	head -c 1000 /dev/urandom > $cachedir/A-1.0_1.noarch.xbps.part
+	touch -t 200001010000 $cachedir/A-1.0_1.noarch.xbps.part
+	xbps-install -C $PWD/conf -r root -yd A
+	atf_check_equal $? 0
+	cmp pkg_A/usr/share/A/data root/usr/share/A/data
+	atf_check_equal $? 0
+	out=$(grep -c '^GET /A-1.0_1.noarch.xbps -$' repo.log)
+	atf_check_equal $out 1
+	# partial file with the remote mtime, must be resumed
+	xbps-remove -C $PWD/conf -r root -yd A
+	atf_check_equal $? 0
+	rm -f $cachedir/A-1.0_1.noarch.xbps*
+	head -c 1000 repo/A-1.0_1.noarch.xbps > $cachedir/A-1.0_1.noarch.xbps.part
+	touch -r repo/A-1.0_1.noarch.xbps $cachedir/A-1.0_1.noarch.xbps.part
+	rm -f repo.log
+	xbps-install -C $PWD/conf -r root -yd A
+	atf_check_equal $? 0
+	stop_servers
+	cmp pkg_A/usr/share/A/data root/usr/share/A/data
+	atf_check_equal $? 0
+	out=$(grep -c '^GET /A-1.0_1.noarch.xbps bytes=1000-$' repo.log)
+	atf_check_equal $out 1
+}
+
+resume_part_cleanup() {
+	stop_servers
+}
+
+atf_test_case remote_seekable cleanup
+
+remote_seekable_head() {
+	atf_set "descr" "Tests for remote repositories: range requests are only used for seekable pkgs"
+}
+
+remote_seekable_body() {
+	create_repo repo
+	mkdir -p pkg_B/usr/share/B
+	echo B > pkg_B/usr/share/B/data
+	cd repo
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --seekable ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/B-1.0_1.noarch.xbps
+	atf_check_equal $? 0
+	xbps-rindex -d --privkey ../privkey.pem -S $PWD/B-1.0_1.noarch.xbps
+	atf_check_equal $? 0
+	cd ..
+	url=$(start_server repo ok)
+	mkdir -p conf
+	echo "repository=$url" > conf/repo.conf
+	yes | xbps-install -C $PWD/conf -r root -Sd
+	atf_check_equal $? 0
+	out=$(xbps-query -C $PWD/conf -r root -R -f A)
+	atf_check_equal "$out" /usr/share/A/data
+	out=$(xbps-query -C $PWD/conf -r root -R -f B)
+	atf_check_equal "$out" /usr/share/B/data
+	stop_servers
+	# A is read from the start, without HEAD or range requests
+	out=$(grep -c '^GET /A-1.0_1.noarch.xbps -$' repo.log)
+	atf_check_equal $out 1
+	out=$(grep -c '^HEAD /A-1.0_1' repo.log)
+	atf_check_equal $out 0
+	# B is read from its index
+	out=$(grep -c '^HEAD /B-1.0_1.noarch.xbps -$' repo.log)
+	atf_check_equal $out 1
+	out=$(grep -c '^GET /B-1.0_1.noarch.xbps bytes=' repo.log)
+	atf_check_equal $out 2
+	out=$(grep -c '^GET /B-1.0_1.noarch.xbps -$' repo.log)
+	atf_check_equal $out 0
+}
+
+remote_seekable_cleanup() {
+	stop_servers
+}
+
+atf_test_case segmented cleanup
+
+segmented_head() {
+	atf_set "descr" "Tests for downloads: big files are downloaded in ranges"
+}
+
+segmented_body() {
+	create_repo repo 3145728
+	url=$(start_server repo ok)
+	mkdir -p conf
+	echo "repository=$url" > conf/repo.conf
+	echo "fetchsegments=4" > conf/fetch.conf
+	echo "fetchthreshold=1M" >> conf/fetch.conf
+	yes | xbps-install -C $PWD/conf -r root -Sd
+	atf_check_equal $? 0
+	out=$(xbps-install -C $PWD/conf -r root -yd A 2>&1)
+	atf_check_equal $? 0
+	stop_servers
+	out=$(echo "$out" | grep -c "downloading in 3 segments")
+	atf_check_equal $out 1
+	out=$(grep -c '^GET /A-1.0_1.noarch.xbps bytes=[0-9]*-[0-9]*$' repo.log)
+	atf_check_equal $out 2
+	atf_check_equal "$(xbps-digest root/var/cache/xbps/A-1.0_1.noarch.xbps)" \
+		"$(xbps-digest repo/A-1.0_1.noarch.xbps)"
+	cmp pkg_A/usr/share/A/data root/usr/share/A/data
+	atf_check_equal $? 0
+}
+
+segmented_cleanup() {
+	stop_servers
+}
+
+atf_test_case segmented_norange cleanup
+
+segmented_norange_head() {
+	atf_set "descr" "Tests for downloads: a single stream is used if ranges are not supported"
+}
+
+segmented_norange_body() {
+	create_repo repo 3145728
+	url=$(start_server repo norange)
+	mkdir -p conf
+	echo "repository=$url" > conf/repo.conf
+	echo "fetchsegments=4" > conf/fetch.conf
+	echo "fetchthreshold=1M" >> conf/fetch.conf
+	yes | xbps-install -C $PWD/conf -r root -Sd
+	atf_check_equal $? 0
+	out=$(xbps-install -C $PWD/conf -r root -yd A 2>&1)
+	atf_check_equal $? 0
+	stop_servers
+	out=$(echo "$out" | grep -c "using a single stream")
+	atf_check_equal $out 1
+	atf_check_equal "$(xbps-digest root/var/cache/xbps/A-1.0_1.noarch.xbps)" \
+		"$(xbps-digest repo/A-1.0_1.noarch.xbps)"
+	cmp pkg_A/usr/share/A/data root/usr/share/A/data
+	atf_check_equal $? 0
+}
+
+segmented_norange_cleanup() {
+	stop_servers
+}
+
+atf_test_case hash_sidecar cleanup
+
+hash_sidecar_head() {
+	atf_set "descr" "Tests for downloads: the digest computed while downloading is only used for the same file"
+}
+
+# reinstall A, prints how many times the saved digest was used.
+sidecar_used() {
+	xbps-install -C $PWD/conf -r root -fyd A > out 2>&1
+	atf_check_equal $? 0
+	grep -c "using digest computed while downloading" out
+}
+
+hash_sidecar_body() {
+	create_repo repo
+	url=$(start_server repo ok)
+	mkdir -p conf
+	echo "repository=$url" > conf/repo.conf
+	yes | xbps-install -C $PWD/conf -r root -Sd
+	atf_check_equal $? 0
+	binpkg=root/var/cache/xbps/A-1.0_1.noarch.xbps
+	out=$(xbps-install -C $PWD/conf -r root -yd A 2>&1)
+	atf_check_equal $? 0
+	out=$(echo "$out" | grep -c "using digest computed while downloading")
+	atf_check_equal $out 1
+	atf_check_equal "$(cut -d ' ' -f 1 $binpkg.sha256)" \
+		"$(xbps-digest repo/A-1.0_1.noarch.xbps)"
+	atf_check_equal $(sidecar_used) 1
+	# ignored if the binpkg was rewritten
+	cp repo/A-1.0_1.noarch.xbps $binpkg
+	atf_check_equal $(sidecar_used) 0
+	# or its mtime was reset
+	rm -f $binpkg
+	xbps-install -C $PWD/conf -r root -fy A
+	atf_check_equal $? 0
+	atf_check_equal $(sidecar_used) 1
+	touch -r repo/A-1.0_1.noarch.xbps $binpkg
+	atf_check_equal $(sidecar_used) 0
+	# or the sidecar is writable by others
+	rm -f $binpkg
+	xbps-install -C $PWD/conf -r root -fy A
+	atf_check_equal $? 0
+	chmod g+w $binpkg.sha256
+	atf_check_equal $(sidecar_used) 0
+	stop_servers
+}
+
+hash_sidecar_cleanup() {
+	stop_servers
+}
+
+atf_test_case hash_sidecar_remove cleanup
+
+hash_sidecar_remove_head() {
+	atf_set "descr" "Tests for downloads: the saved digest is removed with its binpkg"
+}
+
+hash_sidecar_remove_body() {
+	create_repo repo
+	url=$(start_server repo ok)
+	mkdir -p conf
+	echo "repository=$url" > conf/repo.conf
+	yes | xbps-install -C $PWD/conf -r root -Sd
+	atf_check_equal $? 0
+	binpkg=root/var/cache/xbps/A-1.0_1.noarch.xbps
+	xbps-install -C $PWD/conf -r root -y A
+	atf_check_equal $? 0
+	test -f $binpkg.sha256
+	atf_check_equal $? 0
+	# a wrong saved digest fails the signature check
+	sed -i -e 's/^[0-9a-f]*/0000000000000000000000000000000000000000000000000000000000000000/' \
+		$binpkg.sha256
+	xbps-install -C $PWD/conf -r root -fy A
+	atf_check_equal $? 1
+	test -e $binpkg -o -e $binpkg.sig -o -e $binpkg.sha256
+	atf_check_equal $? 1
+	# removed along with obsolete binpkgs
+	xbps-install -C $PWD/conf -r root -fy A
+	atf_check_equal $? 0
+	test -f $binpkg.sha256
+	atf_check_equal $? 0
+	mkdir -p pkg_A2/usr/share/A
+	echo A > pkg_A2/usr/share/A/data
+	cd repo
+	xbps-create -A noarch -n A-1.1_1 -s "A pkg" ../pkg_A2
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/A-1.1_1.noarch.xbps
+	atf_check_equal $? 0
+	xbps-rindex -d --privkey ../privkey.pem -S $PWD/A-1.1_1.noarch.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -C $PWD/conf -r root -S
+	atf_check_equal $? 0
+	stop_servers
+	xbps-remove -C $PWD/conf -r root -O
+	atf_check_equal $? 0
+	test -e $binpkg -o -e $binpkg.sig -o -e $binpkg.sha256
+	atf_check_equal $? 1
+}
+
+hash_sidecar_remove_cleanup() {
+	stop_servers
+}
+
+atf_init_test_cases() {
+	atf_add_test_case mirror_failover
+	atf_add_test_case mirror_failover_partial
+	atf_add_test_case mirror_probe_timeout
+	atf_add_test_case resume_part
+	atf_add_test_case remote_seekable
+	atf_add_test_case segmented
+	atf_add_test_case segmented_norange
+	atf_add_test_case hash_sidecar
+	atf_add_test_case hash_sidecar_remove
+}
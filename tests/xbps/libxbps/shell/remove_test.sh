@@ -489,6 +489,35 @@ remove_directory_body() {
 	atf_check_equal $? 1
 }
 
+atf_test_case remove_directory_tree
+
+remove_directory_tree_head() {
+	atf_set "descr" "xbps-remove(1): remove files in many directories"
+}
+
+remove_directory_tree_body() {
+	mkdir -p some_repo pkg_A/B/C/D pkg_A/B2/C pkg_A/E
+	for f in B/file00 B/C/file00 B/C/D/file00 B/C/D/file01 B2/file00 B2/C/file00 E/file00; do
+		echo $f > pkg_A/$f
+	done
+	ln -s ../B2/file00 pkg_A/B/C/link00
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root -C empty.conf --repository=$PWD/some_repo -y A
+	atf_check_equal $? 0
+	touch root/E/unowned
+	xbps-remove -r root -C empty.conf -y A
+	atf_check_equal $? 0
+	test -d root/B -o -d root/B2 -o -f root/E/file00
+	atf_check_equal $? 1
+	test -f root/E/unowned
+	atf_check_equal $? 0
+}
+
 atf_test_case keep_modified_files
 
 keep_modified_files_head() {
@@ -633,6 +662,7 @@ atf_init_test_cases() {
 	atf_add_test_case remove_with_revdeps_in_trans_inverted
 	atf_add_test_case remove_with_revdeps_in_trans_recursive
 	atf_add_test_case remove_directory
+	atf_add_test_case remove_directory_tree
 	atf_add_test_case keep_modified_files
 	atf_add_test_case remove_modified_files
 	atf_add_test_case keep_modified_conf_files
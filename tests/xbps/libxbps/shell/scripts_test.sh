@@ -84,7 +84,224 @@ script_arch_body() {
 	atf_check_equal $rval 0
 }
 
+atf_test_case script_pre_deps
+
+script_pre_deps_head() {
+	atf_set "descr" "Tests for package scripts: pre action runs after deps are unpacked"
+}
+
+script_pre_deps_body() {
+	mkdir some_repo root
+	for f in B C D E F; do
+		mkdir -p pkg_$f/usr/bin
+		echo "$f-1.0_1" > pkg_$f/usr/bin/$f
+	done
+	mkdir -p pkg_A/usr/bin
+	echo "A-1.0_1" > pkg_A/usr/bin/A
+	cat > pkg_A/INSTALL <<_EOF
+#!/bin/sh
+if [ "\$1" = "pre" ]; then
+	for f in B C D E F; do
+		[ -f usr/bin/\$f ] || exit 1
+	done
+fi
+exit 0
+_EOF
+	chmod +x pkg_A/INSTALL
+
+	cd some_repo
+	for f in B C D E F; do
+		xbps-create -A noarch -n $f-1.0_1 -s "$f pkg" ../pkg_$f
+		atf_check_equal $? 0
+	done
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" -D "B>=0 C>=0 D>=0 E>=0 F>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -C empty.conf -r root --repository=$PWD/some_repo -y A
+	atf_check_equal $? 0
+	out=$(xbps-query -r root -l|awk '{print $2}'|tr '\n' ' ')
+	atf_check_equal "$out" "A-1.0_1 B-1.0_1 C-1.0_1 D-1.0_1 E-1.0_1 F-1.0_1 "
+	for f in A B C D E F; do
+		atf_check_equal "$(cat root/usr/bin/$f)" "$f-1.0_1"
+	done
+}
+
+atf_test_case script_post_deps
+
+script_post_deps_head() {
+	atf_set "descr" "Tests for package scripts: post action runs after deps are configured"
+}
+
+script_post_deps_body() {
+	mkdir some_repo root
+	for f in A B C D E F; do
+		mkdir -p pkg_$f/usr/bin
+		echo "$f-1.0_1" > pkg_$f/usr/bin/$f
+		cat > pkg_$f/INSTALL <<_EOF
+#!/bin/sh
+if [ "\$1" = "post" ]; then
+	for f in \$DEPS; do
+		[ -f \$f.configured ] || exit 1
+	done
+	touch $f.configured
+fi
+exit 0
+_EOF
+		chmod +x pkg_$f/INSTALL
+	done
+	sed -i 's,^\(if .*\)$,DEPS="B C D E F"\n\1,' pkg_A/INSTALL
+	sed -i 's,^\(if .*\)$,DEPS="C"\n\1,' pkg_B/INSTALL
+
+	cd some_repo
+	for f in C D E F; do
+		xbps-create -A noarch -n $f-1.0_1 -s "$f pkg" ../pkg_$f
+		atf_check_equal $? 0
+	done
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" -D "C>=0" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" -D "B>=0 D>=0 E>=0 F>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	mkdir conf
+	echo "parallelconfigure=true" > conf/parallel.conf
+	for conf in empty.conf $PWD/conf; do
+		rm -rf root
+		xbps-install -C $conf -r root --repository=$PWD/some_repo -y A
+		atf_check_equal $? 0
+		for f in A B C D E F; do
+			test -f root/$f.configured
+			atf_check_equal $? 0
+		done
+		out=$(xbps-query -r root -p state A)
+		atf_check_equal "$out" "installed"
+	done
+}
+
+atf_test_case script_triggers
+
+script_triggers_head() {
+	atf_set "descr" "Tests for package scripts: triggers are executed once"
+}
+
+script_triggers_body() {
+	mkdir -p some_repo root/usr/libexec/xbps-hooks
+	cat > root/usr/libexec/xbps-hooks/foo <<_EOF
+#!/bin/sh
+echo "\$@" >> foo.log
+_EOF
+	chmod +x root/usr/libexec/xbps-hooks/foo
+	for f in A B C; do
+		mkdir -p pkg_$f/usr/share/$f
+		echo "$f-1.0_1" > pkg_$f/usr/share/$f/$f
+	done
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" --triggers "foo" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --triggers "foo bar" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" ../pkg_C
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -C empty.conf -r root --repository=$PWD/some_repo -y A B C
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/foo.log)" "run A-1.0_1 B-1.0_1"
+	rm root/foo.log
+	xbps-remove -C empty.conf -r root -y A B C
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/foo.log)" "run A-1.0_1 B-1.0_1"
+}
+
+atf_test_case script_pre_serial
+
+script_pre_serial_head() {
+	atf_set "descr" "Tests for package scripts: pre actions run one at a time in order"
+}
+
+script_pre_serial_body() {
+	mkdir some_repo root
+	for f in A B C D E F; do
+		mkdir -p pkg_$f/usr/bin
+		echo "$f-1.0_1" > pkg_$f/usr/bin/$f
+		cat > pkg_$f/INSTALL <<_EOF
+#!/bin/sh
+if [ "\$1" = "pre" ]; then
+	echo "start \$2" >> pre.log
+	sleep 0.1
+	echo "end \$2" >> pre.log
+fi
+exit 0
+_EOF
+		chmod +x pkg_$f/INSTALL
+	done
+
+	cd some_repo
+	for f in A B C D E F; do
+		xbps-create -A noarch -n $f-1.0_1 -s "$f pkg" ../pkg_$f
+		atf_check_equal $? 0
+	done
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	expected=$(xbps-install -C empty.conf -r root --repository=$PWD/some_repo -n A B C D E F | \
+		awk '{sub(/-1.0_1$/, "", $1); print "start " $1 "\nend " $1}')
+	xbps-install -C empty.conf -r root --repository=$PWD/some_repo -y A B C D E F
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/pre.log)" "$expected"
+}
+
+atf_test_case script_post_killed
+
+script_post_killed_head() {
+	atf_set "descr" "Tests for package scripts: post action killed by a signal"
+}
+
+script_post_killed_body() {
+	mkdir some_repo conf
+	echo "parallelconfigure=true" > conf/parallel.conf
+	for f in A B; do
+		mkdir -p pkg_$f/usr/bin
+		echo "$f-1.0_1" > pkg_$f/usr/bin/$f
+	done
+	cat > pkg_A/INSTALL <<_EOF
+#!/bin/sh
+if [ "\$1" = "post" ]; then
+	kill -9 \$\$
+fi
+exit 0
+_EOF
+	chmod +x pkg_A/INSTALL
+
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" -D "A>=0" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	for conf in empty.conf $PWD/conf; do
+		rm -rf root
+		xbps-install -C $conf -r root --repository=$PWD/some_repo -y B
+		atf_check_equal $? 255
+		out=$(xbps-query -r root -p state A)
+		atf_check_equal "$out" "unpacked"
+		out=$(xbps-query -r root -p state B)
+		atf_check_equal "$out" "unpacked"
+	done
+}
+
 atf_init_test_cases() {
 	atf_add_test_case script_nargs
 	atf_add_test_case script_arch
+	atf_add_test_case script_pre_deps
+	atf_add_test_case script_pre_serial
+	atf_add_test_case script_post_deps
+	atf_add_test_case script_post_killed
+	atf_add_test_case script_triggers
 }
@@ -152,6 +152,144 @@ reject_fifo_file_body() {
 	atf_check_equal $? 1
 }
 
+atf_test_case hash_many_files
+
+hash_many_files_head() {
+	atf_set "descr" "xbps-create(1): hash of all regular files is correct"
+}
+
+hash_many_files_body() {
+	mkdir -p repo pkg_A/usr/share/foo pkg_A/etc
+	for f in $(seq 1 64); do
+		seq 1 $((f * 100)) > pkg_A/usr/share/foo/file$f
+	done
+	echo conf > pkg_A/etc/foo.conf
+	cd repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" -F /etc/foo.conf ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root --repository=$PWD/repo -yd foo
+	atf_check_equal $? 0
+	xbps-pkgdb -r root foo
+	atf_check_equal $? 0
+	result="$(xbps-query -r root -f foo | wc -l)"
+	atf_check_equal "$result" 65
+}
+
+atf_test_case digest_blake2b
+
+digest_blake2b_head() {
+	atf_set "descr" "xbps-create(1): create and verify pkg with blake2b digests"
+}
+
+digest_blake2b_body() {
+	mkdir -p repo pkg_A/usr/bin
+	echo 123456789 > pkg_A/usr/bin/foo
+	cd repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" --digest blake2b ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a --digest blake2b $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	result="$(xbps-query -r root --repository=repo -p filename-sha256 foo)"
+	expected="blake2b:$(xbps-digest -m blake2b repo/foo-1.0_1.noarch.xbps)"
+	atf_check_equal "$result" "$expected"
+	xbps-install -r root --repository=$PWD/repo -yd foo
+	atf_check_equal $? 0
+	xbps-pkgdb -r root foo
+	atf_check_equal $? 0
+	echo 987654321 > root/usr/bin/foo
+	xbps-pkgdb -r root foo
+	atf_check_equal $? 1
+}
+
+atf_test_case mutable_files
+
+mutable_files_head() {
+	atf_set "descr" "xbps-create(1): files are marked as mutable"
+}
+
+mutable_files_body() {
+	mkdir -p repo pkg_A/usr/bin
+	for f in foo bar baz; do
+		echo $f > pkg_A/usr/bin/$f
+	done
+	cd repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" -M "/usr/bin/foo  /usr/bin/baz" ../pkg_A
+	atf_check_equal $? 0
+	tar -xf foo-1.0_1.noarch.xbps ./files.plist
+	atf_check_equal $? 0
+	result="$(grep -c '<key>mutable</key>' files.plist)"
+	atf_check_equal "$result" 2
+	result="$(grep -A4 '/usr/bin/bar' files.plist | grep -c mutable)"
+	atf_check_equal "$result" 0
+}
+
+atf_test_case compress_threads
+
+compress_threads_head() {
+	atf_set "descr" "xbps-create(1): pkgs compressed with multiple threads"
+}
+
+compress_threads_body() {
+	mkdir -p repo pkg_A/usr/bin pkg_B/usr/bin
+	seq 1 100000 > pkg_A/usr/bin/foo
+	seq 1 100000 > pkg_B/usr/bin/bar
+	cd repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" --compression xz -j 2 ../pkg_A
+	atf_check_equal $? 0
+	XBPS_COMPRESS_THREADS=0 xbps-create -A noarch -n bar-1.0_1 -s "bar pkg" --compression zstd ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n baz-1.0_1 -s "baz pkg" -j foo ../pkg_B
+	atf_check_equal $? 1
+	xbps-rindex -d -a --compression zstd -j 2 $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root --repository=$PWD/repo -yd foo bar
+	atf_check_equal $? 0
+	xbps-pkgdb -r root -a
+	atf_check_equal $? 0
+}
+
+atf_test_case seekable
+
+seekable_head() {
+	atf_set "descr" "xbps-create(1): seekable pkgs with a member index"
+}
+
+seekable_body() {
+	mkdir -p repo pkg_A/usr/bin pkg_A/usr/share/foo
+	echo 123456789 > pkg_A/usr/bin/foo
+	ln pkg_A/usr/bin/foo pkg_A/usr/bin/foo2
+	ln -s foo pkg_A/usr/bin/foo3
+	for f in $(seq 1 16); do
+		seq 1 $((f * 10000)) > pkg_A/usr/share/foo/file$f
+	done
+	cd repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" --compression gzip --seekable ../pkg_A
+	atf_check_equal $? 1
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" --seekable ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	result="$(xbps-query -r root --repository=$PWD/repo -p seekable foo)"
+	atf_check_equal "$result" yes
+	xbps-install -r root --repository=$PWD/repo -yd foo
+	atf_check_equal $? 0
+	xbps-pkgdb -r root foo
+	atf_check_equal $? 0
+	# corrupt the props.plist frame, files.plist must still be read
+	# from its own frame.
+	offset=$(tail -c 4096 repo/foo-1.0_1.noarch.xbps | strings | sed -n 's| ./props.plist$||p')
+	atf_check_equal $? 0
+	printf 'XXXXXXXX' | dd of=repo/foo-1.0_1.noarch.xbps bs=1 seek=$((offset + 16)) conv=notrunc
+	result="$(xbps-query -r root2 --repository=$PWD/repo -f foo | wc -l)"
+	atf_check_equal "$result" 19
+}
+
 atf_init_test_cases() {
 	atf_add_test_case hardlinks_size
 	atf_add_test_case symlink_relative_target
@@ -159,4 +297,9 @@ atf_init_test_cases() {
 	atf_add_test_case restore_mtime
 	atf_add_test_case reproducible_pkg
 	atf_add_test_case reject_fifo_file
+	atf_add_test_case hash_many_files
+	atf_add_test_case digest_blake2b
+	atf_add_test_case mutable_files
+	atf_add_test_case compress_threads
+	atf_add_test_case seekable
 }
@@ -167,9 +167,101 @@ stage_resolve_bug_body() {
 	atf_check_equal $? 1
 }
 
+atf_test_case many_pkgs
+
+many_pkgs_head() {
+	atf_set "descr" "xbps-rindex(1) -a: register many pkgs in argv order"
+}
+
+many_pkgs_body() {
+	mkdir -p some_repo pkg_A
+	touch pkg_A/file00
+	cd some_repo
+	for p in foo bar baz blah; do
+		for v in 1.0 2.0 1.1; do
+			xbps-create -A noarch -n $p-${v}_1 -s "$p pkg" ../pkg_A
+			atf_check_equal $? 0
+		done
+	done
+	echo junk > broken-1.0_1.noarch.xbps
+	xbps-rindex -d -a $PWD/foo-2.0_1.noarch.xbps $PWD/broken-1.0_1.noarch.xbps \
+		$PWD/foo-1.1_1.noarch.xbps $PWD/bar-1.0_1.noarch.xbps \
+		$PWD/bar-2.0_1.noarch.xbps $PWD/baz-1.1_1.noarch.xbps \
+		$PWD/blah-1.0_1.noarch.xbps $PWD/blah-1.1_1.noarch.xbps
+	atf_check_equal $? 0
+	cd ..
+	result="$(xbps-query -r root -C empty.conf --repository=some_repo -s '' | sort | tr '\n' ' ')"
+	expected="[-] bar-2.0_1 bar pkg [-] baz-1.1_1 baz pkg [-] blah-1.1_1 blah pkg [-] foo-2.0_1 foo pkg "
+	atf_check_equal "$result" "$expected"
+	xbps-install -r root -C empty.conf --repository=$PWD/some_repo -yd foo
+	atf_check_equal $? 0
+}
+
+atf_test_case memo
+
+memo_head() {
+	atf_set "descr" "xbps-rindex(1) -a: unchanged pkgs are not read again"
+}
+
+memo_body() {
+	mkdir -p some_repo pkg_A
+	touch pkg_A/file00
+	cd some_repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	# overwrite the pkg in place, keeping its size and mtime.
+	cp -p foo-1.0_1.noarch.xbps ref
+	dd if=/dev/zero of=foo-1.0_1.noarch.xbps bs=64 count=1 conv=notrunc
+	touch -r ref foo-1.0_1.noarch.xbps
+	result="$(xbps-rindex -d -a $PWD/foo-1.0_1.noarch.xbps 2>&1 | grep -c 'already registered')"
+	atf_check_equal "$result" 1
+	result="$(xbps-rindex -d -f -a $PWD/foo-1.0_1.noarch.xbps 2>&1 | grep -c 'failed to read')"
+	atf_check_equal "$result" 1
+}
+
+atf_test_case sign_pkgs
+
+sign_pkgs_head() {
+	atf_set "descr" "xbps-rindex(1) -S: sign many pkgs, skipping signed ones"
+}
+
+sign_pkgs_body() {
+	command -v openssl >/dev/null || atf_skip "openssl(1) not found"
+	openssl genrsa -traditional -out privkey.pem 2048 || \
+		openssl genrsa -out privkey.pem 2048
+	atf_check_equal $? 0
+	mkdir -p some_repo pkg_A
+	touch pkg_A/file00
+	cd some_repo
+	for i in 1 2 3 4 5 6 7 8; do
+		xbps-create -A noarch -n foo$i-1.0_1 -s "foo$i pkg" ../pkg_A
+		atf_check_equal $? 0
+	done
+	xbps-rindex -S --privkey ../privkey.pem foo1-1.0_1.noarch.xbps
+	atf_check_equal $? 0
+	cp foo1-1.0_1.noarch.xbps.sig ref.sig
+	xbps-rindex -v -S --privkey ../privkey.pem $PWD/*.xbps 2>err
+	atf_check_equal $? 0
+	result="$(ls *.xbps.sig | wc -l)"
+	atf_check_equal $result 8
+	result="$(grep -c 'skipping' err)"
+	atf_check_equal $result 1
+	cmp ref.sig foo1-1.0_1.noarch.xbps.sig
+	atf_check_equal $? 0
+	xbps-rindex -v -S --privkey ../privkey.pem $PWD/*.xbps 2>err
+	atf_check_equal $? 0
+	result="$(grep -c 'skipping' err)"
+	atf_check_equal $result 8
+}
+
 atf_init_test_cases() {
 	atf_add_test_case update
 	atf_add_test_case revert
 	atf_add_test_case stage
 	atf_add_test_case stage_resolve_bug
+	atf_add_test_case many_pkgs
+	atf_add_test_case memo
+	atf_add_test_case sign_pkgs
 }
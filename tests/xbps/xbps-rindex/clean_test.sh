@@ -79,8 +79,39 @@ remove_from_stage_body() {
 	atf_check_equal $? 1
 }
 
+atf_test_case hashcheck
+
+hashcheck_head() {
+	atf_set "descr" "xbps-rindex(1) -c -C: remove pkgs with mismatched hash test"
+}
+
+hashcheck_body() {
+	mkdir -p some_repo pkg_A pkg_B
+	touch pkg_A/file00 pkg_B/file01
+	cd some_repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n bar-1.0_1 -s "bar pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	echo "corrupted" > bar-1.0_1.noarch.xbps
+	cd ..
+	xbps-rindex -c some_repo
+	atf_check_equal $? 0
+	result=$(xbps-query -r root -C empty.conf --repository=some_repo -s bar|wc -l)
+	atf_check_equal ${result} 1
+	xbps-rindex -C -c some_repo
+	atf_check_equal $? 0
+	result=$(xbps-query -r root -C empty.conf --repository=some_repo -s bar|wc -l)
+	atf_check_equal ${result} 0
+	result=$(xbps-query -r root -C empty.conf --repository=some_repo -s foo|wc -l)
+	atf_check_equal ${result} 1
+}
+
 atf_init_test_cases() {
 	atf_add_test_case noremove
 	atf_add_test_case issue19
 	atf_add_test_case remove_from_stage
+	atf_add_test_case hashcheck
 }